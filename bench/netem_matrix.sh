@@ -0,0 +1,49 @@
+#!/bin/sh
+# Benchmark matrix: every socket tuning profile under several emulated
+# latencies on loopback. Needs root (tc netem on lo).
+#
+# Usage: bench/netem_matrix.sh BUILD_DIR [loadgen args...]
+# Env:   DELAYS   one-way delays in ms (default "0 5 25")
+#        PROFILES profiles to compare (default "none default latency bulk")
+
+set -u
+BUILD_DIR=$(cd "${1:?usage: $0 BUILD_DIR [loadgen args...]}" && pwd)
+shift
+DELAYS=${DELAYS:-"0 5 25"}
+PROFILES=${PROFILES:-"none default latency bulk"}
+RUN_DIR="$BUILD_DIR/netem_run"
+
+if ! command -v tc >/dev/null 2>&1; then
+    echo "tc not found; install iproute2." >&2
+    exit 1
+fi
+
+cleanup() {
+    tc qdisc del dev lo root 2>/dev/null
+    [ -f "$RUN_DIR/server.pid" ] && kill "$(cat "$RUN_DIR/server.pid")" 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+printf "%-8s %-8s %10s %10s %12s %12s %12s\n" delay profile ops/s MiB/s list_p50_us list_p99_us dl_p99_us
+for delay in $DELAYS; do
+    tc qdisc del dev lo root 2>/dev/null
+    if [ "$delay" != 0 ] && ! tc qdisc add dev lo root netem delay "${delay}ms" limit 100000; then
+        echo "${delay}ms: netem unavailable (is sch_netem loaded?), skipped" >&2
+        continue
+    fi
+    for profile in $PROFILES; do
+        rm -rf "$RUN_DIR" && mkdir -p "$RUN_DIR"
+        (cd "$RUN_DIR" && exec "$BUILD_DIR/server" --profile "$profile" > server.log 2>&1) &
+        echo $! > "$RUN_DIR/server.pid"
+        sleep 1
+        "$BUILD_DIR/loadgen" --profile "$profile" "$@" > "$RUN_DIR/loadgen.log" 2>&1
+        kill "$(cat "$RUN_DIR/server.pid")" 2>/dev/null
+        wait 2>/dev/null
+        awk -v delay="${delay}ms" -v profile="$profile" '
+            $1 == "list"     { lp50 = $4; lp99 = $5 }
+            $1 == "download" { dp99 = $5 }
+            $1 == "throughput:" { ops = $2; mib = $4 }
+            END { printf "%-8s %-8s %10s %10s %12s %12s %12s\n", delay, profile, ops, mib, lp50, lp99, dp99 }
+        ' "$RUN_DIR/loadgen.log"
+    done
+done
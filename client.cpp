@@ -6,6 +6,11 @@
  * 1. LIST: Listing remote files.
  * 2. DOWNLOAD: Downloading files from the server.
  * 3. UPLOAD: Uploading files to the server.
+ * 4. PGET: Downloading a file over several connections at once, each
+ *    block checked against the file's Merkle tree (TREE).
+ * 5. VERSIONS / RESTORE: Listing a file's kept versions and making one
+ *    current again; "download <file>@<version>" fetches an old version.
+ * 6. STATS: Showing server-side counters and latency percentiles.
  *
  * Supports Windows (Winsock) and POSIX (Linux/macOS) sockets.
  */
@@ -16,145 +21,228 @@
 #include <fstream>
 #include <sstream>
 #include <cstring>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <filesystem> // For directory creation
 
-// --- Platform-Specific Includes ---
-#ifdef _WIN32
-    // Windows (Winsock)
-    #include <winsock2.h>
-    #include <ws2tcpip.h>
-    #pragma comment(lib, "ws2_32.lib") // Link against the Winsock library
-    typedef SOCKET SocketType;
-    #define CLOSE_SOCKET(s) closesocket(s)
-#else
-    // POSIX (Linux/macOS)
-    #include <sys/socket.h>
-    #include <netinet/in.h>
-    #include <arpa/inet.h>
-    #include <unistd.h>
-    typedef int SocketType;
-    #define CLOSE_SOCKET(s) close(s)
-#endif
-// --- End Platform-Specific ---
+#include "libfileshare/buffer_pool.h"
+#include "libfileshare/checksum.h"
+#include "libfileshare/flow_control.h"
+#include "libfileshare/merkle.h"
+#include "libfileshare/platform.h"
+#include "libfileshare/protocol.h"
+#include "libfileshare/socket_tuning.h"
+#include "libfileshare/transport.h"
 
 // --- Configuration ---
 const char* HOST = "127.0.0.1";
 const int PORT = 9999;
-const int BUFFER_SIZE = 4096;
+const size_t BUFFER_SIZE = BUFFER_CAPACITY;   // Bytes per transfer chunk
 const char* CLIENT_FILES_DIR = "client_files";
+const uint64_t DOWNLOAD_WINDOW = DEFAULT_TRANSFER_WINDOW;  // Bytes the server may have in flight
 const std::string ENCRYPTION_KEY = "mysecretkey";
+const int MAX_BUSY_RETRIES = 5;               // Reconnects after "BUSY retry-after N"
+const int RECV_TIMEOUT_SEC = 30;              // Give up on a reply or data stalled this long
+const int PING_INTERVAL_SEC = 60;             // Keeps an idle session under the server's idle timeout
+const char* TUNING_PROFILE = "default";       // See libfileshare/socket_tuning.h
+const bool USE_STARTTLS = true;               // Encrypt the session after AUTH (kTLS where available)
+const bool VERIFY_CHECKSUMS = true;           // CRC32C per chunk and per file on transfers
+const int MAX_REPAIR_ATTEMPTS = 3;            // Re-fetches of a chunk that failed its checksum
+const size_t PARALLEL_SEGMENTS = 4;           // Connections used by pget unless told otherwise
 // --- End Configuration ---
 
 /**
- * @brief "Encrypts" or "Decrypts" data using a simple XOR cipher.
- * This is NOT secure and is for educational purposes only.
+ * @brief Sends a command (string) to the server as one encrypted frame.
  */
-std::string encryptDecrypt(const std::string& data) {
-    std::string result = data;
-    for (size_t i = 0; i < data.size(); ++i) {
-        result[i] = data[i] ^ ENCRYPTION_KEY[i % ENCRYPTION_KEY.size()];
+bool sendCommand(Connection& conn, const std::string& cmd) {
+    return conn.sendFrame(cmd);
+}
+
+// Set when a reply on an authenticated session is "BUSY retry-after N": the
+// server is draining for a restart or upgrade and has ended the session.
+// The command loop then resumes on a new connection and runs the command
+// again. (A BUSY to AUTH or RESUME is admission control instead.)
+std::atomic<bool> serverDraining{false};
+
+/**
+ * @brief Receives one response frame from the server, with decryption.
+ */
+std::string receiveResponse(Connection& conn) {
+    std::string payload;
+    if (!conn.recvFrame(payload)) {
+        return ""; // Connection closed or error
     }
-    return result;
+    int retryAfterSec = 0;
+    if (parseBusyReply(payload, retryAfterSec)) serverDraining.store(true);
+    return payload;
 }
 
 /**
- * @brief Sends a command (string) to the server, with encryption.
+ * @brief Handles the LIST command response.
  */
-bool sendCommand(SocketType sock, const std::string& cmd) {
-    std::string encryptedCmd = encryptDecrypt(cmd);
-    return send(sock, encryptedCmd.c_str(), encryptedCmd.length(), 0) > 0;
+void handleList(Connection& conn) {
+    std::string response = receiveResponse(conn);
+    if (serverDraining.load()) return;   // Run again on the next session
+    std::cout << response << std::endl;
 }
 
 /**
- * @brief Receives a response from the server, with decryption.
+ * @brief Receives length bytes of file data and writes them at offset,
+ * returning credit as they are written. With checksums each chunk is
+ * followed by its CRC frame: fileCrc accumulates the server's CRCs and
+ * chunks that do not match theirs are added to damaged.
+ * @return false if the connection was lost.
  */
-std::string receiveResponse(SocketType sock) {
-    char buffer[BUFFER_SIZE] = {0};
-    int bytesReceived = recv(sock, buffer, BUFFER_SIZE, 0);
-    if (bytesReceived <= 0) {
-        return ""; // Connection closed or error
+bool receiveFileData(Connection& conn, std::ofstream& outFile, uint64_t offset, uint64_t length, bool checksums,
+                     uint32_t& fileCrc, std::vector<ChunkChecksum>& damaged) {
+    if (outFile.is_open()) outFile.seekp(offset, std::ios_base::beg);
+    ReceiveWindow window(DOWNLOAD_WINDOW, length);
+    Buffer chunk = Buffer::acquire();
+    std::string crcFrame;
+    uint64_t received = 0;
+    while (received < length) {
+        if (!conn.recvFrame(chunk)) return false;
+        if (checksums) {
+            uint32_t crc = 0;
+            if (!conn.recvFrame(crcFrame) || !parseCrcFrame(crcFrame, crc)) return false;
+            if (crc32c(0, chunk.data(), chunk.size()) != crc) damaged.push_back({offset + received, chunk.size(), crc});
+            fileCrc = crc32cCombine(fileCrc, crc, chunk.size());
+        }
+
+        // Ensure we don't write more bytes than expected
+        uint64_t bytesToWrite = std::min<uint64_t>(chunk.size(), length - received);
+        if (outFile.is_open()) outFile.write(chunk.data(), bytesToWrite);
+        received += bytesToWrite;
+
+        uint64_t grant = window.consume(bytesToWrite);
+        if (grant > 0 && !sendCredit(conn, grant)) return false;
     }
-    return encryptDecrypt(std::string(buffer, bytesReceived));
+    return true;
 }
 
 /**
- * @brief Handles the LIST command response.
+ * @brief Fetches a damaged chunk again with RANGE until it hashes to the
+ * CRC it was first sent with, and writes it in place.
  */
-void handleList(SocketType sock) {
-    std::string response = receiveResponse(sock);
-    std::cout << response << std::endl;
+bool repairChunk(Connection& conn, std::ofstream& outFile, const std::string& filename, const ChunkChecksum& bad) {
+    for (int attempt = 0; attempt < MAX_REPAIR_ATTEMPTS; ++attempt) {
+        sendCommand(conn, "RANGE " + filename + " " + std::to_string(bad.offset) + " " + std::to_string(bad.length) +
+                          " " + std::to_string(DOWNLOAD_WINDOW) + " " + CHECKSUM_NAME);
+        std::string response = receiveResponse(conn);
+        CommandView reply = tokenizeCommand(response);
+        uint64_t length = 0;
+        if (reply.verbText != "OK_RANGE" || !parseNumber(reply.arg(0), length) || length != bad.length) return false;
+        uint32_t rangeCrc = 0;
+        std::vector<ChunkChecksum> stillDamaged;
+        if (!receiveFileData(conn, outFile, bad.offset, bad.length, true, rangeCrc, stillDamaged)) return false;
+        std::string done = receiveResponse(conn);
+        if (tokenizeCommand(done).verbText != "DOWNLOAD_DONE") return false;
+        if (stillDamaged.empty() && rangeCrc == bad.crc) return true;
+    }
+    return false;
 }
 
 /**
  * @brief Handles the DOWNLOAD command logic.
  */
-void handleDownload(SocketType sock, const std::string& filename) {
-    std::string response = receiveResponse(sock);
-    std::stringstream ss(response);
-    std::string command;
-    ss >> command;
+void handleDownload(Connection& conn, const std::string& filename) {
+    // 1. Request the file, advertising how much data may be in flight
+    sendCommand(conn, "DOWNLOAD " + filename + " " + std::to_string(DOWNLOAD_WINDOW) +
+                      (VERIFY_CHECKSUMS ? std::string(" ") + CHECKSUM_NAME : ""));
+
+    std::string response = receiveResponse(conn);
+    CommandView reply = tokenizeCommand(response);
+    long long fileSize = 0;
 
-    if (command == "OK_DOWNLOAD") {
-        long long fileSize;
-        ss >> fileSize;
+    if (reply.verbText == "OK_DOWNLOAD" && parseNumber(reply.arg(0), fileSize)) {
         std::cout << "[+] Server OK. File size: " << fileSize << " bytes." << std::endl;
         std::string filepath = std::string(CLIENT_FILES_DIR) + "/" + filename;
         std::ofstream outFile(filepath, std::ios_base::binary); // <-- FIX: std::ios to std::ios_base
 
+        // The server is already streaming; if we cannot write, drain and discard.
         if (!outFile.is_open()) {
             std::cerr << "[-] Error: Could not open file for writing: " << filepath << std::endl;
-            sendCommand(sock, "CANCEL"); // Tell server to stop
-            return;
         }
 
-        // 2. Tell server we are ready
-        sendCommand(sock, "START");
-
-        // 3. Receive file data in chunks
-        long long bytesReceived = 0;
+        // 2. Receive file data in chunks, returning credit as it is written
         std::cout << "[+] Downloading " << filename << "..." << std::endl;
-        while (bytesReceived < fileSize) {
-            std::string chunk = receiveResponse(sock);
-            if (chunk.empty()) {
-                std::cerr << "[-] Error: Connection lost during download." << std::endl;
-                break;
+        uint32_t fileCrc = 0;
+        std::vector<ChunkChecksum> damaged;
+        if (!receiveFileData(conn, outFile, 0, fileSize, VERIFY_CHECKSUMS, fileCrc, damaged)) {
+            std::cerr << "[-] Error: Connection lost during download." << std::endl;
+            std::cerr << "[-] Download failed. Incomplete file." << std::endl;
+            return;
+        }
+        // FIX: Wait for the final "DOWNLOAD_DONE" signal from the server
+        std::string doneSignal = receiveResponse(conn);
+        CommandView done = tokenizeCommand(doneSignal);
+        if (done.verbText != "DOWNLOAD_DONE") {
+            std::cout << "[+] Warning: Did not receive final DONE signal. Got: " << doneSignal << std::endl;
+        }
+        if (!outFile.is_open()) return;
+
+        // 3. Verify: the chunk CRCs must add up to the server's file CRC, and
+        // chunks that did not match theirs are fetched again.
+        if (VERIFY_CHECKSUMS) {
+            uint32_t expected = 0;
+            if (!parseCrc(done.arg(0), expected) || expected != fileCrc) {
+                std::cerr << "[-] Checksum mismatch: file CRC " << crcToHex(fileCrc) << ", server sent "
+                          << done.arg(0) << "." << std::endl;
+                return;
             }
-            
-            // FIX: Removed the logic that was incorrectly checking for DOWNLOAD_DONE here.
-            // That signal comes after the loop.
-
-            // Ensure we don't write more bytes than expected
-            long long bytesToWrite = chunk.length();
-            if (bytesReceived + bytesToWrite > fileSize) {
-                bytesToWrite = fileSize - bytesReceived;
-                chunk = chunk.substr(0, bytesToWrite);
+            for (const ChunkChecksum& bad : damaged) {
+                std::cerr << "[-] Chunk at offset " << bad.offset << " failed its checksum; fetching it again."
+                          << std::endl;
+                if (!repairChunk(conn, outFile, filename, bad)) {
+                    std::cerr << "[-] Download failed: could not repair chunk at offset " << bad.offset << "."
+                              << std::endl;
+                    return;
+                }
             }
-
-            outFile.write(chunk.c_str(), bytesToWrite);
-            bytesReceived += bytesToWrite;
         }
         outFile.close();
+        std::cout << "[+] Download complete: " << filepath;
+        if (VERIFY_CHECKSUMS) std::cout << " (crc32c " << crcToHex(fileCrc) << " verified)";
+        std::cout << std::endl;
 
-        if (bytesReceived >= fileSize) {
-            std::cout << "[+] Download complete: " << filepath << std::endl;
-            // FIX: Wait for the final "DOWNLOAD_DONE" signal from the server
-            std::string done_signal = receiveResponse(sock);
-            if (done_signal != "DOWNLOAD_DONE") {
-                std::cout << "[+] Warning: Did not receive final DONE signal. Got: " << done_signal << std::endl;
-            }
-        } else {
-            std::cerr << "[-] Download failed. Incomplete file." << std::endl;
-        }
-
-    } else {
+    } else if (!serverDraining.load()) {
         std::cout << "[-] Server error: " << response << std::endl;
     }
 }
 
+/**
+ * @brief Sends length bytes of file from offset as chunks, each followed
+ * by its CRC frame when checksums are on. fileCrc accumulates the CRCs.
+ */
+bool sendFileData(Connection& conn, std::ifstream& file, Buffer& chunk, uint64_t offset, uint64_t length,
+                  bool checksums, uint32_t& fileCrc) {
+    file.clear();
+    file.seekg(offset, std::ios_base::beg);
+    std::string crcFrame;
+    while (length > 0) {
+        uint64_t n = std::min<uint64_t>(BUFFER_SIZE, length);
+        if (!file.read(chunk.data(), n)) return false;
+        chunk.setSize(n);
+        if (checksums) {
+            uint32_t crc = crc32c(0, chunk.data(), n);
+            formatCrcFrame(crc, crcFrame);
+            fileCrc = crc32cCombine(fileCrc, crc, n);
+        }
+        if (!conn.sendFrame(chunk, checksums ? &crcFrame : nullptr)) return false;
+        length -= n;
+    }
+    return true;
+}
+
 /**
  * @brief Handles the UPLOAD command logic.
  */
-void handleUpload(SocketType sock, const std::string& filename) {
+void handleUpload(Connection& conn, const std::string& filename) {
     std::string filepath = std::string(CLIENT_FILES_DIR) + "/" + filename;
     std::ifstream file(filepath, std::ios_base::binary | std::ios_base::ate); // <-- FIX: std::ios to std::ios_base
 
@@ -167,70 +255,125 @@ void handleUpload(SocketType sock, const std::string& filename) {
     file.seekg(0, std::ios_base::beg); // <-- FIX: std::ios to std::ios_base
 
     // 1. Send UPLOAD command with filename and size
-    sendCommand(sock, "UPLOAD " + filename + " " + std::to_string(fileSize));
-
-    // 2. Wait for server OK
-    std::string response = receiveResponse(sock);
-    if (response != "OK_UPLOAD") {
-        std::cerr << "[-] Server error: " << response << std::endl;
+    sendCommand(conn, "UPLOAD " + filename + " " + std::to_string(fileSize) +
+                      (VERIFY_CHECKSUMS ? std::string(" ") + CHECKSUM_NAME : ""));
+
+    // 2. Wait for server OK, which carries our initial credit
+    std::string response = receiveResponse(conn);
+    CommandView reply = tokenizeCommand(response);
+    uint64_t window = 0;
+    if (reply.verbText != "OK_UPLOAD" || !parseNumber(reply.arg(0), window) || window == 0) {
+        if (!serverDraining.load()) std::cerr << "[-] Server error: " << response << std::endl;
         return;
     }
 
-    // 3. Send file data in chunks
+    // 3. Send file data in chunks, never exceeding the server's credit
     std::cout << "[+] Uploading " << filename << " (" << fileSize << " bytes)..." << std::endl;
-    char fileBuffer[BUFFER_SIZE / 2]; // Smaller chunks for sending
-    while (file.read(fileBuffer, sizeof(fileBuffer)) || file.gcount() > 0) {
-        std::string chunk(fileBuffer, file.gcount());
-        if (!sendCommand(sock, chunk)) {
+    SendCredit credit(window);
+    Buffer chunk = Buffer::acquire();
+    uint32_t fileCrc = 0;
+    uint64_t remaining = fileSize;
+    while (remaining > 0) {
+        uint64_t allowed = credit.allowance(BUFFER_SIZE, remaining);
+        if (allowed == 0) {
+            if (!receiveCredit(conn, response, credit)) {
+                std::cerr << "[-] Error: Connection lost during upload." << std::endl;
+                return;
+            }
+            continue;
+        }
+        if (!sendFileData(conn, file, chunk, fileSize - remaining, allowed, VERIFY_CHECKSUMS, fileCrc)) {
+            std::cerr << "[-] Error: Connection lost during upload." << std::endl;
+            return;
+        }
+        credit.consume(allowed);
+        remaining -= allowed;
+    }
+
+    // 4. Resend chunks the server found damaged, then wait for confirmation
+    while (true) {
+        response = receiveResponse(conn);
+        reply = tokenizeCommand(response);
+        uint64_t offset = 0, length = 0;
+        if (reply.verbText != "RESEND" || !parseNumber(reply.arg(0), offset) || !parseNumber(reply.arg(1), length)) {
+            break;
+        }
+        std::cerr << "[-] Server asked again for " << length << " bytes at offset " << offset << "." << std::endl;
+        uint32_t ignored = 0;
+        if (!sendFileData(conn, file, chunk, offset, length, VERIFY_CHECKSUMS, ignored)) {
             std::cerr << "[-] Error: Connection lost during upload." << std::endl;
             return;
         }
     }
     file.close();
 
-    // 4. Wait for final confirmation
-    response = receiveResponse(sock);
+    uint32_t serverCrc = 0;
+    if (VERIFY_CHECKSUMS && reply.verbText == "UPLOAD_SUCCESS") {
+        if (parseCrc(reply.arg(0), serverCrc) && serverCrc == fileCrc) {
+            std::cout << "[+] Server response: UPLOAD_SUCCESS (crc32c " << crcToHex(fileCrc) << " verified)"
+                      << std::endl;
+        } else {
+            std::cerr << "[-] Checksum mismatch: file CRC " << crcToHex(fileCrc) << ", server has "
+                      << reply.arg(0) << "." << std::endl;
+        }
+        return;
+    }
     std::cout << "[+] Server response: " << response << std::endl;
 }
 
 /**
- * @brief Initializes platform-specific networking (e.g., Winsock).
- * @return 0 on success, -1 on failure.
+ * @brief Pings the server in the background so a user idling at the prompt
+ * is not reaped by the server's idle deadline. Commands and pings take turns
+ * through the session mutex, so frames never interleave.
  */
-int initialize_networking() {
-#ifdef _WIN32
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        std::cerr << "WSAStartup failed." << std::endl;
-        return -1;
+class IdlePinger {
+public:
+    IdlePinger(Connection& conn, std::mutex& sessionMutex)
+        : conn_(conn), sessionMutex_(sessionMutex), thread_(&IdlePinger::run, this) {}
+
+    ~IdlePinger() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
     }
-#endif
-    return 0;
-}
 
-/**
- * @brief Cleans up platform-specific networking.
- */
-void cleanup_networking() {
-#ifdef _WIN32
-    WSACleanup();
-#endif
-}
+    bool connectionLost() const { return lost_.load(); }
 
-/**
- * @brief Main function to run the client.
- */
-int main() {
-    if (initialize_networking() != 0) {
-        return 1;
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!wake_.wait_for(lock, std::chrono::seconds(PING_INTERVAL_SEC), [&] { return stopping_; })) {
+            std::lock_guard<std::mutex> session(sessionMutex_);
+            if (!sendCommand(conn_, "PING") || receiveResponse(conn_) != "PONG") {
+                lost_.store(!serverDraining.load());   // A drained session is resumed before the next command
+                return;
+            }
+        }
     }
 
+    Connection& conn_;
+    std::mutex& sessionMutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::atomic<bool> lost_{false};
+    std::thread thread_;
+};
+
+/**
+ * @brief Opens a TCP connection to the server. Returns null on failure.
+ */
+std::unique_ptr<Connection> connectToServer() {
     SocketType sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) { // Or INVALID_SOCKET
         std::cerr << "[-] Failed to create socket." << std::endl;
-        cleanup_networking();
-        return 1;
+        return nullptr;
     }
+    auto conn = std::make_unique<Connection>(sock, ENCRYPTION_KEY);
+    setReceiveTimeout(sock, RECV_TIMEOUT_SEC);
 
     sockaddr_in serverAddr;
     serverAddr.sin_family = AF_INET;
@@ -239,32 +382,354 @@ int main() {
 
     if (connect(sock, (sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
         std::cerr << "[-] Connection failed. Is the server running?" << std::endl;
-        CLOSE_SOCKET(sock);
-        cleanup_networking();
-        return 1;
+        return nullptr;
     }
+    applyTuningProfile(sock, *findTuningProfile(TUNING_PROFILE));
 
     std::cout << "[+] Connected to server at " << HOST << ":" << PORT << std::endl;
+    return conn;
+}
+
+/**
+ * @brief Opens and authenticates another session, encrypted like the
+ * first, for a parallel download: with RESUME if there is a ticket, with
+ * AUTH if there is none or the server turns it down. Returns null on failure.
+ */
+std::unique_ptr<Connection> openSession(const std::string& user, const std::string& pass,
+                                        const std::string& ticket) {
+    std::unique_ptr<Connection> conn = connectToServer();
+    if (!conn) return nullptr;
+    // Read directly: a BUSY here is admission control, not a drain (see serverDraining).
+    std::string reply;
+    bool resumed = false;
+    if (!ticket.empty()) {
+        sendCommand(*conn, "RESUME " + ticket);
+        resumed = conn->recvFrame(reply) && reply == "RESUMED";
+    }
+    if (!resumed) {
+        sendCommand(*conn, "AUTH " + user + " " + pass);
+        if (!conn->recvFrame(reply) || tokenizeCommand(reply).verbText != "AUTH_SUCCESS") return nullptr;
+    }
+    if (USE_STARTTLS && !requestSecureTransport(*conn, ENCRYPTION_KEY)) return nullptr;
+    return conn;
+}
+
+/**
+ * @brief Fetches a file's Merkle tree with TREE, a page of leaves at a
+ * time, and checks the leaves against the root.
+ */
+bool fetchTree(Connection& conn, const std::string& filename, TreeInfo& info, std::vector<Hash256>& leaves) {
+    leaves.clear();
+    do {
+        size_t before = leaves.size();
+        sendCommand(conn, "TREE " + filename + " " + std::to_string(before));
+        std::string response = receiveResponse(conn);
+        if (!parseTreeReply(response, info, leaves)) {
+            if (!serverDraining.load()) std::cerr << "[-] Server error: " << response.substr(0, 120) << std::endl;
+            return false;
+        }
+        if (leaves.size() == before && leaves.size() < info.leafCount) return false;
+    } while (leaves.size() < info.leafCount);
+    if (info.leafCount != (info.size + info.blockSize - 1) / info.blockSize || merkleRoot(leaves) != info.root) {
+        std::cerr << "[-] Merkle tree for " << filename << " does not match its root." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Downloads blocks [firstLeaf, lastLeaf) with RANGE into file,
+ * hashing each as it arrives; blocks that do not match their leaf, or
+ * never arrived, are added to failed.
+ * @return false if the connection can no longer be used.
+ */
+bool fetchVerifiedRange(Connection& conn, const std::string& filename, std::fstream& file, const TreeInfo& info,
+                        const std::vector<Hash256>& leaves, uint64_t firstLeaf, uint64_t lastLeaf,
+                        std::vector<uint64_t>& failed) {
+    uint64_t offset = firstLeaf * info.blockSize;
+    uint64_t length = std::min(info.size, lastLeaf * info.blockSize) - offset;
+    uint64_t leaf = firstLeaf;
+    auto giveUp = [&](bool usable) {
+        for (; leaf < lastLeaf; ++leaf) failed.push_back(leaf);
+        return usable;
+    };
+    sendCommand(conn, "RANGE " + filename + " " + std::to_string(offset) + " " + std::to_string(length) + " " +
+                      std::to_string(DOWNLOAD_WINDOW));
+    std::string response = receiveResponse(conn);
+    CommandView reply = tokenizeCommand(response);
+    uint64_t announced = 0;
+    if (response.empty()) return giveUp(false);
+    if (reply.verbText != "OK_RANGE" || !parseNumber(reply.arg(0), announced) || announced != length) {
+        return giveUp(true);
+    }
+
+    file.seekp(offset, std::ios_base::beg);
+    ReceiveWindow window(DOWNLOAD_WINDOW, length);
+    Buffer chunk = Buffer::acquire();
+    Sha256 sha;
+    uint64_t received = 0, blockFill = 0;
+    while (received < length) {
+        if (!conn.recvFrame(chunk) || chunk.size() > length - received) return giveUp(false);
+        file.write(chunk.data(), chunk.size());
+        const char* data = chunk.data();
+        size_t left = chunk.size();
+        while (left > 0) {
+            uint64_t blockLength = std::min(info.blockSize, info.size - leaf * info.blockSize);
+            size_t take = static_cast<size_t>(std::min<uint64_t>(left, blockLength - blockFill));
+            if (blockFill == 0) sha.update("", 1);   // The leaf prefix byte, 0x00
+            sha.update(data, take);
+            data += take;
+            left -= take;
+            blockFill += take;
+            if (blockFill == blockLength) {
+                if (sha.finish() != leaves[leaf]) failed.push_back(leaf);
+                ++leaf;
+                blockFill = 0;
+            }
+        }
+        received += chunk.size();
+        uint64_t grant = window.consume(chunk.size());
+        if (grant > 0 && !sendCredit(conn, grant)) return giveUp(false);
+    }
+    return tokenizeCommand(receiveResponse(conn)).verbText == "DOWNLOAD_DONE" || giveUp(false);
+}
+
+/**
+ * @brief Handles pget: fetches the Merkle tree, downloads contiguous
+ * segments over parallel sessions, then fetches failed blocks again on
+ * the main session.
+ */
+void handleParallelDownload(Connection& conn, const std::string& filename, size_t segments,
+                            const std::string& user, const std::string& pass, const std::string& ticket) {
+    TreeInfo info;
+    std::vector<Hash256> leaves;
+    if (!fetchTree(conn, filename, info, leaves)) return;
+
+    std::string filepath = std::string(CLIENT_FILES_DIR) + "/" + filename;
+    std::error_code ec;
+    {
+        std::ofstream create(filepath, std::ios_base::binary | std::ios_base::trunc);
+        if (!create.is_open()) {
+            std::cerr << "[-] Error: Could not open file for writing: " << filepath << std::endl;
+            return;
+        }
+    }
+    std::filesystem::resize_file(filepath, info.size, ec);
+    if (ec) {
+        std::cerr << "[-] Error: Could not size " << filepath << ": " << ec.message() << std::endl;
+        return;
+    }
+
+    size_t count = static_cast<size_t>(std::min<uint64_t>(std::max<size_t>(segments, 1), info.leafCount));
+    std::cout << "[+] " << filename << ": " << info.size << " bytes in " << info.leafCount << " blocks, root "
+              << hashToHex(info.root).substr(0, 16) << "... Fetching " << count << " segment(s)." << std::endl;
+
+    // Segment i covers leaves [leafCount * i / count, leafCount * (i + 1) / count).
+    std::vector<std::vector<uint64_t>> failed(count);
+    auto fetchSegment = [&](size_t i, Connection* session) {
+        uint64_t first = info.leafCount * i / count, last = info.leafCount * (i + 1) / count;
+        std::fstream file(filepath, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+        if (!session || !file.is_open()) {
+            for (uint64_t leaf = first; leaf < last; ++leaf) failed[i].push_back(leaf);
+            return session != nullptr;
+        }
+        return fetchVerifiedRange(*session, filename, file, info, leaves, first, last, failed[i]);
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < count; ++i) {
+        workers.emplace_back([&, i] {
+            std::unique_ptr<Connection> extra = openSession(user, pass, ticket);
+            if (fetchSegment(i, extra.get())) sendCommand(*extra, "QUIT");
+        });
+    }
+    bool usable = count == 0 || fetchSegment(0, &conn);
+    for (std::thread& worker : workers) worker.join();
+
+    // Fetch failed blocks again, a run of consecutive ones per RANGE.
+    std::vector<uint64_t> retry;
+    for (const auto& segment : failed) retry.insert(retry.end(), segment.begin(), segment.end());
+    std::sort(retry.begin(), retry.end());
+    size_t refetched = retry.size();
+    for (int attempt = 0; usable && !retry.empty() && attempt < MAX_REPAIR_ATTEMPTS; ++attempt) {
+        std::cerr << "[-] " << retry.size() << " block(s) missing or failed verification; fetching them again."
+                  << std::endl;
+        std::fstream file(filepath, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+        std::vector<uint64_t> stillFailed;
+        for (size_t i = 0; usable && i < retry.size();) {
+            size_t j = i + 1;
+            while (j < retry.size() && retry[j] == retry[j - 1] + 1) ++j;
+            usable = fetchVerifiedRange(conn, filename, file, info, leaves, retry[i], retry[j - 1] + 1, stillFailed);
+            i = j;
+        }
+        retry.swap(stillFailed);
+    }
+    if (!usable) {
+        std::cerr << "[-] Error: Connection lost during download." << std::endl;
+        return;
+    }
+    if (!retry.empty()) {
+        std::cerr << "[-] Download failed: " << retry.size() << " block(s) could not be verified." << std::endl;
+        return;
+    }
+    std::cout << "[+] Download complete: " << filepath << " (" << count << " segment(s), " << refetched
+              << " block(s) fetched again, merkle root verified)" << std::endl;
+}
+
+/**
+ * @brief Runs one line typed at the prompt on conn.
+ * @return false once the user quits.
+ */
+bool runCommand(Connection& conn, const std::string& line, const std::string& user, const std::string& pass,
+                const std::string& ticket) {
+    std::stringstream ss(line);
+    std::string command;
+    ss >> command;
+
+    if (command.empty()) return true;
+
+    if (command == "list") {
+        std::string limit, after;
+        ss >> limit >> after;
+        sendCommand(conn, "LIST" + (limit.empty() ? "" : " " + limit + (after.empty() ? "" : " " + after)));
+        handleList(conn);
+    } else if (command == "versions") {
+        std::string filename;
+        ss >> filename;
+        if (filename.empty()) {
+            std::cout << "Usage: versions [filename]" << std::endl;
+            return true;
+        }
+        sendCommand(conn, "VERSIONS " + filename);
+        handleList(conn);
+    } else if (command == "restore") {
+        std::string filename, version;
+        ss >> filename >> version;
+        if (filename.empty() || version.empty()) {
+            std::cout << "Usage: restore [filename] [version]" << std::endl;
+            return true;
+        }
+        sendCommand(conn, "RESTORE " + filename + " " + version);
+        handleList(conn);
+    } else if (command == "stats") {
+        sendCommand(conn, "STATS");
+        handleList(conn); // Same shape: a single text response
+    } else if (command == "download") {
+        std::string filename;
+        ss >> filename;
+        if (filename.empty()) {
+            std::cout << "Usage: download [filename]" << std::endl;
+            return true;
+        }
+        handleDownload(conn, filename);
+    } else if (command == "pget") {
+        std::string filename;
+        size_t segments = 0;
+        ss >> filename;
+        if (!(ss >> segments) || segments == 0) segments = PARALLEL_SEGMENTS;
+        if (filename.empty()) {
+            std::cout << "Usage: pget [filename] [segments]" << std::endl;
+            return true;
+        }
+        handleParallelDownload(conn, filename, segments, user, pass, ticket);
+    } else if (command == "upload") {
+        std::string filename;
+        ss >> filename;
+        if (filename.empty()) {
+            std::cout << "Usage: upload [filename]" << std::endl;
+            return true;
+        }
+        handleUpload(conn, filename);
+    } else if (command == "quit") {
+        sendCommand(conn, "QUIT");
+        return false;
+    } else {
+        std::cout << "[-] Unknown command." << std::endl;
+    }
+    return true;
+}
+
+/**
+ * @brief Replaces a session the server ended while draining with a new one,
+ * to whichever server now accepts connections, resumed with the ticket.
+ */
+bool resumeDrainedSession(std::unique_ptr<Connection>& session, const std::string& user, const std::string& pass,
+                          const std::string& ticket) {
+    std::cout << "[*] Server is restarting; resuming the session..." << std::endl;
+    session->close();
+    serverDraining.store(false);
+    session = openSession(user, pass, ticket);
+    return session != nullptr;
+}
+
+/**
+ * @brief Main function to run the client.
+ */
+int main() {
+    if (initialize_networking() != 0) {
+        std::cerr << "WSAStartup failed." << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<Connection> session = connectToServer();
+    if (!session) {
+        cleanup_networking();
+        return 1;
+    }
 
     // --- Authentication ---
     bool isAuthenticated = false;
+    int busyRetries = 0;
+    std::string user, pass;
+    std::string ticket;   // From AUTH_SUCCESS; extra pget sessions RESUME with it
     while (!isAuthenticated) {
-        std::string user, pass;
-        std::cout << "Username: ";
-        std::getline(std::cin, user);
-        std::cout << "Password: ";
-        std::getline(std::cin, pass);
+        if (busyRetries == 0) {
+            std::cout << "Username: ";
+            std::getline(std::cin, user);
+            std::cout << "Password: ";
+            std::getline(std::cin, pass);
+        }
 
-        sendCommand(sock, "AUTH " + user + " " + pass);
-        std::string response = receiveResponse(sock);
+        sendCommand(*session, "AUTH " + user + " " + pass);
+        std::string response = receiveResponse(*session);
 
-        if (response == "AUTH_SUCCESS") {
+        int retryAfterSec = 0;
+        CommandView reply = tokenizeCommand(response);
+        if (reply.verbText == "AUTH_SUCCESS") {
             isAuthenticated = true;
+            ticket = std::string(reply.arg(0));
             std::cout << "[+] Authentication successful!" << std::endl;
+            if (USE_STARTTLS) {
+                if (requestSecureTransport(*session, ENCRYPTION_KEY)) {
+                    std::cout << "[+] Session encrypted (" << (session->kernelTx() ? "kernel" : "user-space")
+                              << " TLS)." << std::endl;
+                } else {
+                    std::cout << "[-] STARTTLS failed; continuing without it." << std::endl;
+                }
+            }
+        } else if (parseBusyReply(response, retryAfterSec)) {
+            // The server shed this connection; reconnect once it asks us to.
+            if (++busyRetries > MAX_BUSY_RETRIES) {
+                std::cerr << "[-] Server is busy. Giving up." << std::endl;
+                cleanup_networking();
+                return 1;
+            }
+            std::cout << "[-] Server is busy. Retrying in " << retryAfterSec << "s..." << std::endl;
+            std::this_thread::sleep_for(std::chrono::seconds(retryAfterSec));
+            session = connectToServer();
+            if (!session) {
+                cleanup_networking();
+                return 1;
+            }
+        } else if (response.empty()) {
+            std::cerr << "[-] Connection lost." << std::endl;
+            cleanup_networking();
+            return 1;
         } else {
+            busyRetries = 0;
             std::cout << "[-] Authentication failed. Please try again." << std::endl;
         }
     }
+    serverDraining.store(false);   // BUSY replies to AUTH were admission control, handled above
 
     // Ensure client files directory exists
     if (!std::filesystem::exists(CLIENT_FILES_DIR)) {
@@ -273,46 +738,38 @@ int main() {
     }
 
     // --- Command Loop ---
+    std::mutex sessionMutex;
+    auto pinger = std::make_unique<IdlePinger>(*session, sessionMutex);
     std::string line;
-    while (true) {
-        std::cout << "\n(list, upload [file], download [file], quit)\n> ";
+    bool running = true;
+    while (running) {
+        std::cout << "\n(list [limit] [after], upload [file], download [file[@version]], pget [file] [segments],\n"
+                     " versions [file], restore [file] [version], stats, quit)\n> ";
         std::getline(std::cin, line);
-        
-        std::stringstream ss(line);
-        std::string command;
-        ss >> command;
-
-        if (command.empty()) continue;
-
-        if (command == "list") {
-            sendCommand(sock, "LIST");
-            handleList(sock);
-        } else if (command == "download") {
-            std::string filename;
-            ss >> filename;
-            if (filename.empty()) {
-                std::cout << "Usage: download [filename]" << std::endl;
-                continue;
-            }
-            sendCommand(sock, "DOWNLOAD " + filename);
-            handleDownload(sock, filename);
-        } else if (command == "upload") {
-            std::string filename;
-            ss >> filename;
-            if (filename.empty()) {
-                std::cout << "Usage: upload [filename]" << std::endl;
-                continue;
-            }
-            handleUpload(sock, filename);
-        } else if (command == "quit") {
-            sendCommand(sock, "QUIT");
+        if (pinger->connectionLost()) {
+            std::cerr << "[-] Connection to server lost." << std::endl;
             break;
-        } else {
-            std::cout << "[-] Unknown command." << std::endl;
+        }
+
+        // A command the draining server turned away runs again, once, on the resumed session.
+        for (int attempt = 0; running && attempt < 2; ++attempt) {
+            if (serverDraining.load()) {
+                pinger.reset();
+                if (!resumeDrainedSession(session, user, pass, ticket)) {
+                    std::cerr << "[-] Connection to server lost." << std::endl;
+                    running = false;
+                    break;
+                }
+                pinger = std::make_unique<IdlePinger>(*session, sessionMutex);
+            }
+            std::lock_guard<std::mutex> lock(sessionMutex);
+            running = runCommand(*session, line, user, pass, ticket);
+            if (!serverDraining.load()) break;
         }
     }
 
-    CLOSE_SOCKET(sock);
+    pinger.reset();
+    if (session) session->close();
     cleanup_networking();
     return 0;
 }
\ No newline at end of file
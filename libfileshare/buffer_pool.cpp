@@ -0,0 +1,144 @@
+#include "libfileshare/buffer_pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "libfileshare/metrics.h"
+
+namespace {
+
+const size_t THREAD_CACHE_LIMIT = 16;       // Blocks kept per thread
+const size_t SHARED_POOL_LIMIT = 1024;      // Blocks kept in the overflow list
+const size_t SHARED_BATCH = 8;              // Blocks moved per refill
+
+ShardedCounter acquiredCount;
+ShardedCounter heapAllocatedCount;
+std::atomic<int64_t> outstandingCount{0};
+
+std::mutex sharedMutex;
+std::vector<BufferBlock*>& sharedFree() {
+    static std::vector<BufferBlock*> blocks;
+    return blocks;
+}
+
+char* allocateStorage() {
+    size_t bytes = BUFFER_HEADROOM + BUFFER_CAPACITY;
+#ifdef _WIN32
+    void* storage = _aligned_malloc(bytes, BUFFER_ALIGNMENT);
+#else
+    void* storage = std::aligned_alloc(BUFFER_ALIGNMENT, bytes);
+#endif
+    if (!storage) throw std::bad_alloc();
+    return static_cast<char*>(storage);
+}
+
+void destroyBlock(BufferBlock* block) {
+#ifdef _WIN32
+    _aligned_free(block->storage);
+#else
+    std::free(block->storage);
+#endif
+    delete block;
+}
+
+/**
+ * @brief Returns a batch of blocks to the shared list, freeing any excess.
+ */
+void releaseShared(BufferBlock** blocks, size_t count) {
+    std::lock_guard<std::mutex> lock(sharedMutex);
+    for (size_t i = 0; i < count; ++i) {
+        if (sharedFree().size() < SHARED_POOL_LIMIT) {
+            sharedFree().push_back(blocks[i]);
+        } else {
+            destroyBlock(blocks[i]);
+        }
+    }
+}
+
+struct ThreadCache {
+    BufferBlock* blocks[THREAD_CACHE_LIMIT];
+    size_t count = 0;
+
+    ~ThreadCache() {
+        releaseShared(blocks, count);
+    }
+};
+
+thread_local ThreadCache threadCache;
+
+BufferBlock* takeBlock() {
+    ThreadCache& cache = threadCache;
+    if (cache.count == 0) {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        auto& shared = sharedFree();
+        while (cache.count < SHARED_BATCH && !shared.empty()) {
+            cache.blocks[cache.count++] = shared.back();
+            shared.pop_back();
+        }
+    }
+    if (cache.count > 0) {
+        return cache.blocks[--cache.count];
+    }
+
+    heapAllocatedCount.add();
+    BufferBlock* block = new BufferBlock();
+    block->storage = allocateStorage();
+    return block;
+}
+
+void returnBlock(BufferBlock* block) {
+    ThreadCache& cache = threadCache;
+    if (cache.count < THREAD_CACHE_LIMIT) {
+        cache.blocks[cache.count++] = block;
+    } else {
+        releaseShared(&block, 1);
+    }
+}
+
+} // namespace
+
+Buffer Buffer::acquire() {
+    acquiredCount.add();
+    outstandingCount.fetch_add(1, std::memory_order_relaxed);
+    BufferBlock* block = takeBlock();
+    block->refs.store(1, std::memory_order_relaxed);
+    block->size = 0;
+    return Buffer(block);
+}
+
+Buffer::Buffer(const Buffer& other) : block_(other.block_) {
+    if (block_) block_->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+Buffer::Buffer(Buffer&& other) noexcept : block_(other.block_) {
+    other.block_ = nullptr;
+}
+
+Buffer& Buffer::operator=(Buffer other) noexcept {
+    std::swap(block_, other.block_);
+    return *this;
+}
+
+Buffer::~Buffer() {
+    release();
+}
+
+void Buffer::release() {
+    if (block_ && block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        outstandingCount.fetch_sub(1, std::memory_order_relaxed);
+        returnBlock(block_);
+    }
+    block_ = nullptr;
+}
+
+BufferPoolStats bufferPoolStats() {
+    return BufferPoolStats{
+        acquiredCount.value(),
+        heapAllocatedCount.value(),
+        static_cast<uint64_t>(std::max<int64_t>(outstandingCount.load(std::memory_order_relaxed), 0)),
+    };
+}
@@ -0,0 +1,69 @@
+/*
+ * Pooled, reference-counted I/O buffers.
+ *
+ * Large chunk buffers are recycled through a small per-thread cache
+ * (backed by a shared overflow list) instead of being allocated per
+ * chunk. A Buffer handle is cheap to copy: copies share the same block
+ * and the block returns to the pool when the last handle goes away, so
+ * one buffer can flow read -> cipher -> send without reallocation.
+ *
+ * Each block reserves BUFFER_HEADROOM bytes in front of the payload so
+ * a frame header can be written in place.
+ */
+
+#ifndef FILESHARE_BUFFER_POOL_H
+#define FILESHARE_BUFFER_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+const size_t BUFFER_CAPACITY = 64 * 1024;   // Payload bytes per pooled buffer
+const size_t BUFFER_HEADROOM = 64;          // Reserved in front of the payload
+const size_t BUFFER_ALIGNMENT = 64;         // Cache-line aligned storage
+
+struct BufferBlock {
+    std::atomic<uint32_t> refs{0};
+    size_t size = 0;
+    char* storage = nullptr;                // BUFFER_HEADROOM + BUFFER_CAPACITY bytes
+};
+
+class Buffer {
+public:
+    Buffer() = default;
+    Buffer(const Buffer& other);
+    Buffer(Buffer&& other) noexcept;
+    Buffer& operator=(Buffer other) noexcept;
+    ~Buffer();
+
+    /**
+     * @brief Takes a buffer from the calling thread's pool (size 0).
+     */
+    static Buffer acquire();
+
+    char* data() { return block_->storage + BUFFER_HEADROOM; }
+    const char* data() const { return block_->storage + BUFFER_HEADROOM; }
+    char* headroom() { return block_->storage; }
+    size_t size() const { return block_->size; }
+    void setSize(size_t size) { block_->size = size; }
+    static constexpr size_t capacity() { return BUFFER_CAPACITY; }
+
+    explicit operator bool() const { return block_ != nullptr; }
+    uint32_t useCount() const { return block_ ? block_->refs.load(std::memory_order_relaxed) : 0; }
+
+private:
+    explicit Buffer(BufferBlock* block) : block_(block) {}
+    void release();
+
+    BufferBlock* block_ = nullptr;
+};
+
+struct BufferPoolStats {
+    uint64_t acquired;          // Buffer::acquire() calls
+    uint64_t heapAllocated;     // Acquires that had to allocate a new block
+    uint64_t outstanding;       // Blocks currently handed out
+};
+
+BufferPoolStats bufferPoolStats();
+
+#endif // FILESHARE_BUFFER_POOL_H
@@ -0,0 +1,174 @@
+#include "libfileshare/checksum.h"
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define FILESHARE_HAVE_SSE42_CRC 1
+#include <nmmintrin.h>
+#endif
+
+namespace {
+
+const uint32_t CRC32C_POLY = 0x82f63b78;   // Reflected Castagnoli polynomial
+const size_t LANE_BYTES = 4096;            // Per-lane block for the 3-way hardware loop
+
+struct Crc32cTables {
+    uint32_t slice[8][256];
+    uint32_t x2n[32];            // x^(2^n) mod P
+    uint32_t laneShift;          // x^(8 * LANE_BYTES) mod P
+};
+
+/**
+ * @brief a * b mod P, both as reflected polynomials.
+ */
+uint32_t multModP(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31, p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+/**
+ * @brief x^(8 * bytes) mod P: the operator that shifts a CRC past bytes zeros.
+ */
+uint32_t shiftOperator(const uint32_t* x2n, uint64_t bytes) {
+    uint32_t p = 1u << 31;   // x^0
+    for (int k = 3; bytes; bytes >>= 1, ++k) {
+        if (bytes & 1) p = multModP(x2n[k & 31], p);
+    }
+    return p;
+}
+
+Crc32cTables buildTables() {
+    Crc32cTables t{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; ++k) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        t.slice[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int s = 1; s < 8; ++s) t.slice[s][i] = (t.slice[s - 1][i] >> 8) ^ t.slice[0][t.slice[s - 1][i] & 0xff];
+    }
+    uint32_t p = 1u << 30;   // x^1
+    for (int n = 0; n < 32; ++n) {
+        t.x2n[n] = p;
+        p = multModP(p, p);
+    }
+    t.laneShift = shiftOperator(t.x2n, LANE_BYTES);
+    return t;
+}
+
+const Crc32cTables& tables() {
+    static const Crc32cTables t = buildTables();
+    return t;
+}
+
+// The raw update functions work on the un-inverted register.
+
+uint32_t crcTable(uint32_t crc, const unsigned char* p, size_t length) {
+    const Crc32cTables& t = tables();
+    while (length >= 8) {
+        uint32_t lo, hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= crc;   // Little-endian hosts; the table path is the portable fallback
+        crc = t.slice[7][lo & 0xff] ^ t.slice[6][(lo >> 8) & 0xff] ^ t.slice[5][(lo >> 16) & 0xff] ^
+              t.slice[4][lo >> 24] ^ t.slice[3][hi & 0xff] ^ t.slice[2][(hi >> 8) & 0xff] ^
+              t.slice[1][(hi >> 16) & 0xff] ^ t.slice[0][hi >> 24];
+        p += 8;
+        length -= 8;
+    }
+    while (length--) crc = (crc >> 8) ^ t.slice[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#ifdef FILESHARE_HAVE_SSE42_CRC
+__attribute__((target("sse4.2")))
+uint32_t crcHardware(uint32_t crc, const unsigned char* p, size_t length) {
+    // crc32 has a 3-cycle latency but issues every cycle: run three
+    // independent lanes and merge them with the shift operator.
+    const uint32_t laneShift = tables().laneShift;
+    while (length >= 3 * LANE_BYTES) {
+        uint64_t a = crc, b = 0, c = 0;
+        for (size_t i = 0; i < LANE_BYTES; i += 8) {
+            uint64_t wa, wb, wc;
+            std::memcpy(&wa, p + i, 8);
+            std::memcpy(&wb, p + LANE_BYTES + i, 8);
+            std::memcpy(&wc, p + 2 * LANE_BYTES + i, 8);
+            a = _mm_crc32_u64(a, wa);
+            b = _mm_crc32_u64(b, wb);
+            c = _mm_crc32_u64(c, wc);
+        }
+        crc = multModP(laneShift, multModP(laneShift, static_cast<uint32_t>(a)) ^ static_cast<uint32_t>(b)) ^
+              static_cast<uint32_t>(c);
+        p += 3 * LANE_BYTES;
+        length -= 3 * LANE_BYTES;
+    }
+    uint64_t wide = crc;
+    while (length >= 8) {
+        uint64_t w;
+        std::memcpy(&w, p, 8);
+        wide = _mm_crc32_u64(wide, w);
+        p += 8;
+        length -= 8;
+    }
+    crc = static_cast<uint32_t>(wide);
+    while (length--) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+using CrcFn = uint32_t (*)(uint32_t, const unsigned char*, size_t);
+
+CrcFn selectImplementation() {
+#ifdef FILESHARE_HAVE_SSE42_CRC
+    if (__builtin_cpu_supports("sse4.2")) return crcHardware;
+#endif
+    return crcTable;
+}
+
+const CrcFn crcImplementation = selectImplementation();
+
+} // namespace
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t length) {
+    return ~crcImplementation(~crc, static_cast<const unsigned char*>(data), length);
+}
+
+uint32_t crc32cCombine(uint32_t crcA, uint32_t crcB, uint64_t lengthB) {
+    return multModP(shiftOperator(tables().x2n, lengthB), crcA) ^ crcB;
+}
+
+bool crc32cAccelerated() {
+    return crcImplementation != crcTable;
+}
+
+std::string crcToHex(uint32_t crc) {
+    char text[12];
+    int n = std::snprintf(text, sizeof(text), "%08x", crc);
+    return std::string(text, n);
+}
+
+void formatCrcFrame(uint32_t crc, std::string& out) {
+    char text[16];
+    int n = std::snprintf(text, sizeof(text), "CRC %08x", crc);
+    out.assign(text, n);
+}
+
+bool parseCrc(std::string_view text, uint32_t& crc) {
+    if (text.size() != 8) return false;
+    auto result = std::from_chars(text.data(), text.data() + text.size(), crc, 16);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+bool parseCrcFrame(std::string_view frame, uint32_t& crc) {
+    return frame.size() == 12 && frame.substr(0, 4) == "CRC " && parseCrc(frame.substr(4), crc);
+}
@@ -0,0 +1,64 @@
+/*
+ * CRC32C (Castagnoli) for end-to-end transfer integrity.
+ *
+ * Uses the SSE4.2 crc32 instruction when the CPU has it, selected once at
+ * startup, and a slicing-by-8 table otherwise. Checksums of consecutive
+ * pieces can be combined without touching the data again, so a whole-file
+ * CRC costs nothing beyond the per-chunk ones.
+ */
+
+#ifndef FILESHARE_CHECKSUM_H
+#define FILESHARE_CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+const char* const CHECKSUM_NAME = "crc32c";   // Argument that turns checksums on for a transfer
+
+/**
+ * @brief Extends crc (0 for a fresh checksum) over length bytes.
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+
+/**
+ * @brief CRC of A followed by B, given crc32c(A), crc32c(B) and B's length.
+ */
+uint32_t crc32cCombine(uint32_t crcA, uint32_t crcB, uint64_t lengthB);
+
+/**
+ * @brief True if the hardware instruction is in use.
+ */
+bool crc32cAccelerated();
+
+/**
+ * @brief A chunk whose data did not match its CRC, kept until it is sent again.
+ */
+struct ChunkChecksum {
+    uint64_t offset;
+    uint64_t length;
+    uint32_t crc;      // What the sender said the data should hash to
+};
+
+/**
+ * @brief 8 lowercase hex digits.
+ */
+std::string crcToHex(uint32_t crc);
+
+/**
+ * @brief Formats the per-chunk control frame "CRC <8 hex digits>" into out.
+ */
+void formatCrcFrame(uint32_t crc, std::string& out);
+
+/**
+ * @brief Parses 8 hex digits.
+ */
+bool parseCrc(std::string_view text, uint32_t& crc);
+
+/**
+ * @brief Parses "CRC <8 hex digits>".
+ */
+bool parseCrcFrame(std::string_view frame, uint32_t& crc);
+
+#endif // FILESHARE_CHECKSUM_H
@@ -0,0 +1,16 @@
+#include "libfileshare/cipher.h"
+
+void xorCipher(char* data, size_t length, const std::string& key, size_t keyOffset) {
+    if (key.empty()) return;
+    size_t k = keyOffset % key.size();
+    for (size_t i = 0; i < length; ++i) {
+        data[i] ^= key[k];
+        if (++k == key.size()) k = 0;
+    }
+}
+
+std::string encryptDecrypt(const std::string& data, const std::string& key) {
+    std::string result = data;
+    xorCipher(&result[0], result.size(), key);
+    return result;
+}
@@ -0,0 +1,26 @@
+/*
+ * XOR stream "cipher" shared by client and server.
+ *
+ * This is NOT secure and is for educational purposes only.
+ */
+
+#ifndef FILESHARE_CIPHER_H
+#define FILESHARE_CIPHER_H
+
+#include <cstddef>
+#include <string>
+
+const std::string DEFAULT_ENCRYPTION_KEY = "mysecretkey";
+
+/**
+ * @brief XORs data in place with the repeating key. The key stream starts
+ * at position keyOffset, so a message can be processed in pieces.
+ */
+void xorCipher(char* data, size_t length, const std::string& key, size_t keyOffset = 0);
+
+/**
+ * @brief "Encrypts" or "Decrypts" data using a simple XOR cipher.
+ */
+std::string encryptDecrypt(const std::string& data, const std::string& key = DEFAULT_ENCRYPTION_KEY);
+
+#endif // FILESHARE_CIPHER_H
@@ -0,0 +1,69 @@
+#include "libfileshare/config_file.h"
+
+#include <fstream>
+
+#include "libfileshare/protocol.h"
+
+namespace {
+
+std::string_view trim(std::string_view text) {
+    const char* space = " \t\r";
+    size_t first = text.find_first_not_of(space);
+    if (first == std::string_view::npos) return {};
+    return text.substr(first, text.find_last_not_of(space) - first + 1);
+}
+
+} // namespace
+
+bool readConfigFile(const std::string& path, std::vector<ConfigEntry>& entries, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+    entries.clear();
+    std::string line;
+    for (size_t number = 1; std::getline(in, line); ++number) {
+        std::string_view text = trim(line);
+        if (text.empty() || text[0] == '#') continue;
+        size_t equals = text.find('=');
+        std::string_view name = equals == std::string_view::npos ? text : trim(text.substr(0, equals));
+        if (equals == std::string_view::npos || name.empty()) {
+            error = path + ":" + std::to_string(number) + ": expected name = value";
+            return false;
+        }
+        entries.push_back({std::string(name), std::string(trim(text.substr(equals + 1))), number});
+    }
+    if (in.bad()) {
+        error = "cannot read " + path;
+        return false;
+    }
+    return true;
+}
+
+bool parseByteSize(std::string_view text, uint64_t& out) {
+    uint64_t scale = 1;
+    if (!text.empty()) {
+        switch (text.back()) {
+            case 'K': case 'k': scale = uint64_t(1) << 10; break;
+            case 'M': case 'm': scale = uint64_t(1) << 20; break;
+            case 'G': case 'g': scale = uint64_t(1) << 30; break;
+        }
+        if (scale > 1) text.remove_suffix(1);
+    }
+    uint64_t value = 0;
+    if (!parseNumber(text, value) || value > UINT64_MAX / scale) return false;
+    out = value * scale;
+    return true;
+}
+
+bool parseBool(std::string_view text, bool& out) {
+    if (text == "true" || text == "yes" || text == "on" || text == "1") {
+        out = true;
+    } else if (text == "false" || text == "no" || text == "off" || text == "0") {
+        out = false;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,42 @@
+/*
+ * "name = value" configuration files.
+ *
+ * One setting per line; blank lines and lines starting with '#' are
+ * skipped, and whitespace around the name and the value is ignored. The
+ * reader only splits lines: what a name means and how its value parses
+ * is up to the caller, with the helpers below for the common value types.
+ */
+
+#ifndef FILESHARE_CONFIG_FILE_H
+#define FILESHARE_CONFIG_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct ConfigEntry {
+    std::string name;
+    std::string value;
+    size_t line;                  // 1-based, for error messages
+};
+
+/**
+ * @brief Reads every entry of a configuration file, in order. False if the
+ * file cannot be read or a line is not "name = value"; error says which.
+ */
+bool readConfigFile(const std::string& path, std::vector<ConfigEntry>& entries, std::string& error);
+
+/**
+ * @brief Parses a byte count or other unsigned number, optionally followed
+ * by K, M or G (powers of 1024): "65536", "64K", "1G".
+ */
+bool parseByteSize(std::string_view text, uint64_t& out);
+
+/**
+ * @brief Parses true/false, yes/no, on/off or 1/0.
+ */
+bool parseBool(std::string_view text, bool& out);
+
+#endif // FILESHARE_CONFIG_FILE_H
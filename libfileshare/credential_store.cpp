@@ -0,0 +1,283 @@
+#include "libfileshare/credential_store.h"
+
+#include <fstream>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "libfileshare/merkle.h"
+#include "libfileshare/protocol.h"
+
+namespace {
+
+const char* const SCRYPT_TAG = "scrypt";
+const uint32_t MAX_SCRYPT_LOG_N = 24;   // 2 GiB at r = 8: anything larger is a typo
+
+void appendHex(std::string& out, std::string_view bytes) {
+    static const char digits[] = "0123456789abcdef";
+    for (unsigned char c : bytes) {
+        out += digits[c >> 4];
+        out += digits[c & 15];
+    }
+}
+
+int nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+bool decodeHex(std::string_view text, std::string& out) {
+    if (text.size() % 2) return false;
+    out.clear();
+    for (size_t i = 0; i < text.size(); i += 2) {
+        int hi = nibble(text[i]), lo = nibble(text[i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out += static_cast<char>(hi << 4 | lo);
+    }
+    return true;
+}
+
+bool deriveKey(std::string_view password, const std::string& salt, const ScryptParams& params, uint8_t* out,
+               size_t length) {
+    uint64_t n = uint64_t(1) << params.logN;
+    uint64_t maxmem = 256 * uint64_t(params.r) * (n + params.p) + (1 << 20);
+    return EVP_PBE_scrypt(password.data(), password.size(), reinterpret_cast<const unsigned char*>(salt.data()),
+                          salt.size(), n, params.r, params.p, maxmem, out, length) == 1;
+}
+
+/**
+ * @brief Splits "scrypt:<log2 N>:<r>:<p>:<salt hex>:<hash hex>".
+ */
+bool parseEncoded(std::string_view encoded, ScryptParams& params, std::string& salt, std::string& hash) {
+    std::string_view fields[6];
+    size_t count = 0;
+    while (count < 6) {
+        size_t colon = encoded.find(':');
+        fields[count++] = encoded.substr(0, colon);
+        if (colon == std::string_view::npos) break;
+        encoded.remove_prefix(colon + 1);
+    }
+    return count == 6 && encoded.find(':') == std::string_view::npos && fields[0] == SCRYPT_TAG &&
+           parseNumber(fields[1], params.logN) && params.logN >= 1 && params.logN <= MAX_SCRYPT_LOG_N &&
+           parseNumber(fields[2], params.r) && params.r >= 1 && params.r <= 32 &&
+           parseNumber(fields[3], params.p) && params.p >= 1 && params.p <= 16 &&
+           decodeHex(fields[4], salt) && salt.size() >= 8 && salt.size() <= 64 &&
+           decodeHex(fields[5], hash) && hash.size() >= 16 && hash.size() <= 64;
+}
+
+std::string cacheKey(std::string_view user, std::string_view password, const std::string& encoded) {
+    static const char separator = '\0';
+    Sha256 sha;
+    sha.update(user.data(), user.size());
+    sha.update(&separator, 1);
+    sha.update(password.data(), password.size());
+    sha.update(&separator, 1);
+    sha.update(encoded.data(), encoded.size());
+    Hash256 digest = sha.finish();
+    return std::string(reinterpret_cast<const char*>(digest.data()), digest.size());
+}
+
+std::string ticketDigest(std::string_view user, const std::string& encoded) {
+    static const char prefix[] = "ticket";   // Separates these digests from cache keys
+    static const char separator = '\0';
+    Sha256 sha;
+    sha.update(prefix, sizeof(prefix));
+    sha.update(user.data(), user.size());
+    sha.update(&separator, 1);
+    sha.update(encoded.data(), encoded.size());
+    Hash256 digest = sha.finish();
+    return std::string(reinterpret_cast<const char*>(digest.data()), digest.size());
+}
+
+} // namespace
+
+std::string hashPassword(std::string_view password, const ScryptParams& params) {
+    std::string salt(SCRYPT_SALT_SIZE, '\0');
+    uint8_t hash[SCRYPT_HASH_SIZE];
+    if (RAND_bytes(reinterpret_cast<unsigned char*>(&salt[0]), static_cast<int>(salt.size())) != 1 ||
+        !deriveKey(password, salt, params, hash, sizeof(hash))) {
+        return "";
+    }
+    std::string out = std::string(SCRYPT_TAG) + ":" + std::to_string(params.logN) + ":" + std::to_string(params.r) +
+                      ":" + std::to_string(params.p) + ":";
+    appendHex(out, salt);
+    out += ':';
+    appendHex(out, std::string_view(reinterpret_cast<const char*>(hash), sizeof(hash)));
+    return out;
+}
+
+CredentialStore::CredentialStore(size_t hashThreads, size_t queueLimit, size_t cacheEntries)
+    : queueLimit_(queueLimit), cacheEntries_(cacheEntries) {
+    dummy_.params = DEFAULT_SCRYPT_PARAMS;
+    dummy_.salt.assign(SCRYPT_SALT_SIZE, '\0');
+    dummy_.hash.assign(SCRYPT_HASH_SIZE, '\0');
+    for (size_t i = 0; i < (hashThreads > 0 ? hashThreads : 1); ++i) {
+        workers_.emplace_back(&CredentialStore::workerLoop, this);
+    }
+}
+
+CredentialStore::~CredentialStore() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_.notify_all();
+    for (std::thread& worker : workers_) worker.join();
+}
+
+bool CredentialStore::load(const std::string& path, std::string& error) {
+    FileStat stat{};
+    std::ifstream in(path);
+    if (!in || !statFile(path, stat)) {
+        error = "cannot open " + path;
+        return false;
+    }
+    auto users = std::make_shared<UserMap>();
+    std::string line;
+    for (size_t number = 1; std::getline(in, line); ++number) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        size_t colon = line.find(':');
+        Credential credential;
+        if (colon == 0 || colon == std::string::npos ||
+            !parseEncoded(std::string_view(line).substr(colon + 1), credential.params, credential.salt,
+                          credential.hash)) {
+            error = path + ":" + std::to_string(number) + ": malformed entry";
+            return false;
+        }
+        credential.encoded = line.substr(colon + 1);
+        if (!users->emplace(line.substr(0, colon), std::move(credential)).second) {
+            error = path + ":" + std::to_string(number) + ": duplicate user";
+            return false;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(usersMutex_);
+        users_ = std::move(users);
+        path_ = path;
+        loadedStat_ = stat;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    cache_.clear();
+    lru_.clear();
+    return true;
+}
+
+bool CredentialStore::reloadIfChanged(std::string& error) {
+    std::string path;
+    FileStat loaded{}, current{};
+    {
+        std::lock_guard<std::mutex> lock(usersMutex_);
+        path = path_;
+        loaded = loadedStat_;
+    }
+    // A missing file keeps the users loaded last.
+    if (path.empty() || !statFile(path, current) || current == loaded) return false;
+    if (load(path, error)) return true;
+    std::lock_guard<std::mutex> lock(usersMutex_);
+    loadedStat_ = current;            // Not retried until it changes again
+    return false;
+}
+
+AuthResult CredentialStore::verify(std::string_view user, std::string_view password) {
+    std::shared_ptr<const UserMap> users;
+    {
+        std::lock_guard<std::mutex> lock(usersMutex_);
+        users = users_;
+    }
+    const Credential* credential = &dummy_;
+    bool known = false;
+    if (users) {
+        auto it = users->find(std::string(user));
+        if (it != users->end()) {
+            credential = &it->second;
+            known = true;
+        }
+    }
+    std::string key = cacheKey(user, password, credential->encoded);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto hit = known ? cache_.find(key) : cache_.end();
+    if (hit != cache_.end()) {
+        lru_.splice(lru_.begin(), lru_, hit->second);
+        cacheHits_.fetch_add(1, std::memory_order_relaxed);
+        return AuthResult::Accepted;
+    }
+    std::shared_ptr<Pending> pending;
+    auto flight = inFlight_.find(key);
+    if (flight != inFlight_.end()) {
+        pending = flight->second;
+    } else {
+        if (queue_.size() >= queueLimit_) {
+            shed_.fetch_add(1, std::memory_order_relaxed);
+            return AuthResult::Busy;
+        }
+        pending = std::make_shared<Pending>();
+        inFlight_.emplace(key, pending);
+        queue_.push_back(Job{key, std::move(users), credential, known, std::string(password), pending});
+        work_.notify_one();
+    }
+    done_.wait(lock, [&] { return pending->done; });
+    return pending->accepted ? AuthResult::Accepted : AuthResult::Rejected;
+}
+
+bool CredentialStore::ticketBinding(std::string_view user, std::string& binding) const {
+    std::shared_ptr<const UserMap> users;
+    {
+        std::lock_guard<std::mutex> lock(usersMutex_);
+        users = users_;
+    }
+    if (!users) return false;
+    auto it = users->find(std::string(user));
+    if (it == users->end()) return false;
+    binding = ticketDigest(user, it->second.encoded);
+    return true;
+}
+
+void CredentialStore::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        work_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (stopping_) return;
+        Job job = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+
+        const Credential& credential = *job.credential;
+        uint8_t derived[64];
+        bool match = deriveKey(job.password, credential.salt, credential.params, derived, credential.hash.size()) &&
+                     CRYPTO_memcmp(derived, credential.hash.data(), credential.hash.size()) == 0;
+        OPENSSL_cleanse(&job.password[0], job.password.size());
+        hashes_.fetch_add(1, std::memory_order_relaxed);
+
+        lock.lock();
+        finish(job, job.known && match);
+    }
+}
+
+void CredentialStore::finish(const Job& job, bool accepted) {
+    job.pending->done = true;
+    job.pending->accepted = accepted;
+    inFlight_.erase(job.key);
+    if (accepted && cacheEntries_ > 0 && !cache_.count(job.key)) {
+        lru_.push_front(job.key);
+        cache_.emplace(job.key, lru_.begin());
+        if (cache_.size() > cacheEntries_) {
+            cache_.erase(lru_.back());
+            lru_.pop_back();
+        }
+    }
+    done_.notify_all();
+}
+
+size_t CredentialStore::users() const {
+    std::lock_guard<std::mutex> lock(usersMutex_);
+    return users_ ? users_->size() : 0;
+}
+
+size_t CredentialStore::queued() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
@@ -0,0 +1,159 @@
+/*
+ * Users and salted scrypt password hashes, read from a credential file.
+ *
+ * Each line of the file is "<user>:scrypt:<log2 N>:<r>:<p>:<salt hex>:<hash
+ * hex>"; blank lines and lines starting with '#' are skipped. scrypt is
+ * memory-hard (128 * N * r bytes per hash, 16 MiB with the defaults), so a
+ * stolen file is slow to attack even with GPUs, and it is just as slow to
+ * check a password honestly. Three things keep a storm of logins, such as
+ * every client reconnecting after a restart, from overwhelming the server:
+ *
+ *  - Hashes are computed by a small pool of threads, so at most that many
+ *    run at once however many sessions are waiting, and the queue in front
+ *    of the pool is bounded: beyond it verify() answers Busy at once.
+ *  - Concurrent checks of the same user and password share one hash.
+ *  - Successful checks are remembered in an LRU cache keyed by a SHA-256
+ *    of the user, the password and the stored hash, so a repeat login
+ *    costs one SHA-256 and a changed password never matches a stale entry.
+ *    Failures are never cached, so guessing stays expensive.
+ *
+ * Names that are not in the file are checked against a dummy hash, so
+ * they take as long to refuse as a wrong password.
+ *
+ * Session tickets (session_ticket.h) are signed over ticketBinding(), a
+ * digest of the user's line, so removing a user or changing a password
+ * also invalidates every ticket issued before.
+ */
+
+#ifndef FILESHARE_CREDENTIAL_STORE_H
+#define FILESHARE_CREDENTIAL_STORE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "libfileshare/file_index.h"
+
+struct ScryptParams {
+    uint32_t logN;                // N = 2^logN
+    uint32_t r;
+    uint32_t p;
+};
+
+const ScryptParams DEFAULT_SCRYPT_PARAMS = {14, 8, 1};   // 16 MiB and a few tens of ms per hash
+const size_t SCRYPT_SALT_SIZE = 16;
+const size_t SCRYPT_HASH_SIZE = 32;
+
+/**
+ * @brief "scrypt:<log2 N>:<r>:<p>:<salt hex>:<hash hex>" for password with a
+ * fresh random salt, the part of a credential line after "<user>:". Empty
+ * if hashing fails.
+ */
+std::string hashPassword(std::string_view password, const ScryptParams& params = DEFAULT_SCRYPT_PARAMS);
+
+enum class AuthResult { Accepted, Rejected, Busy };
+
+class CredentialStore {
+public:
+    /**
+     * @param hashThreads Threads computing hashes.
+     * @param queueLimit Hashes allowed to wait for a thread.
+     * @param cacheEntries Successful checks remembered.
+     */
+    CredentialStore(size_t hashThreads, size_t queueLimit, size_t cacheEntries);
+    ~CredentialStore();
+
+    CredentialStore(const CredentialStore&) = delete;
+    CredentialStore& operator=(const CredentialStore&) = delete;
+
+    /**
+     * @brief Replaces the users with those in path. On failure error says
+     * why (with the line number for a malformed entry) and the users loaded
+     * before stay in effect.
+     */
+    bool load(const std::string& path, std::string& error);
+
+    /**
+     * @brief Loads path again if it changed since the last load. Returns
+     * true if it was reloaded; error is set if the reload failed.
+     */
+    bool reloadIfChanged(std::string& error);
+
+    /**
+     * @brief Checks a password, blocking until a hash thread has done so
+     * unless the check is cached. Busy if the hash queue is full.
+     */
+    AuthResult verify(std::string_view user, std::string_view password);
+
+    /**
+     * @brief Sets binding to a SHA-256 of user's current credential line,
+     * for signing session tickets. False if user is not in the file.
+     */
+    bool ticketBinding(std::string_view user, std::string& binding) const;
+
+    size_t users() const;
+    size_t queued() const;
+    uint64_t cacheHits() const { return cacheHits_.load(std::memory_order_relaxed); }
+    uint64_t hashes() const { return hashes_.load(std::memory_order_relaxed); }
+    uint64_t shed() const { return shed_.load(std::memory_order_relaxed); }
+
+private:
+    struct Credential {
+        ScryptParams params;
+        std::string salt;
+        std::string hash;
+        std::string encoded;          // As in the file; part of the cache key
+    };
+    using UserMap = std::unordered_map<std::string, Credential>;
+
+    struct Pending {
+        bool done = false;
+        bool accepted = false;
+    };
+
+    struct Job {
+        std::string key;
+        std::shared_ptr<const UserMap> users;   // Keeps credential alive while hashing
+        const Credential* credential;
+        bool known;
+        std::string password;
+        std::shared_ptr<Pending> pending;
+    };
+
+    void workerLoop();
+    void finish(const Job& job, bool accepted);
+
+    mutable std::mutex usersMutex_;
+    std::shared_ptr<const UserMap> users_;
+    std::string path_;
+    FileStat loadedStat_{};
+    Credential dummy_;
+
+    mutable std::mutex mutex_;        // Cache, in-flight checks and the job queue
+    std::condition_variable work_;
+    std::condition_variable done_;
+    std::deque<Job> queue_;
+    std::unordered_map<std::string, std::shared_ptr<Pending>> inFlight_;
+    std::list<std::string> lru_;      // Cache keys, most recent first
+    std::unordered_map<std::string, std::list<std::string>::iterator> cache_;
+    size_t queueLimit_;
+    size_t cacheEntries_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+
+    std::atomic<uint64_t> cacheHits_{0};
+    std::atomic<uint64_t> hashes_{0};
+    std::atomic<uint64_t> shed_{0};
+};
+
+#endif // FILESHARE_CREDENTIAL_STORE_H
@@ -0,0 +1,222 @@
+#include "libfileshare/file_catalog.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <mutex>
+
+#include "libfileshare/file_index.h"
+#include "libfileshare/protocol.h"
+
+#if defined(__linux__) && __has_include(<linux/fs.h>)
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#ifdef FICLONE
+#define FILESHARE_HAVE_FICLONE 1
+#endif
+#endif
+
+namespace {
+
+/**
+ * @brief Makes `to` a new file sharing from's data: a reflink clone where
+ * the filesystem has them, a hard link otherwise.
+ */
+bool cloneOrLink(const std::string& from, const std::string& to) {
+#ifdef FILESHARE_HAVE_FICLONE
+    int source = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (source >= 0) {
+        int clone = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        bool cloned = clone >= 0 && ioctl(clone, FICLONE, source) == 0;
+        if (clone >= 0) ::close(clone);
+        ::close(source);
+        if (cloned) return true;
+        if (clone >= 0) ::unlink(to.c_str());   // EOPNOTSUPP, EXDEV, ...: link instead
+    }
+#endif
+    std::error_code ec;
+    std::filesystem::create_hard_link(from, to, ec);
+    return !ec;
+}
+
+} // namespace
+
+bool parseVersionSpec(std::string_view spec, std::string_view& name, uint64_t& version) {
+    size_t at = spec.rfind(VERSION_SEPARATOR);
+    if (at == std::string_view::npos || at == 0) return false;
+    name = spec.substr(0, at);
+    return parseNumber(spec.substr(at + 1), version) && version > 0;
+}
+
+std::string FileCatalog::versionFile(std::string_view name, uint64_t version) const {
+    return versionsDir_ + "/" + std::string(name) + VERSION_SEPARATOR + std::to_string(version);
+}
+
+bool FileCatalog::open(const std::string& directory, bool (*isServed)(std::string_view)) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    directory_ = directory;
+    versionsDir_ = directory + "/" + VERSIONS_DIR_NAME;
+    std::error_code ec;
+    std::filesystem::create_directories(versionsDir_, ec);
+    if (ec) return false;
+
+    names_.clear();
+    for (std::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        std::error_code typeError;
+        if (isServed(name) && it->is_regular_file(typeError)) names_.insert(std::move(name));
+    }
+    if (ec) return false;
+
+    versions_.clear();
+    keptVersions_ = 0;
+    for (std::filesystem::directory_iterator it(versionsDir_, ec), end; !ec && it != end; it.increment(ec)) {
+        std::string file = it->path().filename().string();
+        std::string_view name;
+        uint64_t version = 0;
+        FileStat stat;
+        if (!parseVersionSpec(file, name, version) || !statFile(it->path().string(), stat)) continue;
+        versions_[std::string(name)].push_back({version, stat.inode, stat.size, stat.mtimeNs});
+        ++keptVersions_;
+    }
+    for (auto& entry : versions_) {
+        std::sort(entry.second.begin(), entry.second.end(),
+                  [](const VersionInfo& a, const VersionInfo& b) { return a.version < b.version; });
+    }
+    return !ec;
+}
+
+uint64_t FileCatalog::publish(const std::string& name, const std::string& tempPath) {
+    std::vector<VersionInfo> kept;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = versions_.find(name);
+        if (it != versions_.end()) kept = it->second;
+    }
+    uint64_t next = kept.empty() ? 1 : kept.back().version + 1;
+    std::vector<VersionInfo> added;
+    std::string target = directory_ + "/" + name;
+    std::error_code ec;
+
+    // Versions linked since the listing was loaded by another server on the
+    // same directory, such as one draining after handing its sockets to
+    // this one, are adopted rather than collided with.
+    FileStat current, incoming;
+    while (statFile(versionFile(name, next), incoming)) {
+        added.push_back({next++, incoming.inode, incoming.size, incoming.mtimeNs});
+    }
+    const VersionInfo* newest = !added.empty() ? &added.back() : (!kept.empty() ? &kept.back() : nullptr);
+
+    // Contents that did not come through here (present at startup, or
+    // replaced by hand) are kept as a version of their own first.
+    if (statFile(target, current) && (!newest || newest->inode != current.inode)) {
+        std::filesystem::create_hard_link(target, versionFile(name, next), ec);
+        if (!ec) added.push_back({next++, current.inode, current.size, current.mtimeNs});
+    }
+    uint64_t version = 0;
+    if (statFile(tempPath, incoming)) {
+        std::string file = versionFile(name, next);
+        std::filesystem::create_hard_link(tempPath, file, ec);
+        if (!ec) {
+            std::filesystem::rename(tempPath, target, ec);
+            if (!ec) {
+                added.push_back({next, incoming.inode, incoming.size, incoming.mtimeNs});
+                version = next;
+            } else {
+                std::error_code ignored;
+                std::filesystem::remove(file, ignored);
+            }
+        }
+    }
+
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        std::vector<VersionInfo>& list = versions_[name];
+        list.insert(list.end(), added.begin(), added.end());
+        keptVersions_ += added.size();
+        if (version > 0) names_.insert(name);
+    }
+    prune(name);
+    return version;
+}
+
+uint64_t FileCatalog::restore(const std::string& name, uint64_t version, const std::string& tempPath) {
+    std::string source;
+    if (!versionPath(name, version, source) || !cloneOrLink(source, tempPath)) return 0;
+    uint64_t restored = publish(name, tempPath);
+    if (restored == 0) {
+        std::error_code ec;
+        std::filesystem::remove(tempPath, ec);
+    }
+    return restored;
+}
+
+void FileCatalog::prune(const std::string& name) {
+    std::vector<uint64_t> dropped;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = versions_.find(name);
+        if (it == versions_.end() || it->second.size() <= maxVersions_) return;
+        size_t excess = it->second.size() - maxVersions_;
+        for (size_t i = 0; i < excess; ++i) dropped.push_back(it->second[i].version);
+        it->second.erase(it->second.begin(), it->second.begin() + excess);
+        keptVersions_ -= excess;
+    }
+    // Downloads that already opened a dropped version keep reading it.
+    for (uint64_t version : dropped) {
+        std::error_code ec;
+        std::filesystem::remove(versionFile(name, version), ec);
+    }
+}
+
+bool FileCatalog::versionPath(std::string_view name, uint64_t version, std::string& path) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = versions_.find(std::string(name));
+    if (it == versions_.end()) return false;
+    for (const VersionInfo& info : it->second) {
+        if (info.version == version) {
+            path = versionFile(name, version);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<VersionInfo> FileCatalog::versions(std::string_view name) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = versions_.find(std::string(name));
+    return it == versions_.end() ? std::vector<VersionInfo>() : it->second;
+}
+
+std::vector<std::string> FileCatalog::list(std::string_view after, size_t limit) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    std::vector<std::string> page;
+    auto it = after.empty() ? names_.begin() : names_.upper_bound(after);
+    for (; it != names_.end() && page.size() < limit; ++it) page.push_back(*it);
+    return page;
+}
+
+void FileCatalog::sync(const std::unordered_set<std::string>& present) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    for (auto it = names_.begin(); it != names_.end();) {
+        // A name published after the listing was taken is not in it yet.
+        std::error_code ec;
+        if (!present.count(*it) && !std::filesystem::exists(directory_ + "/" + *it, ec)) {
+            it = names_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    names_.insert(present.begin(), present.end());
+}
+
+size_t FileCatalog::names() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return names_.size();
+}
+
+size_t FileCatalog::keptVersions() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return keptVersions_;
+}
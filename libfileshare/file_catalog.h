@@ -0,0 +1,113 @@
+/*
+ * The served directory's names and the versions kept for each.
+ *
+ * Every published version of a file is kept as a hard link in a hidden
+ * versions directory, named "<name>@<version>", so keeping or restoring a
+ * version never copies data: files are only ever replaced by rename, never
+ * written in place, so a link pins exactly the contents it was made from.
+ * Restores clone the version with FICLONE where the filesystem supports
+ * reflinks (xfs, btrfs), giving the restored file an inode of its own, and
+ * fall back to a hard link elsewhere. Only the newest maxVersions of each
+ * name are kept.
+ *
+ * The names and version lists are held in memory, rebuilt from the two
+ * directories at startup, so LIST pages and version lookups never scan a
+ * directory. Names added or removed behind the server's back show up when
+ * sync() is next given a fresh listing.
+ */
+
+#ifndef FILESHARE_FILE_CATALOG_H
+#define FILESHARE_FILE_CATALOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+const char* const VERSIONS_DIR_NAME = ".versions";
+const char VERSION_SEPARATOR = '@';   // "<name>@<version>" names a kept version
+
+struct VersionInfo {
+    uint64_t version;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtimeNs;
+};
+
+/**
+ * @brief Splits "<name>@<version>". False if spec has no separator or the
+ * version is not a positive number.
+ */
+bool parseVersionSpec(std::string_view spec, std::string_view& name, uint64_t& version);
+
+class FileCatalog {
+public:
+    /**
+     * @param maxVersions Versions kept per name, including the current one.
+     */
+    explicit FileCatalog(size_t maxVersions) : maxVersions_(maxVersions > 0 ? maxVersions : 1) {}
+
+    /**
+     * @brief Creates the versions directory if needed and loads both
+     * listings. isServed filters the names of the served directory.
+     */
+    bool open(const std::string& directory, bool (*isServed)(std::string_view));
+
+    /**
+     * @brief Renames tempPath over name, first keeping the current file as
+     * a version if it is not one already and linking the new contents as
+     * the next version. Callers serialize publishes of the same name.
+     * @return The new version, or 0 on failure (tempPath is left in place).
+     */
+    uint64_t publish(const std::string& name, const std::string& tempPath);
+
+    /**
+     * @brief Makes version the current contents of name, as a new version,
+     * via tempPath (which must not exist). The same locking as publish().
+     * @return The new version, or 0 if version is not kept or on failure.
+     */
+    uint64_t restore(const std::string& name, uint64_t version, const std::string& tempPath);
+
+    /**
+     * @brief Path of a kept version. False if it is not kept.
+     */
+    bool versionPath(std::string_view name, uint64_t version, std::string& path) const;
+
+    /**
+     * @brief Kept versions of name, oldest first.
+     */
+    std::vector<VersionInfo> versions(std::string_view name) const;
+
+    /**
+     * @brief Up to limit names after `after` (all from the start if empty),
+     * in byte order.
+     */
+    std::vector<std::string> list(std::string_view after, size_t limit) const;
+
+    /**
+     * @brief Replaces the name set with a fresh listing of the directory.
+     */
+    void sync(const std::unordered_set<std::string>& present);
+
+    size_t names() const;
+    size_t keptVersions() const;
+
+private:
+    std::string versionFile(std::string_view name, uint64_t version) const;
+    void prune(const std::string& name);
+
+    mutable std::shared_mutex mutex_;
+    size_t maxVersions_;
+    std::string directory_;
+    std::string versionsDir_;
+    std::set<std::string, std::less<>> names_;
+    std::unordered_map<std::string, std::vector<VersionInfo>> versions_;
+    size_t keptVersions_ = 0;
+};
+
+#endif // FILESHARE_FILE_CATALOG_H
@@ -0,0 +1,411 @@
+#include "libfileshare/file_index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "libfileshare/checksum.h"
+#include "libfileshare/rate_limit.h"
+
+namespace {
+
+const char INDEX_MAGIC[8] = {'F', 'S', 'I', 'D', 'X', '0', '2', '\n'};
+const uint32_t RECORD_MAGIC = 0x31434552;     // "REC1"
+const uint16_t RECORD_TOMBSTONE = 1;
+const uint16_t RECORD_HAS_TREE = 2;
+const uint64_t INDEX_MIN_CAPACITY = 1 << 20;
+const uint64_t INDEX_COMPACT_MIN_BYTES = 1 << 20;
+
+size_t align8(size_t n) {
+    return (n + 7) & ~size_t(7);
+}
+
+} // namespace
+
+struct FileIndex::Header {
+    char magic[8];
+    uint32_t blockSize;
+    uint32_t reserved;
+    uint64_t used;          // Header plus records, in bytes
+    uint8_t pad[40];
+};
+
+struct FileIndex::Record {
+    uint32_t magic;
+    uint32_t length;        // Whole record, a multiple of 8
+    uint32_t checksum;      // CRC32C of the record with this field zeroed
+    uint16_t nameLength;
+    uint16_t flags;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtimeNs;
+    uint32_t crc;
+    uint32_t blockCount;
+    uint32_t leafCount;
+    uint32_t reserved;
+    // Followed by the name, padded to 8 bytes, then blockCount BlockSignatures
+    // and leafCount Merkle leaves.
+
+    const char* name() const { return reinterpret_cast<const char*>(this + 1); }
+    const BlockSignature* blocks() const {
+        return reinterpret_cast<const BlockSignature*>(name() + align8(nameLength));
+    }
+    const Hash256* leaves() const { return reinterpret_cast<const Hash256*>(blocks() + blockCount); }
+    uint64_t payloadLength() const {
+        return sizeof(Record) + align8(nameLength) + uint64_t(blockCount) * sizeof(BlockSignature) +
+               uint64_t(leafCount) * sizeof(Hash256);
+    }
+};
+
+static_assert(sizeof(BlockSignature) == 8 && sizeof(Hash256) == 32, "signatures and leaves are stored as-is");
+
+#ifndef _WIN32
+static bool fromStat(const struct stat& st, FileStat& out) {
+    if (!S_ISREG(st.st_mode)) return false;
+    out.inode = static_cast<uint64_t>(st.st_ino);
+    out.size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+    out.mtimeNs = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+    out.ctimeNs = static_cast<int64_t>(st.st_ctimespec.tv_sec) * 1000000000 + st.st_ctimespec.tv_nsec;
+#else
+    out.mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    out.ctimeNs = static_cast<int64_t>(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+#endif
+    return true;
+}
+#endif
+
+bool statFile(const std::string& path, FileStat& out) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(path.c_str(), &st) != 0 || !(st.st_mode & _S_IFREG)) return false;
+    out.inode = 0;
+    out.size = static_cast<uint64_t>(st.st_size);
+    out.mtimeNs = static_cast<int64_t>(st.st_mtime) * 1000000000;
+    out.ctimeNs = static_cast<int64_t>(st.st_ctime) * 1000000000;
+    return true;
+#else
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && fromStat(st, out);
+#endif
+}
+
+bool statOpenFile(int fd, FileStat& out) {
+#ifdef _WIN32
+    (void)fd;
+    (void)out;
+    return false;
+#else
+    struct stat st;
+    return fstat(fd, &st) == 0 && fromStat(st, out);
+#endif
+}
+
+// --- DigestBuilder ---
+
+DigestBuilder::DigestBuilder(bool withTree) : leafHash_(withTree ? new Sha256() : nullptr) {}
+
+void DigestBuilder::update(const char* data, size_t length) {
+    while (length > 0) {
+        size_t take = std::min(length, INDEX_BLOCK_SIZE - blockFill_);
+        blockCrc_ = crc32c(blockCrc_, data, take);
+        if (leafHash_) {
+            if (blockFill_ == 0) leafHash_->update("", 1);   // The leaf prefix byte, 0x00
+            leafHash_->update(data, take);
+        }
+        // Rolling checksum: a = sum(x), b = sum of the running a. For a
+        // piece of m bytes, b gains m * a plus (m - j) * x_j, which
+        // vectorizes where the byte-serial form does not.
+        uint32_t sum = 0, weighted = 0;
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+        for (size_t j = 0; j < take; ++j) {
+            sum += p[j];
+            weighted += static_cast<uint32_t>(take - j) * p[j];
+        }
+        weakB_ += static_cast<uint32_t>(take) * weakA_ + weighted;
+        weakA_ += sum;
+        blockFill_ += take;
+        data += take;
+        length -= take;
+        if (blockFill_ == INDEX_BLOCK_SIZE) {
+            blocks_.push_back({(weakA_ & 0xffff) | (weakB_ << 16), blockCrc_});
+            if (leafHash_) leaves_.push_back(leafHash_->finish());
+            crc_ = crc32cCombine(crc_, blockCrc_, blockFill_);
+            blockCrc_ = weakA_ = weakB_ = 0;
+            blockFill_ = 0;
+        }
+    }
+}
+
+void DigestBuilder::finish(FileDigest& out) {
+    if (blockFill_ > 0) {
+        blocks_.push_back({(weakA_ & 0xffff) | (weakB_ << 16), blockCrc_});
+        if (leafHash_) leaves_.push_back(leafHash_->finish());
+        crc_ = crc32cCombine(crc_, blockCrc_, blockFill_);
+    }
+    out.crc = crc_;
+    out.blocks = std::move(blocks_);
+    out.hasTree = leafHash_ != nullptr;
+    out.leaves = std::move(leaves_);
+    bool withTree = leafHash_ != nullptr;
+    *this = DigestBuilder(withTree);
+}
+
+bool digestFile(const std::string& path, FileDigest& out, uint64_t bytesPerSecond, bool withTree) {
+    FileStat before, after;
+    if (!statFile(path, before)) return false;
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+    TokenBucket pace(bytesPerSecond, INDEX_BLOCK_SIZE);
+    DigestBuilder builder(withTree);
+    std::vector<char> block(INDEX_BLOCK_SIZE);
+    while (file) {
+        std::this_thread::sleep_for(pace.reserve(block.size()));
+        file.read(block.data(), block.size());
+        builder.update(block.data(), static_cast<size_t>(file.gcount()));
+    }
+    // A writer got in while we were reading: the digest matches neither version.
+    if (!file.eof() || !statFile(path, after) || !(after == before)) return false;
+    builder.finish(out);
+    out.stat = after;
+    return true;
+}
+
+// --- FileIndex ---
+
+FileIndex::~FileIndex() {
+#ifndef _WIN32
+    if (base_) munmap(base_, capacity_);
+    if (fd_ >= 0) ::close(fd_);
+#endif
+}
+
+FileIndex::Header* FileIndex::header() const {
+    return reinterpret_cast<Header*>(base_);
+}
+
+bool FileIndex::mapFile(int fd, uint64_t capacity) {
+#ifdef _WIN32
+    (void)fd;
+    (void)capacity;
+    return false;
+#else
+    struct stat st;
+    if (fstat(fd, &st) != 0) return false;
+    if (static_cast<uint64_t>(st.st_size) < capacity && ftruncate(fd, static_cast<off_t>(capacity)) != 0) return false;
+    capacity = std::max<uint64_t>(capacity, static_cast<uint64_t>(st.st_size));
+    void* p = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return false;
+    if (base_) munmap(base_, capacity_);
+    if (fd_ >= 0 && fd_ != fd) ::close(fd_);
+    fd_ = fd;
+    base_ = static_cast<char*>(p);
+    capacity_ = capacity;
+    return true;
+#endif
+}
+
+bool FileIndex::open(const std::string& directory) {
+#ifdef _WIN32
+    (void)directory;
+    return false;
+#else
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    directory_ = directory;
+    std::string path = directory + "/" + INDEX_FILE_NAME;
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    if (!mapFile(fd, INDEX_MIN_CAPACITY)) {
+        ::close(fd);
+        return false;
+    }
+    Header* h = header();
+    if (std::memcmp(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || h->blockSize != INDEX_BLOCK_SIZE ||
+        h->used < sizeof(Header) || h->used > capacity_) {
+        // New, foreign or from another block size: start over.
+        std::memset(h, 0, sizeof(Header));
+        std::memcpy(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        h->blockSize = INDEX_BLOCK_SIZE;
+        h->used = sizeof(Header);
+    }
+    load();
+    return true;
+#endif
+}
+
+void FileIndex::load() {
+    offsets_.clear();
+    liveBytes_ = 0;
+    Header* h = header();
+    uint64_t offset = sizeof(Header);
+    while (offset + sizeof(Record) <= h->used) {
+        Record* r = reinterpret_cast<Record*>(base_ + offset);
+        if (r->magic != RECORD_MAGIC || r->length < sizeof(Record) || r->length % 8 != 0 ||
+            offset + r->length > h->used || r->payloadLength() > r->length) {
+            break;
+        }
+        uint32_t stored = r->checksum;
+        r->checksum = 0;
+        uint32_t actual = crc32c(0, r, r->length);
+        r->checksum = stored;
+        if (actual != stored) break;
+
+        std::string name(r->name(), r->nameLength);
+        auto it = offsets_.find(name);
+        if (it != offsets_.end()) {
+            liveBytes_ -= reinterpret_cast<Record*>(base_ + it->second)->length;
+            offsets_.erase(it);
+        }
+        if (!(r->flags & RECORD_TOMBSTONE)) {
+            offsets_.emplace(std::move(name), offset);
+            liveBytes_ += r->length;
+        }
+        offset += r->length;
+    }
+    h->used = offset;   // Cuts off a record torn by a crash
+}
+
+bool FileIndex::reserve(uint64_t bytes) {
+    uint64_t needed = header()->used + bytes;
+    if (needed <= capacity_) return true;
+    return mapFile(fd_, std::max(needed, capacity_ * 2));
+}
+
+bool FileIndex::append(const std::string& name, const FileDigest& digest, bool tombstone) {
+    if (name.size() > UINT16_MAX) return false;
+    size_t leafCount = digest.hasTree ? digest.leaves.size() : 0;
+    uint64_t length = sizeof(Record) + align8(name.size()) + digest.blocks.size() * sizeof(BlockSignature) +
+                      leafCount * sizeof(Hash256);
+    if (length > UINT32_MAX || !reserve(length)) return false;
+    uint64_t offset = header()->used;
+    char* at = base_ + offset;
+    std::memset(at, 0, length);
+    Record* r = reinterpret_cast<Record*>(at);
+    r->magic = RECORD_MAGIC;
+    r->length = static_cast<uint32_t>(length);
+    r->nameLength = static_cast<uint16_t>(name.size());
+    r->flags = (tombstone ? RECORD_TOMBSTONE : 0) | (digest.hasTree ? RECORD_HAS_TREE : 0);
+    r->inode = digest.stat.inode;
+    r->size = digest.stat.size;
+    r->mtimeNs = digest.stat.mtimeNs;
+    r->crc = digest.crc;
+    r->blockCount = static_cast<uint32_t>(digest.blocks.size());
+    r->leafCount = static_cast<uint32_t>(leafCount);
+    std::memcpy(at + sizeof(Record), name.data(), name.size());
+    if (!digest.blocks.empty()) {
+        std::memcpy(const_cast<BlockSignature*>(r->blocks()), digest.blocks.data(),
+                    digest.blocks.size() * sizeof(BlockSignature));
+    }
+    if (leafCount > 0) {
+        std::memcpy(const_cast<Hash256*>(r->leaves()), digest.leaves.data(), leafCount * sizeof(Hash256));
+    }
+    r->checksum = crc32c(0, r, length);
+    // Publish only once the record is complete, so a crash leaves at worst
+    // a torn tail that the next load() discards.
+    header()->used = offset + length;
+
+    auto it = offsets_.find(name);
+    if (it != offsets_.end()) {
+        liveBytes_ -= reinterpret_cast<Record*>(base_ + it->second)->length;
+        offsets_.erase(it);
+    }
+    if (!tombstone) {
+        offsets_.emplace(name, offset);
+        liveBytes_ += length;
+    }
+    return true;
+}
+
+bool FileIndex::lookup(const std::string& name, const FileStat& current, FileDigest& out) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = offsets_.find(name);
+    if (it == offsets_.end()) return false;
+    const Record* r = reinterpret_cast<const Record*>(base_ + it->second);
+    if (r->inode != current.inode || r->size != current.size || r->mtimeNs != current.mtimeNs) return false;
+    out.stat = current;
+    out.crc = r->crc;
+    out.blocks.assign(r->blocks(), r->blocks() + r->blockCount);
+    out.hasTree = (r->flags & RECORD_HAS_TREE) != 0;
+    out.leaves.assign(r->leaves(), r->leaves() + r->leafCount);
+    return true;
+}
+
+bool FileIndex::isCurrent(const std::string& name, const FileStat& current) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = offsets_.find(name);
+    if (it == offsets_.end()) return false;
+    const Record* r = reinterpret_cast<const Record*>(base_ + it->second);
+    return r->inode == current.inode && r->size == current.size && r->mtimeNs == current.mtimeNs;
+}
+
+bool FileIndex::store(const std::string& name, const FileDigest& digest) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    return base_ && append(name, digest, false);
+}
+
+void FileIndex::retain(const std::unordered_set<std::string>& present) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (!base_) return;
+    std::vector<std::string> gone;
+    for (const auto& entry : offsets_) {
+        if (!present.count(entry.first)) gone.push_back(entry.first);
+    }
+    for (const std::string& name : gone) append(name, FileDigest(), true);
+}
+
+bool FileIndex::compactIfNeeded() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (!base_) return false;
+    uint64_t records = header()->used - sizeof(Header);
+    if (records < INDEX_COMPACT_MIN_BYTES || records < 2 * liveBytes_) return false;
+    return compact();
+}
+
+bool FileIndex::compact() {
+#ifdef _WIN32
+    return false;
+#else
+    std::string path = directory_ + "/" + INDEX_FILE_NAME;
+    std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) return false;
+    Header fresh = *header();
+    fresh.used = sizeof(Header) + liveBytes_;
+    out.write(reinterpret_cast<const char*>(&fresh), sizeof(fresh));
+    for (const auto& entry : offsets_) {
+        const Record* r = reinterpret_cast<const Record*>(base_ + entry.second);
+        out.write(reinterpret_cast<const char*>(r), r->length);   // Records are position-independent
+    }
+    out.close();
+    if (!out || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0 || !mapFile(fd, std::max(INDEX_MIN_CAPACITY, fresh.used))) {
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    load();
+    return true;
+#endif
+}
+
+size_t FileIndex::entries() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return offsets_.size();
+}
+
+uint64_t FileIndex::bytes() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return base_ ? header()->used : 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * Persistent per-file digest index for served files.
+ *
+ * A sidecar file in the served directory holds, for each file, its
+ * whole-file CRC32C and a signature per block (an rsync-style rolling
+ * checksum plus CRC32C) -- the raw material for integrity, delta and
+ * dedup features -- and, once a client has asked for it, the file's
+ * Merkle leaves (merkle.h). An entry is only trusted while the file's inode, size
+ * and mtime still match the ones it was computed for.
+ *
+ * The sidecar is an append-only log of checksummed records, memory-mapped
+ * so startup only walks record headers. Replaced and removed entries are
+ * dropped by compaction, which rewrites the log and renames it into place.
+ * POSIX only; elsewhere open() fails and callers run without an index.
+ */
+
+#ifndef FILESHARE_FILE_INDEX_H
+#define FILESHARE_FILE_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "libfileshare/merkle.h"
+
+const char* const INDEX_FILE_NAME = ".fileshare_index";
+const size_t INDEX_BLOCK_SIZE = 64 * 1024;   // Bytes covered by one block signature
+
+struct FileStat {
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    int64_t mtimeNs = 0;
+    int64_t ctimeNs = 0;    // Not part of the identity: linking or renaming the file changes it
+
+    bool operator==(const FileStat& other) const {
+        return inode == other.inode && size == other.size && mtimeNs == other.mtimeNs;
+    }
+};
+
+/**
+ * @brief Stats path. False if it does not exist or is not a regular file.
+ */
+bool statFile(const std::string& path, FileStat& out);
+
+/**
+ * @brief The same for an open descriptor (POSIX only).
+ */
+bool statOpenFile(int fd, FileStat& out);
+
+struct BlockSignature {
+    uint32_t weak;     // rsync rolling checksum: (a & 0xffff) | (b << 16)
+    uint32_t crc;      // CRC32C of the block
+};
+
+struct FileDigest {
+    FileStat stat;
+    uint32_t crc = 0;                      // CRC32C of the whole file
+    std::vector<BlockSignature> blocks;    // One per INDEX_BLOCK_SIZE bytes
+    bool hasTree = false;                  // Leaves are only computed when asked for
+    std::vector<Hash256> leaves;           // Merkle leaves, one per block
+};
+
+/**
+ * @brief Builds a FileDigest from data fed in pieces of any size, e.g. as
+ * an upload arrives.
+ */
+class DigestBuilder {
+public:
+    explicit DigestBuilder(bool withTree = false);
+
+    void update(const char* data, size_t length);
+
+    /**
+     * @brief Completes the last block and moves the result into out. The
+     * caller fills in out.stat.
+     */
+    void finish(FileDigest& out);
+
+private:
+    uint32_t crc_ = 0;
+    uint32_t blockCrc_ = 0;
+    uint32_t weakA_ = 0;
+    uint32_t weakB_ = 0;
+    size_t blockFill_ = 0;
+    std::vector<BlockSignature> blocks_;
+    std::unique_ptr<Sha256> leafHash_;     // Null unless building the tree
+    std::vector<Hash256> leaves_;
+};
+
+/**
+ * @brief Reads and digests a file. False if it cannot be read or changed
+ * while being read. bytesPerSecond > 0 paces the reads; withTree also
+ * computes the Merkle leaves.
+ */
+bool digestFile(const std::string& path, FileDigest& out, uint64_t bytesPerSecond = 0, bool withTree = false);
+
+class FileIndex {
+public:
+    FileIndex() = default;
+    ~FileIndex();
+
+    FileIndex(const FileIndex&) = delete;
+    FileIndex& operator=(const FileIndex&) = delete;
+
+    /**
+     * @brief Maps directory/INDEX_FILE_NAME, creating it if needed, and
+     * indexes the valid records in it. A torn tail from a crash is cut off.
+     */
+    bool open(const std::string& directory);
+    bool isOpen() const { return base_ != nullptr; }
+
+    /**
+     * @brief Copies out the entry for name if it matches current.
+     */
+    bool lookup(const std::string& name, const FileStat& current, FileDigest& out) const;
+
+    /**
+     * @brief True if name has an entry computed for exactly current.
+     */
+    bool isCurrent(const std::string& name, const FileStat& current) const;
+
+    /**
+     * @brief Stores digest as the entry for name, replacing any older one.
+     */
+    bool store(const std::string& name, const FileDigest& digest);
+
+    /**
+     * @brief Drops entries whose names are not in present.
+     */
+    void retain(const std::unordered_set<std::string>& present);
+
+    /**
+     * @brief Rewrites the log without dead records once they outweigh the
+     * live ones.
+     */
+    bool compactIfNeeded();
+
+    size_t entries() const;
+    uint64_t bytes() const;
+
+private:
+    struct Header;
+    struct Record;
+
+    bool mapFile(int fd, uint64_t capacity);
+    bool reserve(uint64_t bytes);
+    bool append(const std::string& name, const FileDigest& digest, bool tombstone);
+    void load();
+    bool compact();
+    Header* header() const;
+
+    mutable std::shared_mutex mutex_;
+    std::string directory_;
+    int fd_ = -1;
+    char* base_ = nullptr;
+    uint64_t capacity_ = 0;
+    uint64_t liveBytes_ = 0;
+    std::unordered_map<std::string, uint64_t> offsets_;   // Name -> live record
+};
+
+#endif // FILESHARE_FILE_INDEX_H
@@ -0,0 +1,95 @@
+/*
+ * Credit-based flow control for DOWNLOAD and UPLOAD data phases.
+ *
+ * The receiver advertises a window (bytes it is willing to have in
+ * flight). The sender may only send while it holds credit and waits for
+ * an "ACK <bytes>" frame when it runs out; the receiver returns credit
+ * once it has consumed half a window. The receiver never grants credit
+ * beyond the end of the transfer, so every ACK it sends is one the
+ * sender will read before the transfer ends.
+ */
+
+#ifndef FILESHARE_FLOW_CONTROL_H
+#define FILESHARE_FLOW_CONTROL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include "libfileshare/protocol.h"
+#include "libfileshare/transport.h"
+
+const uint64_t DEFAULT_TRANSFER_WINDOW = 1024 * 1024;
+const uint64_t MAX_TRANSFER_WINDOW = 64 * 1024 * 1024;
+
+/**
+ * @brief Sender side: tracks how many bytes may still be sent.
+ */
+class SendCredit {
+public:
+    explicit SendCredit(uint64_t window) : credit_(window) {}
+
+    /**
+     * @brief Bytes that may be sent now, at most chunk and remaining.
+     * Zero means the sender must wait for an ACK.
+     */
+    uint64_t allowance(uint64_t chunk, uint64_t remaining) const {
+        return std::min({credit_, chunk, remaining});
+    }
+
+    void consume(uint64_t bytes) { credit_ -= std::min(bytes, credit_); }
+    void grant(uint64_t bytes) { credit_ += bytes; }
+    uint64_t credit() const { return credit_; }
+
+private:
+    uint64_t credit_;
+};
+
+/**
+ * @brief Receiver side: decides when to hand credit back to the sender.
+ */
+class ReceiveWindow {
+public:
+    ReceiveWindow(uint64_t window, uint64_t total)
+        : window_(window), total_(total), granted_(window) {}
+
+    /**
+     * @brief Records bytes consumed (written out). Returns the credit to
+     * send back in an ACK now, or 0 if no ACK is due.
+     */
+    uint64_t consume(uint64_t bytes) {
+        pending_ += bytes;
+        if (granted_ >= total_ || pending_ < std::max<uint64_t>(window_ / 2, 1)) {
+            return 0;
+        }
+        uint64_t grant = std::min(pending_, total_ - granted_);
+        granted_ += grant;
+        pending_ = 0;
+        return grant;
+    }
+
+private:
+    uint64_t window_;
+    uint64_t total_;
+    uint64_t granted_;
+    uint64_t pending_ = 0;
+};
+
+/**
+ * @brief Blocks for the next frame, which must be "ACK <bytes>", and adds
+ * it to the sender's credit. False on disconnect or protocol error.
+ */
+inline bool receiveCredit(Connection& conn, std::string& scratch, SendCredit& credit) {
+    if (!conn.recvFrame(scratch)) return false;
+    CommandView ack = tokenizeCommand(scratch);
+    uint64_t bytes = 0;
+    if (ack.verb != Verb::Ack || !parseNumber(ack.arg(0), bytes) || bytes == 0) return false;
+    credit.grant(bytes);
+    return true;
+}
+
+inline bool sendCredit(Connection& conn, uint64_t bytes) {
+    return conn.sendFrame("ACK " + std::to_string(bytes));
+}
+
+#endif // FILESHARE_FLOW_CONTROL_H
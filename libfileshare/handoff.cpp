@@ -0,0 +1,154 @@
+#include "libfileshare/handoff.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#include <cstring>
+
+namespace {
+
+const char HANDOFF_ACK = 'A';
+
+#ifndef _WIN32
+bool makeAddress(const std::string& path, sockaddr_un& addr) {
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+#endif
+
+} // namespace
+
+SocketType listenForHandoff(const std::string& path) {
+#ifdef _WIN32
+    (void)path;
+    return INVALID_SOCKET_HANDLE;
+#else
+    sockaddr_un addr;
+    if (!makeAddress(path, addr)) return INVALID_SOCKET_HANDLE;
+    SocketType sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) return INVALID_SOCKET_HANDLE;
+    ::unlink(path.c_str());           // Left by a server that handed off or crashed
+    if (bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::chmod(path.c_str(), 0600) < 0 ||
+        listen(sock, 1) < 0) {
+        CLOSE_SOCKET(sock);
+        return INVALID_SOCKET_HANDLE;
+    }
+    return sock;
+#endif
+}
+
+SocketType acceptHandoff(SocketType listener) {
+#ifdef _WIN32
+    (void)listener;
+    return INVALID_SOCKET_HANDLE;
+#else
+    SocketType channel = accept(listener, nullptr, nullptr);
+    if (channel < 0) return INVALID_SOCKET_HANDLE;
+#ifdef SO_PEERCRED
+    ucred peer{};
+    socklen_t length = sizeof(peer);
+    if (getsockopt(channel, SOL_SOCKET, SO_PEERCRED, &peer, &length) < 0 || peer.uid != ::getuid()) {
+        CLOSE_SOCKET(channel);
+        return INVALID_SOCKET_HANDLE;
+    }
+#endif
+    return channel;
+#endif
+}
+
+SocketType connectHandoff(const std::string& path) {
+#ifdef _WIN32
+    (void)path;
+    return INVALID_SOCKET_HANDLE;
+#else
+    sockaddr_un addr;
+    if (!makeAddress(path, addr)) return INVALID_SOCKET_HANDLE;
+    SocketType sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) return INVALID_SOCKET_HANDLE;
+    if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        CLOSE_SOCKET(sock);
+        return INVALID_SOCKET_HANDLE;
+    }
+    return sock;
+#endif
+}
+
+bool sendSockets(SocketType channel, const std::vector<SocketType>& sockets) {
+#ifdef _WIN32
+    (void)channel;
+    (void)sockets;
+    return false;
+#else
+    if (sockets.empty() || sockets.size() > MAX_HANDOFF_SOCKETS) return false;
+    // One byte of data carries the count; the sockets ride along with it.
+    char count = static_cast<char>(sockets.size());
+    iovec iov{&count, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(MAX_HANDOFF_SOCKETS * sizeof(int))] = {};
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = CMSG_SPACE(sockets.size() * sizeof(int));
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sockets.size() * sizeof(int));
+    std::memcpy(CMSG_DATA(header), sockets.data(), sockets.size() * sizeof(int));
+    return sendmsg(channel, &message, SEND_FLAGS) == 1;
+#endif
+}
+
+bool receiveSockets(SocketType channel, std::vector<SocketType>& sockets, int timeoutMs) {
+#ifdef _WIN32
+    (void)channel;
+    (void)sockets;
+    (void)timeoutMs;
+    return false;
+#else
+    if (!waitReadable(channel, timeoutMs)) return false;
+    char count = 0;
+    iovec iov{&count, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(MAX_HANDOFF_SOCKETS * sizeof(int))] = {};
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+    flags |= MSG_CMSG_CLOEXEC;
+#endif
+    if (recvmsg(channel, &message, flags) != 1) return false;
+
+    sockets.clear();
+    for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) continue;
+        size_t received = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < received; ++i) {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            sockets.push_back(fd);
+        }
+    }
+    if ((message.msg_flags & MSG_CTRUNC) || sockets.size() != static_cast<size_t>(count)) {
+        for (SocketType sock : sockets) CLOSE_SOCKET(sock);
+        sockets.clear();
+        return false;
+    }
+    return true;
+#endif
+}
+
+bool sendHandoffAck(SocketType channel) {
+    return send(channel, &HANDOFF_ACK, 1, SEND_FLAGS) == 1;
+}
+
+bool receiveHandoffAck(SocketType channel, int timeoutMs) {
+    char ack = 0;
+    return waitReadable(channel, timeoutMs) && recv(channel, &ack, 1, 0) == 1 && ack == HANDOFF_ACK;
+}
@@ -0,0 +1,69 @@
+/*
+ * Listening-socket hand-off between two server processes on one host.
+ *
+ * The running server listens on a Unix socket. A new server started to
+ * replace it connects there and is sent the running server's listening
+ * sockets as SCM_RIGHTS ancillary data; both processes then hold the same
+ * kernel sockets, so connections waiting in the accept queue are never
+ * refused. Once the new server has everything in place it acknowledges,
+ * and the old one stops accepting and drains. Until then the old server
+ * keeps serving, so a new binary that fails to start costs nothing.
+ *
+ * POSIX only: on Windows every call fails and servers are restarted the
+ * ordinary way.
+ */
+
+#ifndef FILESHARE_HANDOFF_H
+#define FILESHARE_HANDOFF_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "libfileshare/platform.h"
+
+const size_t MAX_HANDOFF_SOCKETS = 4;
+
+/**
+ * @brief Listens for a successor at path, replacing whatever socket file is
+ * there. The file is made accessible to this user only.
+ * @return The listener, or INVALID_SOCKET_HANDLE.
+ */
+SocketType listenForHandoff(const std::string& path);
+
+/**
+ * @brief Accepts a successor. Connections from another user are refused.
+ * @return The channel, or INVALID_SOCKET_HANDLE.
+ */
+SocketType acceptHandoff(SocketType listener);
+
+/**
+ * @brief Connects to the server listening at path.
+ * @return The channel, or INVALID_SOCKET_HANDLE if no server listens there.
+ */
+SocketType connectHandoff(const std::string& path);
+
+/**
+ * @brief Sends up to MAX_HANDOFF_SOCKETS sockets, in order. The sender's
+ * copies stay open.
+ */
+bool sendSockets(SocketType channel, const std::vector<SocketType>& sockets);
+
+/**
+ * @brief Receives the sockets sent with sendSockets(), waiting at most
+ * timeoutMs for them.
+ */
+bool receiveSockets(SocketType channel, std::vector<SocketType>& sockets, int timeoutMs);
+
+/**
+ * @brief Tells the sender that its sockets are in use.
+ */
+bool sendHandoffAck(SocketType channel);
+
+/**
+ * @brief Waits at most timeoutMs for sendHandoffAck(). False if the
+ * successor failed or gave up first.
+ */
+bool receiveHandoffAck(SocketType channel, int timeoutMs);
+
+#endif // FILESHARE_HANDOFF_H
@@ -0,0 +1,115 @@
+#include "libfileshare/merkle.h"
+
+#include <algorithm>
+
+#include <openssl/evp.h>
+
+#include "libfileshare/protocol.h"
+
+namespace {
+
+const unsigned char LEAF_PREFIX = 0x00;
+const unsigned char NODE_PREFIX = 0x01;
+
+int nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+} // namespace
+
+Sha256::Sha256() : ctx_(EVP_MD_CTX_new()) {
+    EVP_DigestInit_ex(static_cast<EVP_MD_CTX*>(ctx_), EVP_sha256(), nullptr);
+}
+
+Sha256::~Sha256() {
+    EVP_MD_CTX_free(static_cast<EVP_MD_CTX*>(ctx_));
+}
+
+void Sha256::update(const void* data, size_t length) {
+    EVP_DigestUpdate(static_cast<EVP_MD_CTX*>(ctx_), data, length);
+}
+
+Hash256 Sha256::finish() {
+    Hash256 hash{};
+    EVP_DigestFinal_ex(static_cast<EVP_MD_CTX*>(ctx_), hash.data(), nullptr);
+    EVP_DigestInit_ex(static_cast<EVP_MD_CTX*>(ctx_), EVP_sha256(), nullptr);
+    return hash;
+}
+
+Hash256 hashLeaf(const void* data, size_t length) {
+    Sha256 sha;
+    sha.update(&LEAF_PREFIX, 1);
+    sha.update(data, length);
+    return sha.finish();
+}
+
+Hash256 merkleRoot(const std::vector<Hash256>& leaves) {
+    if (leaves.empty()) return hashLeaf(nullptr, 0);
+    std::vector<Hash256> level = leaves;
+    Sha256 sha;
+    while (level.size() > 1) {
+        size_t parents = 0;
+        for (size_t i = 0; i + 1 < level.size(); i += 2) {
+            sha.update(&NODE_PREFIX, 1);
+            sha.update(level[i].data(), level[i].size());
+            sha.update(level[i + 1].data(), level[i + 1].size());
+            level[parents++] = sha.finish();
+        }
+        if (level.size() % 2) level[parents++] = level.back();
+        level.resize(parents);
+    }
+    return level[0];
+}
+
+std::string hashToHex(const Hash256& hash) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out(hash.size() * 2, '0');
+    for (size_t i = 0; i < hash.size(); ++i) {
+        out[2 * i] = digits[hash[i] >> 4];
+        out[2 * i + 1] = digits[hash[i] & 15];
+    }
+    return out;
+}
+
+bool parseHash(std::string_view text, Hash256& hash) {
+    if (text.size() != hash.size() * 2) return false;
+    for (size_t i = 0; i < hash.size(); ++i) {
+        int hi = nibble(text[2 * i]), lo = nibble(text[2 * i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        hash[i] = static_cast<uint8_t>(hi << 4 | lo);
+    }
+    return true;
+}
+
+void formatTreeReply(const TreeInfo& info, const std::vector<Hash256>& leaves, size_t first, std::string& out) {
+    size_t last = std::min(leaves.size(), first + TREE_LEAVES_PER_REPLY);
+    out = "TREE " + std::to_string(info.size) + " " + std::to_string(info.blockSize) + " " +
+          std::to_string(info.leafCount) + " " + hashToHex(info.root) + " " + std::to_string(first);
+    out.reserve(out.size() + (last - first) * 65);
+    for (size_t i = first; i < last; ++i) {
+        out += '\n';
+        out += hashToHex(leaves[i]);
+    }
+}
+
+bool parseTreeReply(std::string_view reply, TreeInfo& info, std::vector<Hash256>& leaves) {
+    size_t end = reply.find('\n');
+    CommandView head = tokenizeCommand(reply.substr(0, end));
+    size_t first = 0;
+    if (head.verbText != "TREE" || !parseNumber(head.arg(0), info.size) || !parseNumber(head.arg(1), info.blockSize) ||
+        !parseNumber(head.arg(2), info.leafCount) || !parseHash(head.arg(3), info.root) ||
+        !parseNumber(head.arg(4), first) || first != leaves.size() || info.blockSize == 0) {
+        return false;
+    }
+    while (end != std::string_view::npos) {
+        size_t start = end + 1;
+        end = reply.find('\n', start);
+        Hash256 leaf;
+        if (leaves.size() >= info.leafCount || !parseHash(reply.substr(start, end - start), leaf)) return false;
+        leaves.push_back(leaf);
+    }
+    return true;
+}
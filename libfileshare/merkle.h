@@ -0,0 +1,85 @@
+/*
+ * Merkle trees over file blocks, for verified segmented downloads.
+ *
+ * Every INDEX_BLOCK_SIZE block of a file is a leaf, SHA-256(0x00 || block);
+ * an inner node is SHA-256(0x01 || left || right), and the odd node at the
+ * end of a level is carried up unchanged (the RFC 6962 construction, whose
+ * prefixes keep a leaf from passing for an inner node). Once a client has
+ * checked the leaves against the root it can verify each block on its own,
+ * in any order and whichever connection brought it.
+ */
+
+#ifndef FILESHARE_MERKLE_H
+#define FILESHARE_MERKLE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+const size_t TREE_LEAVES_PER_REPLY = 16384;   // Leaves per TREE reply (1 MiB of hex)
+
+using Hash256 = std::array<uint8_t, 32>;
+
+/**
+ * @brief Incremental SHA-256.
+ */
+class Sha256 {
+public:
+    Sha256();
+    ~Sha256();
+
+    Sha256(const Sha256&) = delete;
+    Sha256& operator=(const Sha256&) = delete;
+
+    void update(const void* data, size_t length);
+
+    /**
+     * @brief Returns the digest and starts over.
+     */
+    Hash256 finish();
+
+private:
+    void* ctx_ = nullptr;         // EVP_MD_CTX
+};
+
+/**
+ * @brief The leaf hash of one block.
+ */
+Hash256 hashLeaf(const void* data, size_t length);
+
+/**
+ * @brief The root over leaves; for no leaves (an empty file), the leaf
+ * hash of no data.
+ */
+Hash256 merkleRoot(const std::vector<Hash256>& leaves);
+
+std::string hashToHex(const Hash256& hash);
+bool parseHash(std::string_view text, Hash256& hash);
+
+/**
+ * @brief The first line of a TREE reply.
+ */
+struct TreeInfo {
+    uint64_t size = 0;            // File size
+    uint64_t blockSize = 0;       // Bytes per leaf; the last block may be short
+    uint64_t leafCount = 0;
+    Hash256 root{};
+};
+
+/**
+ * @brief Formats "TREE <size> <blockSize> <leafCount> <root> <first>"
+ * followed by one hex leaf per line, for at most TREE_LEAVES_PER_REPLY
+ * leaves starting at first.
+ */
+void formatTreeReply(const TreeInfo& info, const std::vector<Hash256>& leaves, size_t first, std::string& out);
+
+/**
+ * @brief Parses a TREE reply, appending its leaves. The reply must
+ * continue where leaves ends.
+ */
+bool parseTreeReply(std::string_view reply, TreeInfo& info, std::vector<Hash256>& leaves);
+
+#endif // FILESHARE_MERKLE_H
@@ -0,0 +1,116 @@
+/*
+ * Low-overhead metrics primitives.
+ *
+ * Hot-path counters are sharded per thread onto separate cache lines so
+ * that concurrent transfers never contend on a shared counter; readers
+ * sum the shards.
+ */
+
+#ifndef FILESHARE_METRICS_H
+#define FILESHARE_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+const size_t METRIC_SHARDS = 16;
+
+/**
+ * @brief Returns this thread's shard index, assigned round-robin on first use.
+ */
+inline size_t metricShard() {
+    static std::atomic<size_t> nextShard{0};
+    thread_local size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+    return shard;
+}
+
+class ShardedCounter {
+public:
+    void add(uint64_t n = 1) {
+        shards_[metricShard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t total = 0;
+        for (const auto& shard : shards_) total += shard.value.load(std::memory_order_relaxed);
+        return total;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Shard, METRIC_SHARDS> shards_;
+};
+
+/**
+ * @brief HDR-style log-linear histogram: exact below 16, then 8 linear
+ * sub-buckets per power of two (<= 12.5% relative error) up to 2^40.
+ */
+class Histogram {
+public:
+    static const int SUB_BUCKETS = 8;
+    static const int BUCKETS = 16 + (40 - 4) * SUB_BUCKETS;
+
+    void record(uint64_t value) {
+        Shard& shard = shards_[metricShard()];
+        shard.counts[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Merged bucket counts across all shards.
+     */
+    std::array<uint64_t, BUCKETS> snapshot(uint64_t* sum = nullptr) const {
+        std::array<uint64_t, BUCKETS> merged{};
+        uint64_t total = 0;
+        for (const auto& shard : shards_) {
+            for (int i = 0; i < BUCKETS; ++i) merged[i] += shard.counts[i].load(std::memory_order_relaxed);
+            total += shard.sum.load(std::memory_order_relaxed);
+        }
+        if (sum) *sum = total;
+        return merged;
+    }
+
+    /**
+     * @brief Value at quantile q (0..1), reported as the bucket's upper bound.
+     */
+    static uint64_t percentile(const std::array<uint64_t, BUCKETS>& counts, double q) {
+        uint64_t total = 0;
+        for (uint64_t c : counts) total += c;
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(q * total);
+        if (rank >= total) rank = total - 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen > rank) return bucketUpperBound(i);
+        }
+        return bucketUpperBound(BUCKETS - 1);
+    }
+
+    static int bucketIndex(uint64_t value) {
+        if (value < 16) return static_cast<int>(value);
+        int msb = 63 - __builtin_clzll(value);
+        if (msb >= 40) return BUCKETS - 1;
+        int sub = static_cast<int>((value >> (msb - 3)) & (SUB_BUCKETS - 1));
+        return 16 + (msb - 4) * SUB_BUCKETS + sub;
+    }
+
+    static uint64_t bucketUpperBound(int index) {
+        if (index < 16) return static_cast<uint64_t>(index);
+        int msb = 4 + (index - 16) / SUB_BUCKETS;
+        uint64_t sub = (index - 16) % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (msb - 3)) - 1;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, BUCKETS> counts{};
+        std::atomic<uint64_t> sum{0};
+    };
+    std::array<Shard, METRIC_SHARDS> shards_;
+};
+
+#endif // FILESHARE_METRICS_H
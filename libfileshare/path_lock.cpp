@@ -0,0 +1,40 @@
+#include "libfileshare/path_lock.h"
+
+#include <algorithm>
+#include <functional>
+
+PathLockTable::Stripe& PathLockTable::stripeFor(std::string_view name) const {
+    return stripes_[std::hash<std::string_view>()(name) % PATH_LOCK_STRIPES];
+}
+
+bool PathLockTable::tryLock(std::string_view name) {
+    Stripe& stripe = stripeFor(name);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    if (std::find(stripe.names.begin(), stripe.names.end(), name) != stripe.names.end()) return false;
+    stripe.names.emplace_back(name);
+    stripe.count.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+void PathLockTable::unlock(std::string_view name) {
+    Stripe& stripe = stripeFor(name);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = std::find(stripe.names.begin(), stripe.names.end(), name);
+    if (it == stripe.names.end()) return;
+    *it = std::move(stripe.names.back());
+    stripe.names.pop_back();
+    stripe.count.fetch_sub(1, std::memory_order_release);
+}
+
+bool PathLockTable::isLocked(std::string_view name) const {
+    Stripe& stripe = stripeFor(name);
+    if (stripe.count.load(std::memory_order_acquire) == 0) return false;
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    return std::find(stripe.names.begin(), stripe.names.end(), name) != stripe.names.end();
+}
+
+size_t PathLockTable::held() const {
+    size_t total = 0;
+    for (const Stripe& stripe : stripes_) total += stripe.count.load(std::memory_order_relaxed);
+    return total;
+}
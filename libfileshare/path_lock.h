@@ -0,0 +1,81 @@
+/*
+ * Per-name write locks for files published by rename.
+ *
+ * Writers build a new version of a file elsewhere and rename it into
+ * place, so readers never need a lock: whatever they open is a complete
+ * version, which stays readable until they close it. What still needs
+ * coordinating is writers to the same name, which this table serializes
+ * without a global lock. Names hash to one of PATH_LOCK_STRIPES stripes,
+ * each with its own mutex and its own short list of held names, and a
+ * per-stripe count lets isLocked() answer without locking in the common
+ * case that nothing in the stripe is held.
+ */
+
+#ifndef FILESHARE_PATH_LOCK_H
+#define FILESHARE_PATH_LOCK_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+const size_t PATH_LOCK_STRIPES = 64;
+
+class PathLockTable {
+public:
+    /**
+     * @brief Takes the write lock on name. False, without waiting, if
+     * another writer holds it.
+     */
+    bool tryLock(std::string_view name);
+    void unlock(std::string_view name);
+
+    /**
+     * @brief True while a writer holds name.
+     */
+    bool isLocked(std::string_view name) const;
+
+    /**
+     * @brief Names held across all stripes.
+     */
+    size_t held() const;
+
+private:
+    struct alignas(64) Stripe {
+        mutable std::mutex mutex;
+        std::atomic<uint32_t> count{0};
+        std::vector<std::string> names;
+    };
+
+    Stripe& stripeFor(std::string_view name) const;
+
+    mutable Stripe stripes_[PATH_LOCK_STRIPES];
+};
+
+/**
+ * @brief Holds a PathLockTable write lock for its lifetime, if it got it.
+ */
+class PathLock {
+public:
+    PathLock(PathLockTable& table, std::string_view name) : table_(table), name_(name) {
+        owns_ = table_.tryLock(name_);
+    }
+    ~PathLock() {
+        if (owns_) table_.unlock(name_);
+    }
+
+    PathLock(const PathLock&) = delete;
+    PathLock& operator=(const PathLock&) = delete;
+
+    bool owns() const { return owns_; }
+
+private:
+    PathLockTable& table_;
+    std::string name_;
+    bool owns_ = false;
+};
+
+#endif // FILESHARE_PATH_LOCK_H
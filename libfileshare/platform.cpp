@@ -0,0 +1,121 @@
+#include "libfileshare/platform.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/resource.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+int initialize_networking() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+void cleanup_networking() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+void setReceiveTimeout(SocketType sock, int seconds) {
+#ifdef _WIN32
+    DWORD timeout = seconds * 1000;
+#else
+    timeval timeout{seconds, 0};
+#endif
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+}
+
+bool waitWritable(SocketType sock, int timeoutMs) {
+#ifdef _WIN32
+    WSAPOLLFD pfd{sock, POLLWRNORM, 0};
+    return WSAPoll(&pfd, 1, timeoutMs) > 0 && (pfd.revents & POLLWRNORM);
+#else
+    pollfd pfd{sock, POLLOUT, 0};
+    return poll(&pfd, 1, timeoutMs) > 0 && (pfd.revents & POLLOUT);
+#endif
+}
+
+bool waitReadable(SocketType sock, int timeoutMs) {
+#ifdef _WIN32
+    WSAPOLLFD pfd{sock, POLLRDNORM, 0};
+    return WSAPoll(&pfd, 1, timeoutMs) > 0 && (pfd.revents & POLLRDNORM);
+#else
+    pollfd pfd{sock, POLLIN, 0};
+    return poll(&pfd, 1, timeoutMs) > 0 && (pfd.revents & POLLIN);
+#endif
+}
+
+void setBlocking(SocketType sock, bool blocking) {
+#ifdef _WIN32
+    u_long nonBlocking = blocking ? 0 : 1;
+    ioctlsocket(sock, FIONBIO, &nonBlocking);
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0) return;
+    fcntl(sock, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+#endif
+}
+
+bool lastErrorWouldBlock() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+void setKeepalive(SocketType sock, int idleSec, int intervalSec, int count) {
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (const char*)&on, sizeof(on));
+#if defined(TCP_KEEPIDLE)
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, (const char*)&idleSec, sizeof(idleSec));
+#elif defined(TCP_KEEPALIVE) // macOS
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPALIVE, (const char*)&idleSec, sizeof(idleSec));
+#endif
+#ifdef TCP_KEEPINTVL
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, (const char*)&intervalSec, sizeof(intervalSec));
+#endif
+#ifdef TCP_KEEPCNT
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, (const char*)&count, sizeof(count));
+#endif
+    (void)intervalSec;
+    (void)count;
+}
+
+void shutdownSocket(SocketType sock) {
+#ifdef _WIN32
+    shutdown(sock, SD_BOTH);
+#else
+    shutdown(sock, SHUT_RDWR);
+#endif
+}
+
+void shutdownReceive(SocketType sock) {
+#ifdef _WIN32
+    shutdown(sock, SD_BOTH);
+#else
+    shutdown(sock, SHUT_RD);
+#endif
+}
+
+void lowerThreadPriority() {
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#else
+    // On Linux nice and I/O priority are per thread when given tid 0.
+    setpriority(PRIO_PROCESS, 0, 19);
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    const int IOPRIO_WHO_PROCESS = 1, IOPRIO_CLASS_IDLE = 3, IOPRIO_CLASS_SHIFT = 13;
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+#endif
+}
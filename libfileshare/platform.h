@@ -0,0 +1,103 @@
+/*
+ * Platform abstraction for sockets.
+ *
+ * Supports Windows (Winsock) and POSIX (Linux/macOS) sockets.
+ */
+
+#ifndef FILESHARE_PLATFORM_H
+#define FILESHARE_PLATFORM_H
+
+#ifdef _WIN32
+    // Windows (Winsock)
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #pragma comment(lib, "ws2_32.lib") // Link against the Winsock library
+    typedef SOCKET SocketType;
+    #define CLOSE_SOCKET(s) closesocket(s)
+    const SocketType INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+#else
+    // POSIX (Linux/macOS)
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <arpa/inet.h>
+    #include <unistd.h>
+    #include <poll.h>
+    typedef int SocketType;
+    #define CLOSE_SOCKET(s) ::close(s)
+    const SocketType INVALID_SOCKET_HANDLE = -1;
+#endif
+
+// Flags for every send(): a write to a vanished peer must fail with EPIPE,
+// not raise SIGPIPE and kill the process.
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+/**
+ * @brief Initializes platform-specific networking (e.g., Winsock).
+ * @return 0 on success, -1 on failure.
+ */
+int initialize_networking();
+
+/**
+ * @brief Cleans up platform-specific networking.
+ */
+void cleanup_networking();
+
+/**
+ * @brief Applies a receive timeout to a socket (0 disables it).
+ */
+void setReceiveTimeout(SocketType sock, int seconds);
+
+/**
+ * @brief Waits until a socket can accept more data without blocking.
+ * @return false on timeout or error (a negative timeout waits forever).
+ */
+bool waitWritable(SocketType sock, int timeoutMs);
+
+/**
+ * @brief Waits until a socket has data to read or, if it is listening, a
+ * connection to accept.
+ * @return false on timeout or error (a negative timeout waits forever).
+ */
+bool waitReadable(SocketType sock, int timeoutMs);
+
+/**
+ * @brief Switches a socket between blocking and non-blocking mode. On a
+ * listening socket shared with another process the mode is shared too.
+ */
+void setBlocking(SocketType sock, bool blocking);
+
+/**
+ * @brief True if the last socket call failed only because it would block.
+ */
+bool lastErrorWouldBlock();
+
+/**
+ * @brief Enables TCP keepalive probes: the first after idleSec of silence,
+ * then every intervalSec, giving up after count unanswered probes.
+ */
+void setKeepalive(SocketType sock, int idleSec, int intervalSec, int count);
+
+/**
+ * @brief Shuts down both directions, waking any thread blocked on the socket.
+ */
+void shutdownSocket(SocketType sock);
+
+/**
+ * @brief Shuts down the receive direction only, waking a thread blocked
+ * reading so it can still write a last reply. Windows cannot wake a reader
+ * this way, so there it shuts down both directions.
+ */
+void shutdownReceive(SocketType sock);
+
+/**
+ * @brief Drops the calling thread to the lowest CPU priority and, on Linux,
+ * the idle I/O class, for background work that must not slow transfers.
+ */
+void lowerThreadPriority();
+
+#endif // FILESHARE_PLATFORM_H
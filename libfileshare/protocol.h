@@ -0,0 +1,201 @@
+/*
+ * Wire protocol shared by client and server.
+ *
+ * Every message travels as one frame: a 4-byte big-endian payload length
+ * followed by the payload, which is passed through the cipher. Framing
+ * keeps message boundaries intact no matter how TCP splits or merges
+ * segments.
+ */
+
+#ifndef FILESHARE_PROTOCOL_H
+#define FILESHARE_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <charconv>
+#include <string_view>
+#include <system_error>
+
+const size_t FRAME_HEADER_SIZE = 4;
+const uint32_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+inline void encodeFrameHeader(uint32_t length, char* out) {
+    out[0] = static_cast<char>(length >> 24);
+    out[1] = static_cast<char>(length >> 16);
+    out[2] = static_cast<char>(length >> 8);
+    out[3] = static_cast<char>(length);
+}
+
+inline uint32_t decodeFrameHeader(const char* in) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(in);
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+// --- Command Parsing ---
+// Commands are tokenized into string_views over the received frame and the
+// verb is resolved through a perfect hash table computed at compile time,
+// so parsing a command never allocates.
+
+enum class Verb : uint8_t {
+    Unknown = 0,
+    Auth,
+    Resume,
+    List,
+    Download,
+    Range,
+    Upload,
+    Ack,
+    Stats,
+    Ping,
+    StartTls,
+    Tree,
+    Versions,
+    Restore,
+    Quit,
+};
+
+struct VerbName {
+    std::string_view name;
+    Verb verb;
+};
+
+constexpr VerbName VERB_NAMES[] = {
+    {"AUTH", Verb::Auth},
+    {"RESUME", Verb::Resume},
+    {"LIST", Verb::List},
+    {"DOWNLOAD", Verb::Download},
+    {"RANGE", Verb::Range},
+    {"UPLOAD", Verb::Upload},
+    {"ACK", Verb::Ack},
+    {"STATS", Verb::Stats},
+    {"PING", Verb::Ping},
+    {"STARTTLS", Verb::StartTls},
+    {"TREE", Verb::Tree},
+    {"VERSIONS", Verb::Versions},
+    {"RESTORE", Verb::Restore},
+    {"QUIT", Verb::Quit},
+};
+constexpr size_t VERB_COUNT = sizeof(VERB_NAMES) / sizeof(VERB_NAMES[0]);
+constexpr size_t VERB_TABLE_SIZE = 32;  // Power of two, > VERB_COUNT
+constexpr uint8_t VERB_TABLE_EMPTY = 0xff;
+
+constexpr uint32_t verbHash(std::string_view text, uint32_t seed) {
+    uint32_t hash = seed;
+    for (char c : text) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+    return hash ^ (hash >> 15);
+}
+
+/**
+ * @brief Smallest seed for which every verb lands in its own slot.
+ */
+constexpr uint32_t findVerbSeed() {
+    for (uint32_t seed = 2166136261u; seed < 2166136261u + 100000; ++seed) {
+        bool used[VERB_TABLE_SIZE] = {};
+        bool collision = false;
+        for (const VerbName& entry : VERB_NAMES) {
+            size_t slot = verbHash(entry.name, seed) & (VERB_TABLE_SIZE - 1);
+            if (used[slot]) {
+                collision = true;
+                break;
+            }
+            used[slot] = true;
+        }
+        if (!collision) return seed;
+    }
+    return 0;
+}
+
+constexpr uint32_t VERB_SEED = findVerbSeed();
+static_assert(VERB_SEED != 0, "No perfect hash seed for the verb table; grow VERB_TABLE_SIZE");
+
+struct VerbTable {
+    uint8_t slots[VERB_TABLE_SIZE];
+};
+
+constexpr VerbTable buildVerbTable() {
+    VerbTable table{};
+    for (size_t i = 0; i < VERB_TABLE_SIZE; ++i) table.slots[i] = VERB_TABLE_EMPTY;
+    for (size_t i = 0; i < VERB_COUNT; ++i) {
+        table.slots[verbHash(VERB_NAMES[i].name, VERB_SEED) & (VERB_TABLE_SIZE - 1)] = static_cast<uint8_t>(i);
+    }
+    return table;
+}
+
+constexpr VerbTable VERB_TABLE = buildVerbTable();
+
+/**
+ * @brief Maps a verb token to its Verb, or Verb::Unknown. Case-sensitive.
+ */
+constexpr Verb lookupVerb(std::string_view text) {
+    uint8_t index = VERB_TABLE.slots[verbHash(text, VERB_SEED) & (VERB_TABLE_SIZE - 1)];
+    if (index == VERB_TABLE_EMPTY || VERB_NAMES[index].name != text) return Verb::Unknown;
+    return VERB_NAMES[index].verb;
+}
+
+static_assert(lookupVerb("DOWNLOAD") == Verb::Download, "verb table is broken");
+static_assert(lookupVerb("download") == Verb::Unknown, "verbs are case-sensitive");
+
+const size_t MAX_COMMAND_ARGS = 8;
+
+/**
+ * @brief A command split into views over the original line. Valid only
+ * while that line is alive and unmodified.
+ */
+struct CommandView {
+    Verb verb = Verb::Unknown;
+    std::string_view verbText;
+    std::string_view args[MAX_COMMAND_ARGS];
+    size_t argCount = 0;
+
+    std::string_view arg(size_t index) const {
+        return index < argCount ? args[index] : std::string_view();
+    }
+};
+
+/**
+ * @brief Splits on spaces/tabs/newlines. Arguments beyond
+ * MAX_COMMAND_ARGS are ignored.
+ */
+inline CommandView tokenizeCommand(std::string_view line) {
+    CommandView view;
+    size_t pos = 0;
+    bool haveVerb = false;
+    while (pos < line.size()) {
+        while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t' || line[pos] == '\r' || line[pos] == '\n')) ++pos;
+        size_t start = pos;
+        while (pos < line.size() && line[pos] != ' ' && line[pos] != '\t' && line[pos] != '\r' && line[pos] != '\n') ++pos;
+        if (start == pos) break;
+        std::string_view token = line.substr(start, pos - start);
+        if (!haveVerb) {
+            view.verbText = token;
+            haveVerb = true;
+        } else if (view.argCount < MAX_COMMAND_ARGS) {
+            view.args[view.argCount++] = token;
+        }
+    }
+    view.verb = lookupVerb(view.verbText);
+    return view;
+}
+
+/**
+ * @brief Parses a whole token as a base-10 integer. False on any junk.
+ */
+template <typename T>
+bool parseNumber(std::string_view text, T& out) {
+    if (text.empty()) return false;
+    auto result = std::from_chars(text.data(), text.data() + text.size(), out);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+/**
+ * @brief Parses an overload rejection: "BUSY retry-after <seconds>".
+ */
+inline bool parseBusyReply(std::string_view reply, int& retryAfterSec) {
+    CommandView view = tokenizeCommand(reply);
+    return view.verbText == "BUSY" && view.arg(0) == "retry-after" && parseNumber(view.arg(1), retryAfterSec);
+}
+// --- End Command Parsing ---
+
+#endif // FILESHARE_PROTOCOL_H
@@ -0,0 +1,65 @@
+/*
+ * Token-bucket rate limiting.
+ *
+ * Implemented as GCRA (virtual scheduling): the bucket is one atomic
+ * "theoretical arrival time", so reserving tokens is a single CAS loop
+ * with no lock and no background refill. A reservation always succeeds
+ * and tells the caller how long to wait before using the tokens, which
+ * lets several buckets (connection, user, global) be charged together.
+ * The rate can be changed while the bucket is in use; reservations
+ * already made keep the wait they were given.
+ */
+
+#ifndef FILESHARE_RATE_LIMIT_H
+#define FILESHARE_RATE_LIMIT_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+class TokenBucket {
+public:
+    /**
+     * @param rate Bytes per second; 0 means unlimited.
+     * @param burst Bytes that may be sent back-to-back after idling.
+     */
+    TokenBucket(uint64_t rate, uint64_t burst) { setRate(rate, burst); }
+
+    void setRate(uint64_t rate, uint64_t burst) {
+        burstNs_.store(rate > 0 ? static_cast<int64_t>(burst * 1e9 / rate) : 0, std::memory_order_relaxed);
+        rate_.store(rate, std::memory_order_relaxed);
+    }
+
+    bool unlimited() const { return rate() == 0; }
+    uint64_t rate() const { return rate_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Charges bytes to the bucket.
+     * @return How long the caller must wait before sending them.
+     */
+    std::chrono::nanoseconds reserve(uint64_t bytes) {
+        uint64_t rate = this->rate();
+        if (rate == 0) return std::chrono::nanoseconds(0);
+        int64_t now = nowNs();
+        int64_t cost = static_cast<int64_t>(bytes * 1e9 / rate);
+        int64_t tat = tat_.load(std::memory_order_relaxed);
+        int64_t newTat;
+        do {
+            newTat = (tat > now ? tat : now) + cost;
+        } while (!tat_.compare_exchange_weak(tat, newTat, std::memory_order_relaxed));
+        int64_t wait = newTat - burstNs_.load(std::memory_order_relaxed) - now;
+        return std::chrono::nanoseconds(wait > 0 ? wait : 0);
+    }
+
+private:
+    static int64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::atomic<uint64_t> rate_{0};
+    std::atomic<int64_t> burstNs_{0};
+    std::atomic<int64_t> tat_{0};
+};
+
+#endif // FILESHARE_RATE_LIMIT_H
@@ -0,0 +1,55 @@
+#include "libfileshare/scheduler.h"
+
+FairScheduler::FairScheduler(size_t slots, uint64_t quantum)
+    : slots_(slots), free_(slots), quantum_(quantum > 0 ? quantum : 1) {}
+
+void FairScheduler::acquire(Flow& flow, uint64_t bytes) {
+    if (slots_ == 0) return;
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (free_ > 0 && queue_.empty()) {
+        // Uncontended: an idle scheduler owes nobody a turn.
+        --free_;
+        flow.deficit = 0;
+        return;
+    }
+    flow.want = bytes;
+    flow.granted = false;
+    // Credit left over from this round keeps the flow's place at the front.
+    if (flow.deficit >= bytes) {
+        queue_.push_front(&flow);
+    } else {
+        queue_.push_back(&flow);
+    }
+    dispatchLocked();
+    flow.ready.wait(lock, [&] { return flow.granted; });
+}
+
+void FairScheduler::release() {
+    if (slots_ == 0) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++free_;
+    dispatchLocked();
+}
+
+size_t FairScheduler::waiting() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+void FairScheduler::dispatchLocked() {
+    while (free_ > 0 && !queue_.empty()) {
+        Flow* flow = queue_.front();
+        queue_.pop_front();
+        if (flow->deficit < flow->want) {
+            flow->deficit += quantum_ * flow->weight;
+        }
+        if (flow->deficit < flow->want) {
+            queue_.push_back(flow); // Not enough credit yet; next round
+            continue;
+        }
+        flow->deficit -= flow->want;
+        flow->granted = true;
+        --free_;
+        flow->ready.notify_one();
+    }
+}
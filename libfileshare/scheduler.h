@@ -0,0 +1,65 @@
+/*
+ * Weighted fair scheduling of transfer sends.
+ *
+ * Deficit round robin over the transfers that want to send: a fixed
+ * number of send slots is handed out in DRR order, each flow earning
+ * quantum * weight bytes of credit per visit. Instead of racing for the
+ * socket whenever the OS happens to run their thread, transfers wait for
+ * their turn, which bounds how long a small transfer can be stuck behind
+ * many large ones and splits throughput in proportion to weight.
+ */
+
+#ifndef FILESHARE_SCHEDULER_H
+#define FILESHARE_SCHEDULER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+class FairScheduler {
+public:
+    /**
+     * @brief One transfer's scheduling state. Owned by the transfer; must
+     * not be destroyed while acquire() is blocked on it.
+     */
+    struct Flow {
+        explicit Flow(uint32_t weight = 1) : weight(weight > 0 ? weight : 1) {}
+
+        uint32_t weight;
+        uint64_t deficit = 0;
+        uint64_t want = 0;
+        bool granted = false;
+        std::condition_variable ready;
+    };
+
+    /**
+     * @param slots Sends allowed in flight at once; 0 disables scheduling.
+     * @param quantum Bytes of credit a weight-1 flow earns per round.
+     */
+    FairScheduler(size_t slots, uint64_t quantum);
+
+    /**
+     * @brief Blocks until the flow may send `bytes`. Every acquire() must
+     * be paired with a release() once the send completes.
+     */
+    void acquire(Flow& flow, uint64_t bytes);
+    void release();
+
+    /**
+     * @brief Flows currently waiting for a slot.
+     */
+    size_t waiting() const;
+
+private:
+    void dispatchLocked();
+
+    mutable std::mutex mutex_;
+    std::deque<Flow*> queue_;
+    size_t slots_;
+    size_t free_;
+    uint64_t quantum_;
+};
+
+#endif // FILESHARE_SCHEDULER_H
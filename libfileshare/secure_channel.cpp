@@ -0,0 +1,252 @@
+#include "libfileshare/secure_channel.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+
+#include "libfileshare/transport.h"
+
+#if defined(__linux__) && __has_include(<linux/tls.h>)
+#define FILESHARE_HAVE_KTLS 1
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
+namespace {
+
+const size_t X25519_KEY_SIZE = 32;
+const unsigned char TLS_APPLICATION_DATA = 23;
+
+std::string toHex(const unsigned char* data, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out(length * 2, '0');
+    for (size_t i = 0; i < length; ++i) {
+        out[2 * i] = digits[data[i] >> 4];
+        out[2 * i + 1] = digits[data[i] & 15];
+    }
+    return out;
+}
+
+bool fromHex(std::string_view text, unsigned char* out, size_t length) {
+    if (text.size() != length * 2) return false;
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    for (size_t i = 0; i < length; ++i) {
+        int hi = nibble(text[2 * i]), lo = nibble(text[2 * i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out[i] = static_cast<unsigned char>(hi << 4 | lo);
+    }
+    return true;
+}
+
+bool hkdfSha256(const unsigned char* ikm, size_t ikmLength, std::string_view salt, const std::string& info,
+                unsigned char* out, size_t outLength) {
+    EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+    bool ok = ctx && EVP_PKEY_derive_init(ctx) > 0 &&
+              EVP_PKEY_CTX_set_hkdf_md(ctx, EVP_sha256()) > 0 &&
+              EVP_PKEY_CTX_set1_hkdf_salt(ctx, reinterpret_cast<const unsigned char*>(salt.data()),
+                                          static_cast<int>(salt.size())) > 0 &&
+              EVP_PKEY_CTX_set1_hkdf_key(ctx, ikm, static_cast<int>(ikmLength)) > 0 &&
+              EVP_PKEY_CTX_add1_hkdf_info(ctx, reinterpret_cast<const unsigned char*>(info.data()),
+                                          static_cast<int>(info.size())) > 0 &&
+              EVP_PKEY_derive(ctx, out, &outLength) > 0;
+    EVP_PKEY_CTX_free(ctx);
+    return ok;
+}
+
+} // namespace
+
+KeyShare::KeyShare() {
+    EVP_PKEY* key = nullptr;
+    EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, nullptr);
+    if (ctx && EVP_PKEY_keygen_init(ctx) > 0 && EVP_PKEY_keygen(ctx, &key) > 0) {
+        unsigned char pub[X25519_KEY_SIZE];
+        size_t length = sizeof(pub);
+        if (EVP_PKEY_get_raw_public_key(key, pub, &length) > 0 && length == X25519_KEY_SIZE) {
+            key_ = key;
+            publicHex_ = toHex(pub, length);
+        } else {
+            EVP_PKEY_free(key);
+        }
+    }
+    EVP_PKEY_CTX_free(ctx);
+}
+
+KeyShare::~KeyShare() {
+    EVP_PKEY_free(static_cast<EVP_PKEY*>(key_));
+}
+
+bool KeyShare::deriveTrafficKeys(std::string_view peerHex, std::string_view psk, bool isServer,
+                                 TrafficKeys& tx, TrafficKeys& rx) const {
+    unsigned char peerPub[X25519_KEY_SIZE];
+    if (!key_ || !fromHex(peerHex, peerPub, sizeof(peerPub))) return false;
+    EVP_PKEY* peer = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, nullptr, peerPub, sizeof(peerPub));
+    if (!peer) return false;
+
+    unsigned char secret[X25519_KEY_SIZE];
+    size_t secretLength = sizeof(secret);
+    EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(static_cast<EVP_PKEY*>(key_), nullptr);
+    bool ok = ctx && EVP_PKEY_derive_init(ctx) > 0 && EVP_PKEY_derive_set_peer(ctx, peer) > 0 &&
+              EVP_PKEY_derive(ctx, secret, &secretLength) > 0 && secretLength == sizeof(secret);
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(peer);
+    // An all-zero secret means the peer sent a low-order point.
+    if (!ok || std::all_of(secret, secret + sizeof(secret), [](unsigned char b) { return b == 0; })) return false;
+
+    // Both public keys go into the info string, client's first, so the
+    // keys are bound to this exchange.
+    std::string info = "fileshare starttls ";
+    info += isServer ? std::string(peerHex) : publicHex_;
+    info += isServer ? publicHex_ : std::string(peerHex);
+    unsigned char material[2 * (SESSION_KEY_SIZE + SESSION_IV_SIZE)];
+    ok = hkdfSha256(secret, sizeof(secret), psk, info, material, sizeof(material));
+    OPENSSL_cleanse(secret, sizeof(secret));
+    if (!ok) return false;
+
+    TrafficKeys clientKeys, serverKeys;
+    const unsigned char* p = material;
+    std::memcpy(clientKeys.key, p, SESSION_KEY_SIZE);
+    std::memcpy(clientKeys.iv, p += SESSION_KEY_SIZE, SESSION_IV_SIZE);
+    std::memcpy(serverKeys.key, p += SESSION_IV_SIZE, SESSION_KEY_SIZE);
+    std::memcpy(serverKeys.iv, p += SESSION_KEY_SIZE, SESSION_IV_SIZE);
+    OPENSSL_cleanse(material, sizeof(material));
+    tx = isServer ? serverKeys : clientKeys;
+    rx = isServer ? clientKeys : serverKeys;
+    return true;
+}
+
+RecordCipher::RecordCipher(const TrafficKeys& keys, bool encrypt) {
+    std::memcpy(iv_, keys.iv, sizeof(iv_));
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (ctx && EVP_CipherInit_ex(ctx, EVP_aes_128_gcm(), nullptr, keys.key, nullptr, encrypt ? 1 : 0) > 0) {
+        ctx_ = ctx;
+    } else {
+        EVP_CIPHER_CTX_free(ctx);
+    }
+}
+
+RecordCipher::~RecordCipher() {
+    EVP_CIPHER_CTX_free(static_cast<EVP_CIPHER_CTX*>(ctx_));
+}
+
+void RecordCipher::nonce(uint8_t out[SESSION_IV_SIZE]) const {
+    // RFC 8446 5.3: the IV XOR the 64-bit big-endian record sequence number.
+    std::memcpy(out, iv_, SESSION_IV_SIZE);
+    for (int i = 0; i < 8; ++i) {
+        out[SESSION_IV_SIZE - 1 - i] ^= static_cast<uint8_t>(sequence_ >> (8 * i));
+    }
+}
+
+bool RecordCipher::seal(const IoSlice* slices, size_t count, std::string& out) {
+    EVP_CIPHER_CTX* ctx = static_cast<EVP_CIPHER_CTX*>(ctx_);
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) total += slices[i].length;
+    size_t sliceOffset = 0;
+    while (total > 0) {
+        size_t plain = std::min(total, TLS_MAX_PLAINTEXT);
+        size_t bodyLength = plain + 1 + TLS_TAG_SIZE;   // Inner content type, then the tag
+        size_t at = out.size();
+        out.resize(at + TLS_HEADER_SIZE + bodyLength);
+        unsigned char* header = reinterpret_cast<unsigned char*>(&out[at]);
+        header[0] = TLS_APPLICATION_DATA;
+        header[1] = 3;
+        header[2] = 3;
+        header[3] = static_cast<unsigned char>(bodyLength >> 8);
+        header[4] = static_cast<unsigned char>(bodyLength);
+
+        uint8_t iv[SESSION_IV_SIZE];
+        nonce(iv);
+        int n = 0;
+        if (EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, iv) <= 0 ||
+            EVP_EncryptUpdate(ctx, nullptr, &n, header, TLS_HEADER_SIZE) <= 0) {
+            return false;
+        }
+        unsigned char* dst = header + TLS_HEADER_SIZE;
+        for (size_t left = plain; left > 0;) {
+            while (slices->length == sliceOffset) {
+                ++slices;
+                sliceOffset = 0;
+            }
+            size_t take = std::min(left, slices->length - sliceOffset);
+            if (EVP_EncryptUpdate(ctx, dst, &n, reinterpret_cast<const unsigned char*>(slices->data + sliceOffset),
+                                  static_cast<int>(take)) <= 0) {
+                return false;
+            }
+            dst += n;
+            sliceOffset += take;
+            left -= take;
+        }
+        if (EVP_EncryptUpdate(ctx, dst, &n, &TLS_APPLICATION_DATA, 1) <= 0) return false;
+        dst += n;
+        if (EVP_EncryptFinal_ex(ctx, dst, &n) <= 0) return false;
+        dst += n;
+        if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, TLS_TAG_SIZE, dst) <= 0) return false;
+        ++sequence_;
+        total -= plain;
+    }
+    return true;
+}
+
+bool RecordCipher::open(const char* header, const char* body, size_t bodyLength, char* out, size_t& plainLength) {
+    EVP_CIPHER_CTX* ctx = static_cast<EVP_CIPHER_CTX*>(ctx_);
+    if (static_cast<unsigned char>(header[0]) != TLS_APPLICATION_DATA || bodyLength <= TLS_TAG_SIZE ||
+        bodyLength > TLS_MAX_RECORD_BODY) {
+        return false;
+    }
+    uint8_t iv[SESSION_IV_SIZE];
+    nonce(iv);
+    size_t cipherLength = bodyLength - TLS_TAG_SIZE;
+    int n = 0;
+    if (EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, iv) <= 0 ||
+        EVP_DecryptUpdate(ctx, nullptr, &n, reinterpret_cast<const unsigned char*>(header), TLS_HEADER_SIZE) <= 0 ||
+        EVP_DecryptUpdate(ctx, reinterpret_cast<unsigned char*>(out), &n, reinterpret_cast<const unsigned char*>(body),
+                          static_cast<int>(cipherLength)) <= 0 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, TLS_TAG_SIZE, const_cast<char*>(body + cipherLength)) <= 0 ||
+        EVP_DecryptFinal_ex(ctx, reinterpret_cast<unsigned char*>(out) + n, &n) <= 0) {
+        return false;
+    }
+    ++sequence_;
+    // Strip padding; the last non-zero byte is the real content type.
+    size_t length = cipherLength;
+    while (length > 0 && out[length - 1] == 0) --length;
+    if (length == 0 || static_cast<unsigned char>(out[length - 1]) != TLS_APPLICATION_DATA) return false;
+    plainLength = length - 1;
+    return true;
+}
+
+void installKernelTls(SocketType sock, const TrafficKeys& tx, const TrafficKeys& rx, bool& txOk, bool& rxOk) {
+    txOk = rxOk = false;
+#ifdef FILESHARE_HAVE_KTLS
+    if (setsockopt(sock, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) return;
+    auto install = [sock](int direction, const TrafficKeys& keys) {
+        // kTLS splits the TLS 1.3 IV into a 4-byte salt and an 8-byte "iv".
+        tls12_crypto_info_aes_gcm_128 info{};
+        info.info.version = TLS_1_3_VERSION;
+        info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        std::memcpy(info.key, keys.key, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+        std::memcpy(info.salt, keys.iv, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+        std::memcpy(info.iv, keys.iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+        bool ok = setsockopt(sock, SOL_TLS, direction, &info, sizeof(info)) == 0;
+        OPENSSL_cleanse(&info, sizeof(info));
+        return ok;
+    };
+    txOk = install(TLS_TX, tx);
+    rxOk = install(TLS_RX, rx);
+#else
+    (void)sock;
+    (void)tx;
+    (void)rx;
+#endif
+}
@@ -0,0 +1,103 @@
+/*
+ * Session encryption negotiated after AUTH (STARTTLS).
+ *
+ * The client and server exchange ephemeral X25519 public keys and derive
+ * per-direction AES-128-GCM traffic keys with HKDF-SHA256, salted with the
+ * shared ENCRYPTION_KEY. From then on the stream is a sequence of TLS 1.3
+ * application-data records, so it can be produced either by the kernel
+ * (kTLS, TCP_ULP "tls") or by RecordCipher in user space, independently
+ * on each side and in each direction.
+ */
+
+#ifndef FILESHARE_SECURE_CHANNEL_H
+#define FILESHARE_SECURE_CHANNEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "libfileshare/platform.h"
+
+struct IoSlice;
+
+const size_t TLS_HEADER_SIZE = 5;
+const size_t TLS_TAG_SIZE = 16;
+const size_t TLS_MAX_PLAINTEXT = 16 * 1024;
+const size_t TLS_MAX_RECORD_BODY = TLS_MAX_PLAINTEXT + 256;   // RFC 8446 limit on the ciphertext
+const size_t SESSION_KEY_SIZE = 16;
+const size_t SESSION_IV_SIZE = 12;
+
+struct TrafficKeys {
+    uint8_t key[SESSION_KEY_SIZE];
+    uint8_t iv[SESSION_IV_SIZE];
+};
+
+/**
+ * @brief One side's ephemeral X25519 key pair for a STARTTLS exchange.
+ */
+class KeyShare {
+public:
+    KeyShare();
+    ~KeyShare();
+
+    KeyShare(const KeyShare&) = delete;
+    KeyShare& operator=(const KeyShare&) = delete;
+
+    bool valid() const { return key_ != nullptr; }
+    const std::string& publicKeyHex() const { return publicHex_; }
+
+    /**
+     * @brief Derives the traffic keys from the peer's hex public key.
+     * False if the peer key is malformed or the exchange fails.
+     */
+    bool deriveTrafficKeys(std::string_view peerHex, std::string_view psk, bool isServer,
+                           TrafficKeys& tx, TrafficKeys& rx) const;
+
+private:
+    void* key_ = nullptr;         // EVP_PKEY
+    std::string publicHex_;
+};
+
+/**
+ * @brief TLS 1.3 AES-128-GCM record protection for one direction.
+ */
+class RecordCipher {
+public:
+    RecordCipher(const TrafficKeys& keys, bool encrypt);
+    ~RecordCipher();
+
+    RecordCipher(const RecordCipher&) = delete;
+    RecordCipher& operator=(const RecordCipher&) = delete;
+
+    bool valid() const { return ctx_ != nullptr; }
+
+    /**
+     * @brief Appends the slices to out as application-data records of at
+     * most TLS_MAX_PLAINTEXT bytes each.
+     */
+    bool seal(const IoSlice* slices, size_t count, std::string& out);
+
+    /**
+     * @brief Decrypts the record with the given header and body into out,
+     * which must hold bodyLength bytes. False unless it authenticates and
+     * carries application data.
+     */
+    bool open(const char* header, const char* body, size_t bodyLength, char* out, size_t& plainLength);
+
+private:
+    void nonce(uint8_t out[SESSION_IV_SIZE]) const;
+
+    void* ctx_ = nullptr;         // EVP_CIPHER_CTX
+    uint8_t iv_[SESSION_IV_SIZE];
+    uint64_t sequence_ = 0;
+};
+
+/**
+ * @brief Hands record encryption to the kernel (Linux kTLS). Each
+ * direction is installed separately; txOk/rxOk report which took. Both
+ * stay false where the "tls" ULP is unavailable.
+ */
+void installKernelTls(SocketType sock, const TrafficKeys& tx, const TrafficKeys& rx, bool& txOk, bool& rxOk);
+
+#endif // FILESHARE_SECURE_CHANNEL_H
@@ -0,0 +1,131 @@
+#include "libfileshare/session_ticket.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include "libfileshare/protocol.h"
+
+namespace {
+
+const size_t TICKET_MAC_SIZE = 32;   // HMAC-SHA256
+
+void appendHex(std::string& out, const void* data, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; ++i) {
+        out += digits[bytes[i] >> 4];
+        out += digits[bytes[i] & 15];
+    }
+}
+
+int nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+/**
+ * @brief Decodes lowercase hex into out, which must hold text.size() / 2 bytes.
+ */
+bool decodeHex(std::string_view text, uint8_t* out) {
+    if (text.size() % 2) return false;
+    for (size_t i = 0; i < text.size(); i += 2) {
+        int hi = nibble(text[i]), lo = nibble(text[i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out[i / 2] = static_cast<uint8_t>(hi << 4 | lo);
+    }
+    return true;
+}
+
+bool readKey(const std::string& path, uint8_t* key) {
+    std::ifstream in(path, std::ios::binary);
+    char buffer[TICKET_KEY_SIZE + 1];
+    in.read(buffer, sizeof(buffer));
+    if (in.gcount() != static_cast<std::streamsize>(TICKET_KEY_SIZE)) return false;
+    std::copy(buffer, buffer + TICKET_KEY_SIZE, key);
+    return true;
+}
+
+} // namespace
+
+bool SessionTickets::loadOrCreateKey(const std::string& path) {
+    ready_ = readKey(path, key_);
+    if (ready_) return true;
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec)) return false;   // Present but unreadable or the wrong size
+
+    // Written aside and linked into place, so a server starting alongside
+    // never reads half a key, and whichever links first wins.
+    uint8_t fresh[TICKET_KEY_SIZE];
+    if (RAND_bytes(fresh, sizeof(fresh)) != 1) return false;
+    std::string temp = path + ".new-";
+    appendHex(temp, fresh, 4);
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        std::filesystem::permissions(temp, std::filesystem::perms::owner_read | std::filesystem::perms::owner_write,
+                                     ec);
+        out.write(reinterpret_cast<const char*>(fresh), sizeof(fresh));
+        OPENSSL_cleanse(fresh, sizeof(fresh));
+        if (!out.flush() || ec) {
+            std::filesystem::remove(temp, ec);
+            return false;
+        }
+    }
+    std::filesystem::create_hard_link(temp, path, ec);
+    std::error_code ignored;
+    std::filesystem::remove(temp, ignored);
+    ready_ = readKey(path, key_);
+    return ready_;
+}
+
+void SessionTickets::sign(std::string_view body, std::string_view binding, uint8_t* mac) const {
+    std::string message;
+    message.reserve(body.size() + binding.size());
+    message.append(body).append(binding);
+    unsigned int length = TICKET_MAC_SIZE;
+    HMAC(EVP_sha256(), key_, sizeof(key_), reinterpret_cast<const unsigned char*>(message.data()), message.size(),
+         mac, &length);
+}
+
+std::string SessionTickets::issue(std::string_view user, std::string_view binding, int64_t expiresUnix) const {
+    if (!ready_ || user.empty() || user.size() > MAX_TICKET_USER) return "";
+    std::string ticket = std::to_string(expiresUnix) + ".";
+    appendHex(ticket, user.data(), user.size());
+    uint8_t mac[TICKET_MAC_SIZE];
+    sign(ticket, binding, mac);
+    ticket += '.';
+    appendHex(ticket, mac, sizeof(mac));
+    return ticket;
+}
+
+bool SessionTickets::claimedUser(std::string_view ticket, std::string& user) {
+    size_t firstDot = ticket.find('.');
+    size_t lastDot = ticket.rfind('.');
+    if (firstDot == std::string_view::npos || lastDot == firstDot) return false;
+    std::string_view userHex = ticket.substr(firstDot + 1, lastDot - firstDot - 1);
+    uint8_t name[MAX_TICKET_USER];
+    if (userHex.empty() || userHex.size() > 2 * MAX_TICKET_USER || !decodeHex(userHex, name)) return false;
+    user.assign(reinterpret_cast<const char*>(name), userHex.size() / 2);
+    return true;
+}
+
+bool SessionTickets::verify(std::string_view ticket, std::string_view binding, int64_t nowUnix) const {
+    size_t firstDot = ticket.find('.');
+    size_t lastDot = ticket.rfind('.');
+    if (!ready_ || firstDot == std::string_view::npos || lastDot == firstDot) return false;
+    std::string_view body = ticket.substr(0, lastDot);
+    int64_t expires = 0;
+    uint8_t presented[TICKET_MAC_SIZE], expected[TICKET_MAC_SIZE];
+    if (!parseNumber(ticket.substr(0, firstDot), expires) || ticket.size() - lastDot - 1 != 2 * TICKET_MAC_SIZE ||
+        !decodeHex(ticket.substr(lastDot + 1), presented)) {
+        return false;
+    }
+    sign(body, binding, expected);
+    return CRYPTO_memcmp(presented, expected, TICKET_MAC_SIZE) == 0 && nowUnix < expires;
+}
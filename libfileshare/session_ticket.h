@@ -0,0 +1,64 @@
+/*
+ * Session tickets: a signed note that a user authenticated, for resuming.
+ *
+ * After AUTH the server hands the client "<expiry>.<user hex>.<mac hex>",
+ * where mac is HMAC-SHA256 over "<expiry>.<user hex>" and a binding under a
+ * key only the servers know. Presenting it with RESUME as the first command
+ * of a new connection stands in for AUTH until the expiry (Unix seconds)
+ * passes. The binding is not part of the ticket: the server supplies it
+ * again on RESUME, from the user's stored credential, so a ticket stops
+ * verifying as soon as the account is removed or its password changes.
+ * No session state is kept: every server sharing the key file and the
+ * credentials accepts every other's tickets, and they stay valid across
+ * restarts.
+ */
+
+#ifndef FILESHARE_SESSION_TICKET_H
+#define FILESHARE_SESSION_TICKET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+const size_t TICKET_KEY_SIZE = 32;
+const size_t MAX_TICKET_USER = 64;   // Longest user name a ticket carries
+
+class SessionTickets {
+public:
+    /**
+     * @brief Reads the key from path, or creates it there (mode 0600) with
+     * fresh random bytes if the file does not exist. False if neither works,
+     * in which case no tickets are issued and none verify.
+     */
+    bool loadOrCreateKey(const std::string& path);
+
+    bool isReady() const { return ready_; }
+
+    /**
+     * @brief A ticket for user valid until expiresUnix and only while the
+     * same binding is presented, or empty if no key is loaded or the name
+     * is too long.
+     */
+    std::string issue(std::string_view user, std::string_view binding, int64_t expiresUnix) const;
+
+    /**
+     * @brief The name a ticket claims to be for, without checking it; used
+     * to look up the binding to verify() it with. False if malformed.
+     */
+    static bool claimedUser(std::string_view ticket, std::string& user);
+
+    /**
+     * @brief Checks ticket's signature over binding and that it has not
+     * expired at nowUnix.
+     */
+    bool verify(std::string_view ticket, std::string_view binding, int64_t nowUnix) const;
+
+private:
+    void sign(std::string_view body, std::string_view binding, uint8_t* mac) const;
+
+    uint8_t key_[TICKET_KEY_SIZE] = {};
+    bool ready_ = false;
+};
+
+#endif // FILESHARE_SESSION_TICKET_H
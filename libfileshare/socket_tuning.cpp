@@ -0,0 +1,97 @@
+#include "libfileshare/socket_tuning.h"
+
+#include <algorithm>
+#include <cstring>
+
+const TuningProfile TUNING_PROFILES[] = {
+    {"none", false, false, false, 0, ""},
+    {"default", true, false, false, 0, ""},
+    {"latency", true, false, false, 16 * 1024, ""},
+    {"bulk", true, true, true, 256 * 1024, "bbr"},
+};
+const size_t TUNING_PROFILE_COUNT = sizeof(TUNING_PROFILES) / sizeof(TUNING_PROFILES[0]);
+
+const TuningProfile* findTuningProfile(std::string_view name) {
+    for (size_t i = 0; i < TUNING_PROFILE_COUNT; ++i) {
+        if (name == TUNING_PROFILES[i].name) return &TUNING_PROFILES[i];
+    }
+    return nullptr;
+}
+
+uint32_t measuredRttUs(SocketType sock) {
+#ifdef TCP_INFO
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+        return info.tcpi_rtt;
+    }
+#endif
+    (void)sock;
+    return 0;
+}
+
+/**
+ * @brief Sets a socket buffer size and returns the effective size, or 0 if
+ * left alone. On Linux a plain SO_SNDBUF/SO_RCVBUF is capped at
+ * net.core.[wr]mem_max and turns autotuning off, which usually leaves a
+ * smaller buffer than autotuning would reach; so only the privileged
+ * *FORCE variant is used there.
+ */
+static int setBufferSize(SocketType sock, int option, int forceOption, int bytes) {
+#ifdef __linux__
+    if (setsockopt(sock, SOL_SOCKET, forceOption, (const char*)&bytes, sizeof(bytes)) != 0) return 0;
+#else
+    (void)forceOption;
+    if (setsockopt(sock, SOL_SOCKET, option, (const char*)&bytes, sizeof(bytes)) != 0) return 0;
+#endif
+    int effective = 0;
+    socklen_t len = sizeof(effective);
+    getsockopt(sock, SOL_SOCKET, option, (char*)&effective, &len);
+    return effective;
+}
+
+TuningResult applyTuningProfile(SocketType sock, const TuningProfile& profile) {
+    TuningResult result;
+    if (profile.noDelay) {
+        int on = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+    }
+    if (profile.sizeBuffersFromBdp) {
+        result.rttUs = measuredRttUs(sock);
+        uint64_t bdp = TUNING_TARGET_BANDWIDTH * result.rttUs / 1000000;
+        // Small BDPs (e.g. loopback) are left to autotuning, which grows past them anyway.
+        if (2 * bdp >= static_cast<uint64_t>(TUNING_MIN_BUFFER)) {
+            int bytes = static_cast<int>(std::min<uint64_t>(2 * bdp, TUNING_MAX_BUFFER));
+#ifdef __linux__
+            result.sendBuffer = setBufferSize(sock, SO_SNDBUF, SO_SNDBUFFORCE, bytes);
+            result.recvBuffer = setBufferSize(sock, SO_RCVBUF, SO_RCVBUFFORCE, bytes);
+#else
+            result.sendBuffer = setBufferSize(sock, SO_SNDBUF, 0, bytes);
+            result.recvBuffer = setBufferSize(sock, SO_RCVBUF, 0, bytes);
+#endif
+        }
+    }
+#ifdef TCP_NOTSENT_LOWAT
+    if (profile.notSentLowat > 0) {
+        setsockopt(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (const char*)&profile.notSentLowat,
+                   sizeof(profile.notSentLowat));
+    }
+#endif
+#ifdef TCP_CONGESTION
+    if (profile.congestion[0] != '\0') {
+        result.congestionSet = setsockopt(sock, IPPROTO_TCP, TCP_CONGESTION, profile.congestion,
+                                          std::strlen(profile.congestion)) == 0;
+    }
+#endif
+    return result;
+}
+
+void setCork(SocketType sock, bool on) {
+#ifdef TCP_CORK
+    int value = on ? 1 : 0;
+    setsockopt(sock, IPPROTO_TCP, TCP_CORK, (const char*)&value, sizeof(value));
+#else
+    (void)sock;
+    (void)on;
+#endif
+}
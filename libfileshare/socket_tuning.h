@@ -0,0 +1,65 @@
+/*
+ * Socket tuning profiles.
+ *
+ * A profile bundles the TCP options applied to a connection right after
+ * accept()/connect(). Options the platform lacks are skipped.
+ */
+
+#ifndef FILESHARE_SOCKET_TUNING_H
+#define FILESHARE_SOCKET_TUNING_H
+
+#include <cstdint>
+#include <string_view>
+
+#include "libfileshare/platform.h"
+
+struct TuningProfile {
+    const char* name;
+    bool noDelay;               // TCP_NODELAY: control frames leave at once (no Nagle/delayed-ACK stall)
+    bool cork;                  // Cork bulk bursts so only full segments go out (Linux TCP_CORK)
+    bool sizeBuffersFromBdp;    // SO_SNDBUF/SO_RCVBUF = 2 x BDP from the measured RTT
+    int notSentLowat;           // TCP_NOTSENT_LOWAT in bytes (0 = kernel default)
+    const char* congestion;     // TCP_CONGESTION algorithm ("" = system default)
+};
+
+const uint64_t TUNING_TARGET_BANDWIDTH = 125000000;  // Bytes/s the BDP is sized for (1 Gbit/s)
+const int TUNING_MIN_BUFFER = 256 * 1024;        // Smaller BDPs keep kernel autotuning
+const int TUNING_MAX_BUFFER = 32 * 1024 * 1024;
+
+/**
+ * "none" applies nothing (kernel defaults), "default" only disables Nagle,
+ * "latency" also keeps little unsent data queued, and "bulk" adds corking,
+ * BDP-sized buffers and BBR.
+ */
+extern const TuningProfile TUNING_PROFILES[];
+extern const size_t TUNING_PROFILE_COUNT;
+
+/**
+ * @brief Looks a profile up by name. Null if unknown.
+ */
+const TuningProfile* findTuningProfile(std::string_view name);
+
+struct TuningResult {
+    uint32_t rttUs = 0;         // Handshake RTT the buffers were sized from (0 if unknown)
+    int sendBuffer = 0;         // Effective SO_SNDBUF (0 if left to autotuning)
+    int recvBuffer = 0;
+    bool congestionSet = false;
+};
+
+/**
+ * @brief Applies a profile to a connected socket.
+ */
+TuningResult applyTuningProfile(SocketType sock, const TuningProfile& profile);
+
+/**
+ * @brief Corks or uncorks a socket; uncorking flushes any partial segment.
+ * No-op where TCP_CORK is unavailable.
+ */
+void setCork(SocketType sock, bool on);
+
+/**
+ * @brief Smoothed RTT from TCP_INFO in microseconds (0 if unavailable).
+ */
+uint32_t measuredRttUs(SocketType sock);
+
+#endif // FILESHARE_SOCKET_TUNING_H
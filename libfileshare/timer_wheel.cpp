@@ -0,0 +1,47 @@
+#include "libfileshare/timer_wheel.h"
+
+TimerWheel::TimerWheel(uint64_t nowTick) : current_(nowTick) {
+    for (auto& level : slots_) {
+        for (TimerNode& head : level) {
+            head.prev = head.next = &head;
+        }
+    }
+}
+
+void TimerWheel::schedule(TimerNode& node, uint64_t expiryTick) {
+    if (node.scheduled()) {
+        unlink(node);
+    } else {
+        ++size_;
+    }
+    if (expiryTick <= current_) expiryTick = current_ + 1;
+    if (expiryTick - current_ > MAX_DELAY) expiryTick = current_ + MAX_DELAY;
+    node.expiry = expiryTick;
+    link(node);
+}
+
+void TimerWheel::cancel(TimerNode& node) {
+    if (!node.scheduled()) return;
+    unlink(node);
+    --size_;
+}
+
+void TimerWheel::link(TimerNode& node) {
+    // Cascaded nodes may be due this very tick (delta 0): level 0, current slot.
+    uint64_t delta = node.expiry - current_;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+        ++level;
+    }
+    TimerNode& head = slots_[level][(node.expiry >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    node.prev = head.prev;
+    node.next = &head;
+    head.prev->next = &node;
+    head.prev = &node;
+}
+
+void TimerWheel::unlink(TimerNode& node) {
+    node.prev->next = node.next;
+    node.next->prev = node.prev;
+    node.prev = node.next = nullptr;
+}
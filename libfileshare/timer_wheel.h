@@ -0,0 +1,91 @@
+/*
+ * Hierarchical timer wheel.
+ *
+ * LEVELS wheels of SLOTS buckets each; level L buckets span SLOTS^L ticks.
+ * Timers are intrusive nodes on doubly linked lists, so scheduling and
+ * cancelling are O(1) with no allocation, and advancing costs one bucket
+ * per tick plus an occasional cascade of a higher-level bucket into the
+ * levels below. Not thread-safe: the owner serializes access.
+ */
+
+#ifndef FILESHARE_TIMER_WHEEL_H
+#define FILESHARE_TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct TimerNode {
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    uint64_t expiry = 0;                    // Absolute tick
+
+    bool scheduled() const { return next != nullptr; }
+};
+
+class TimerWheel {
+public:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+    static constexpr uint64_t MAX_DELAY = (uint64_t(1) << (LEVELS * SLOT_BITS)) - 1;
+
+    explicit TimerWheel(uint64_t nowTick = 0);
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    /**
+     * @brief (Re)schedules a node to expire at an absolute tick. Past ticks
+     * expire on the next advance; delays beyond MAX_DELAY are clamped.
+     */
+    void schedule(TimerNode& node, uint64_t expiryTick);
+
+    /**
+     * @brief Unlinks a node. No-op if it is not scheduled.
+     */
+    void cancel(TimerNode& node);
+
+    /**
+     * @brief Moves time forward to nowTick, calling onExpire(TimerNode&) for
+     * every expired node (already unlinked; it may be rescheduled).
+     */
+    template <typename F>
+    void advance(uint64_t nowTick, F&& onExpire);
+
+    uint64_t now() const { return current_; }
+    size_t size() const { return size_; }
+
+private:
+    void link(TimerNode& node);
+    static void unlink(TimerNode& node);
+
+    TimerNode slots_[LEVELS][SLOTS];        // List heads (circular, self-linked when empty)
+    uint64_t current_;
+    size_t size_ = 0;
+};
+
+template <typename F>
+void TimerWheel::advance(uint64_t nowTick, F&& onExpire) {
+    while (current_ < nowTick) {
+        ++current_;
+        // A lower wheel just wrapped: redistribute the matching higher bucket.
+        for (int level = 1; level < LEVELS; ++level) {
+            if ((current_ & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) != 0) break;
+            TimerNode& head = slots_[level][(current_ >> (SLOT_BITS * level)) & (SLOTS - 1)];
+            while (head.next != &head) {
+                TimerNode& node = *head.next;
+                unlink(node);
+                link(node);
+            }
+        }
+        TimerNode& head = slots_[0][current_ & (SLOTS - 1)];
+        while (head.next != &head) {
+            TimerNode& node = *head.next;
+            unlink(node);
+            --size_;
+            onExpire(node);
+        }
+    }
+}
+
+#endif // FILESHARE_TIMER_WHEEL_H
@@ -0,0 +1,451 @@
+#include "libfileshare/transport.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef __linux__
+#define FILESHARE_HAVE_SENDFILE 1
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define FILESHARE_HAVE_ZEROCOPY 1
+#include <cerrno>
+#include <linux/errqueue.h>
+#endif
+
+#include "libfileshare/protocol.h"
+
+bool sendAll(SocketType sock, const char* data, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        int n = send(sock, data + sent, static_cast<int>(length - sent), SEND_FLAGS);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+bool recvAll(SocketType sock, char* data, size_t length) {
+    size_t received = 0;
+    while (received < length) {
+        int n = recv(sock, data + received, static_cast<int>(length - received), 0);
+        if (n <= 0) return false;
+        received += n;
+    }
+    return true;
+}
+
+bool sendAllGather(SocketType sock, IoSlice* slices, size_t count) {
+#ifdef _WIN32
+    for (size_t i = 0; i < count; ++i) {
+        if (!sendAll(sock, slices[i].data, slices[i].length)) return false;
+    }
+    return true;
+#else
+    const size_t MAX_SLICES = 8;
+    iovec iov[MAX_SLICES];
+    while (count > 0) {
+        size_t used = 0;
+        for (size_t i = 0; i < count && used < MAX_SLICES; ++i) {
+            if (slices[i].length == 0) continue;
+            iov[used].iov_base = const_cast<char*>(slices[i].data);
+            iov[used].iov_len = slices[i].length;
+            ++used;
+        }
+        if (used == 0) return true;
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = used;
+        ssize_t n = sendmsg(sock, &msg, SEND_FLAGS);
+        if (n <= 0) return false;
+        // Drop what was written, resuming mid-slice after a short write.
+        size_t written = static_cast<size_t>(n);
+        while (count > 0 && written >= slices->length) {
+            written -= slices->length;
+            ++slices;
+            --count;
+        }
+        if (count > 0) {
+            slices->data += written;
+            slices->length -= written;
+        }
+    }
+    return true;
+#endif
+}
+
+FileSource::FileSource(const std::string& path) {
+#ifdef FILESHARE_HAVE_SENDFILE
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#else
+    (void)path;
+#endif
+}
+
+FileSource::~FileSource() {
+#ifdef FILESHARE_HAVE_SENDFILE
+    if (mapped_) munmap(mapped_, mappedLength_);
+    if (fd_ >= 0) ::close(fd_);
+#endif
+}
+
+const char* FileSource::map() {
+#ifdef FILESHARE_HAVE_SENDFILE
+    if (!mapped_ && fd_ >= 0) {
+        struct stat st;
+        if (fstat(fd_, &st) != 0 || st.st_size <= 0) return nullptr;
+        void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) return nullptr;
+        mapped_ = p;
+        mappedLength_ = static_cast<size_t>(st.st_size);
+    }
+#endif
+    return static_cast<const char*>(mapped_);
+}
+
+Connection::Connection(SocketType sock, std::string key) : sock_(sock), key_(std::move(key)) {}
+
+Connection::~Connection() {
+    close();
+}
+
+void Connection::close() {
+    if (sock_ != INVALID_SOCKET_HANDLE) {
+        flush(); // Best effort: a final reply may still be queued
+        if (!zeroCopyPending_.empty()) {
+            reapZeroCopy(ZEROCOPY_WAIT_MS);
+            if (!zeroCopyPending_.empty()) {
+                // The kernel may still read these blocks after close(); they
+                // must never be reused for another client's data, so leak them.
+                new std::deque<std::pair<uint32_t, Buffer>>(std::move(zeroCopyPending_));
+            }
+        }
+        CLOSE_SOCKET(sock_);
+        sock_ = INVALID_SOCKET_HANDLE;
+    }
+}
+
+void Connection::appendFrame(std::string& out, const char* data, size_t length) {
+    size_t offset = out.size();
+    out.resize(offset + FRAME_HEADER_SIZE + length);
+    encodeFrameHeader(static_cast<uint32_t>(length), &out[offset]);
+    std::memcpy(&out[offset + FRAME_HEADER_SIZE], data, length);
+    xorCipher(&out[offset + FRAME_HEADER_SIZE], length, key_);
+}
+
+bool Connection::queueFrame(const char* data, size_t length) {
+    if (length > MAX_FRAME_SIZE) return false;
+    appendFrame(sendBuffer_, data, length);
+    return true;
+}
+
+bool Connection::writeOut(IoSlice* slices, size_t count) {
+    if (!sealer_) return sendAllGather(sock_, slices, count);
+    sealed_.clear();
+    return sealer_->seal(slices, count, sealed_) && sendAll(sock_, sealed_.data(), sealed_.size());
+}
+
+bool Connection::flush() {
+    if (sendBuffer_.empty()) return true;
+    IoSlice slice{sendBuffer_.data(), sendBuffer_.size()};
+    bool ok = writeOut(&slice, 1);
+    if (ok) bytesSent_ += sendBuffer_.size();
+    sendBuffer_.clear();
+    return ok;
+}
+
+bool Connection::sendFrame(const char* data, size_t length) {
+    return queueFrame(data, length) && flush();
+}
+
+bool Connection::sendFrame(Buffer& buffer, const std::string* trailer) {
+    size_t length = buffer.size();
+    char* frame = buffer.data() - FRAME_HEADER_SIZE;
+    encodeFrameHeader(static_cast<uint32_t>(length), frame);
+    xorCipher(buffer.data(), length, key_);
+    if (zeroCopyThreshold_ > 0 && length >= zeroCopyThreshold_) {
+        // Only the pinned block goes zero-copy; the small, reused queue and
+        // trailer strings are copied by ordinary sends around it.
+        return flush() && sendZeroCopy(buffer, frame, FRAME_HEADER_SIZE + length) &&
+               (!trailer || sendFrame(*trailer));
+    }
+    trailerBuffer_.clear();
+    if (trailer) {
+        if (trailer->size() > MAX_FRAME_SIZE) return false;
+        appendFrame(trailerBuffer_, trailer->data(), trailer->size());
+    }
+    IoSlice slices[] = {
+        {sendBuffer_.data(), sendBuffer_.size()},
+        {frame, FRAME_HEADER_SIZE + length},
+        {trailerBuffer_.data(), trailerBuffer_.size()},
+    };
+    size_t total = sendBuffer_.size() + FRAME_HEADER_SIZE + length + trailerBuffer_.size();
+    bool ok = writeOut(slices, 3);
+    sendBuffer_.clear();
+    if (!ok) return false;
+    bytesSent_ += total;
+    return true;
+}
+
+bool Connection::fill(size_t minBytes) {
+    if (recvBuffer_.empty()) recvBuffer_.resize(RECV_BUFFER_SIZE);
+    if (recvStart_ == recvEnd_) {
+        recvStart_ = recvEnd_ = 0;
+    } else if (recvBuffer_.size() - recvStart_ < minBytes) {
+        std::memmove(recvBuffer_.data(), recvBuffer_.data() + recvStart_, recvEnd_ - recvStart_);
+        recvEnd_ -= recvStart_;
+        recvStart_ = 0;
+    }
+    while (recvEnd_ - recvStart_ < minBytes) {
+        // Never block on the peer while our own replies sit in the queue.
+        if (!flush()) return false;
+        if (opener_) {
+            if (!readRecord()) return false;
+            continue;
+        }
+        int n = recv(sock_, recvBuffer_.data() + recvEnd_, static_cast<int>(recvBuffer_.size() - recvEnd_), 0);
+        if (n <= 0) return false;
+        recvEnd_ += n;
+    }
+    return true;
+}
+
+bool Connection::readPayload(char* out, size_t length) {
+    size_t buffered = std::min(length, recvEnd_ - recvStart_);
+    std::memcpy(out, recvBuffer_.data() + recvStart_, buffered);
+    recvStart_ += buffered;
+    size_t rest = length - buffered;
+    if (rest == 0) return true;
+    if (opener_) {
+        // Records must be decrypted, so everything goes through the buffer.
+        while (rest > 0) {
+            if (!fill(1)) return false;
+            size_t n = std::min(rest, recvEnd_ - recvStart_);
+            std::memcpy(out + length - rest, recvBuffer_.data() + recvStart_, n);
+            recvStart_ += n;
+            rest -= n;
+        }
+        return true;
+    }
+    if (rest < RECV_BUFFER_SIZE / 2) {
+        // Small remainder: read ahead so following frames come in the same recv.
+        if (!fill(rest)) return false;
+        std::memcpy(out + buffered, recvBuffer_.data() + recvStart_, rest);
+        recvStart_ += rest;
+        return true;
+    }
+    // Large remainder: straight into the destination, no extra copy.
+    return flush() && recvAll(sock_, out + buffered, rest);
+}
+
+bool Connection::readRecord() {
+    // Read ahead until a whole record is buffered; its header gives the length.
+    if (recordBuffer_.empty()) recordBuffer_.resize(TLS_HEADER_SIZE + TLS_MAX_RECORD_BODY);
+    size_t need = TLS_HEADER_SIZE;
+    bool haveLength = false;
+    while (true) {
+        size_t buffered = recordEnd_ - recordStart_;
+        if (!haveLength && buffered >= TLS_HEADER_SIZE) {
+            const unsigned char* header = reinterpret_cast<const unsigned char*>(recordBuffer_.data() + recordStart_);
+            size_t body = size_t(header[3]) << 8 | header[4];
+            if (body > TLS_MAX_RECORD_BODY) return false;
+            need += body;
+            haveLength = true;
+        }
+        if (haveLength && buffered >= need) break;
+        if (recordBuffer_.size() - recordStart_ < need) {
+            std::memmove(recordBuffer_.data(), recordBuffer_.data() + recordStart_, buffered);
+            recordEnd_ = buffered;
+            recordStart_ = 0;
+        }
+        int n = recv(sock_, recordBuffer_.data() + recordEnd_, static_cast<int>(recordBuffer_.size() - recordEnd_), 0);
+        if (n <= 0) return false;
+        recordEnd_ += n;
+    }
+
+    // Decrypt straight into the plaintext buffer.
+    size_t bodyLength = need - TLS_HEADER_SIZE;
+    if (recvBuffer_.size() - recvEnd_ < bodyLength) {
+        std::memmove(recvBuffer_.data(), recvBuffer_.data() + recvStart_, recvEnd_ - recvStart_);
+        recvEnd_ -= recvStart_;
+        recvStart_ = 0;
+        if (recvBuffer_.size() - recvEnd_ < bodyLength) recvBuffer_.resize(recvEnd_ + bodyLength);
+    }
+    const char* record = recordBuffer_.data() + recordStart_;
+    size_t plainLength = 0;
+    if (!opener_->open(record, record + TLS_HEADER_SIZE, bodyLength, recvBuffer_.data() + recvEnd_, plainLength)) {
+        return false;
+    }
+    recordStart_ += need;
+    recvEnd_ += plainLength;
+    return true;
+}
+
+bool Connection::recvFrame(std::string& payload) {
+    if (!fill(FRAME_HEADER_SIZE)) return false;
+    uint32_t length = decodeFrameHeader(recvBuffer_.data() + recvStart_);
+    if (length > MAX_FRAME_SIZE) return false;
+    recvStart_ += FRAME_HEADER_SIZE;
+    payload.resize(length);
+    if (length > 0 && !readPayload(&payload[0], length)) return false;
+    xorCipher(&payload[0], length, key_);
+    bytesReceived_ += FRAME_HEADER_SIZE + length;
+    return true;
+}
+
+bool Connection::recvFrame(Buffer& buffer) {
+    if (!fill(FRAME_HEADER_SIZE)) return false;
+    uint32_t length = decodeFrameHeader(recvBuffer_.data() + recvStart_);
+    if (length > Buffer::capacity()) return false;
+    recvStart_ += FRAME_HEADER_SIZE;
+    if (length > 0 && !readPayload(buffer.data(), length)) return false;
+    xorCipher(buffer.data(), length, key_);
+    buffer.setSize(length);
+    bytesReceived_ += FRAME_HEADER_SIZE + length;
+    return true;
+}
+
+bool Connection::enableZeroCopy(size_t threshold) {
+#ifdef FILESHARE_HAVE_ZEROCOPY
+    int on = 1;
+    if (threshold == 0 || secure_ || setsockopt(sock_, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) != 0) return false;
+    zeroCopyThreshold_ = threshold;
+    return true;
+#else
+    (void)threshold;
+    return false;
+#endif
+}
+
+bool Connection::sendZeroCopy(Buffer& buffer, const char* frame, size_t length) {
+#ifdef FILESHARE_HAVE_ZEROCOPY
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t n = send(sock_, frame + sent, length - sent, MSG_ZEROCOPY | SEND_FLAGS);
+        if (n < 0 && errno == ENOBUFS) {
+            // Out of optmem for pinned pages: wait for completions, then retry.
+            reapZeroCopy(ZEROCOPY_WAIT_MS);
+            continue;
+        }
+        if (n <= 0) return false;
+        ++zeroCopyNextId_;
+        sent += n;
+    }
+    bytesSent_ += length;
+    ++zeroCopyFrames_;
+    zeroCopyPending_.emplace_back(zeroCopyNextId_ - 1, buffer);
+    reapZeroCopy(0);
+    while (zeroCopyPending_.size() > ZEROCOPY_MAX_INFLIGHT) {
+        size_t before = zeroCopyPending_.size();
+        reapZeroCopy(ZEROCOPY_WAIT_MS);
+        if (zeroCopyPending_.size() == before) return false; // No completions: peer stalled
+    }
+    return true;
+#else
+    (void)buffer;
+    return sendAll(sock_, frame, length);
+#endif
+}
+
+void Connection::reapZeroCopy(int timeoutMs) {
+#ifdef FILESHARE_HAVE_ZEROCOPY
+    while (!zeroCopyPending_.empty()) {
+        char control[128];
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sock_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return;
+            if (timeoutMs == 0) return;
+            pollfd pfd{sock_, 0, 0};              // POLLERR is always reported
+            if (poll(&pfd, 1, timeoutMs) <= 0) return;
+            timeoutMs = 0;                        // Drain what is there, then return
+            continue;
+        }
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            bool recvErr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                           (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!recvErr) continue;
+            const auto* err = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            uint32_t first = err->ee_info, last = err->ee_data;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) zeroCopyCopied_ += last - first + 1;
+            // TCP completes sends in order: every block up to `last` is free.
+            while (!zeroCopyPending_.empty() &&
+                   static_cast<int32_t>(last - zeroCopyPending_.front().first) >= 0) {
+                zeroCopyPending_.pop_front();
+            }
+        }
+    }
+#else
+    (void)timeoutMs;
+#endif
+}
+
+bool Connection::startSecure(const TrafficKeys& tx, const TrafficKeys& rx) {
+    if (secure_ || !flush() || hasBufferedInput()) return false;
+    // Records are sealed as a whole, so pinned zero-copy blocks buy nothing.
+    reapZeroCopy(ZEROCOPY_WAIT_MS);
+    zeroCopyThreshold_ = 0;
+    installKernelTls(sock_, tx, rx, kernelTx_, kernelRx_);
+    if (!kernelTx_) sealer_ = std::make_unique<RecordCipher>(tx, true);
+    if (!kernelRx_) opener_ = std::make_unique<RecordCipher>(rx, false);
+    if ((sealer_ && !sealer_->valid()) || (opener_ && !opener_->valid())) return false;
+    key_.clear();    // The XOR cipher gives way to the records
+    secure_ = true;
+    return true;
+}
+
+bool Connection::sendFileFrame(const FileSource& file, uint64_t offset, size_t length, const std::string* trailer) {
+#ifdef FILESHARE_HAVE_SENDFILE
+    if (!kernelTx_ || !file.isOpen() || length > MAX_FRAME_SIZE) return false;
+    // MSG_MORE keeps the kernel's record open so the queued replies and the
+    // header share it with the start of the file data.
+    size_t offsetInQueue = sendBuffer_.size();
+    sendBuffer_.resize(offsetInQueue + FRAME_HEADER_SIZE);
+    encodeFrameHeader(static_cast<uint32_t>(length), &sendBuffer_[offsetInQueue]);
+    for (size_t sent = 0; sent < sendBuffer_.size();) {
+        ssize_t n = send(sock_, sendBuffer_.data() + sent, sendBuffer_.size() - sent, MSG_MORE | SEND_FLAGS);
+        if (n <= 0) {
+            sendBuffer_.clear();
+            return false;
+        }
+        sent += n;
+    }
+    bytesSent_ += sendBuffer_.size();
+    sendBuffer_.clear();
+    off_t position = static_cast<off_t>(offset);
+    for (size_t left = length; left > 0;) {
+        ssize_t n = sendfile(sock_, file.fd(), &position, left);
+        if (n <= 0) return false;
+        left -= n;
+    }
+    bytesSent_ += length;
+    return !trailer || sendFrame(*trailer);
+#else
+    (void)file;
+    (void)offset;
+    (void)length;
+    (void)trailer;
+    return false;
+#endif
+}
+
+bool requestSecureTransport(Connection& conn, std::string_view psk) {
+    KeyShare share;
+    if (!share.valid() || !conn.sendFrame("STARTTLS " + share.publicKeyHex())) return false;
+    std::string reply;
+    if (!conn.recvFrame(reply)) return false;
+    CommandView view = tokenizeCommand(reply);
+    TrafficKeys tx, rx;
+    return view.verbText == "OK_STARTTLS" && share.deriveTrafficKeys(view.arg(0), psk, false, tx, rx) &&
+           conn.startSecure(tx, rx);
+}
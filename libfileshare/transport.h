@@ -0,0 +1,224 @@
+/*
+ * Framed, ciphered message transport over a connected socket.
+ *
+ * Outgoing control frames can be queued and go out together with the next
+ * data frame in one gathered write (sendmsg/writev). Incoming bytes are
+ * read in large recv() calls into a buffer that is then split into frames,
+ * so pipelined commands cost one syscall per batch rather than two per
+ * frame. Queued output is always flushed before blocking on input.
+ *
+ * Optionally (Linux), large Buffer frames are sent with MSG_ZEROCOPY: the
+ * kernel transmits straight from the pooled block, the Connection keeps a
+ * reference to it until the socket error queue reports completion, and
+ * only then does the block go back to the pool.
+ *
+ * After STARTTLS the stream becomes TLS 1.3 records (see secure_channel.h)
+ * and the XOR cipher is dropped. Where the kernel encrypts (kTLS), file
+ * data can be sent with sendfile() straight from the page cache.
+ */
+
+#ifndef FILESHARE_TRANSPORT_H
+#define FILESHARE_TRANSPORT_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "libfileshare/buffer_pool.h"
+#include "libfileshare/cipher.h"
+#include "libfileshare/platform.h"
+#include "libfileshare/secure_channel.h"
+
+/**
+ * @brief Sends all bytes, retrying on short writes. False on error.
+ */
+bool sendAll(SocketType sock, const char* data, size_t length);
+
+/**
+ * @brief Receives exactly length bytes. False on close, timeout or error.
+ */
+bool recvAll(SocketType sock, char* data, size_t length);
+
+struct IoSlice {
+    const char* data;
+    size_t length;
+};
+
+/**
+ * @brief Sends several slices with as few gathered writes as possible.
+ */
+bool sendAllGather(SocketType sock, IoSlice* slices, size_t count);
+
+const size_t RECV_BUFFER_SIZE = 16 * 1024;  // Bytes read ahead per recv()
+const size_t ZEROCOPY_MAX_INFLIGHT = 32;    // Buffers held awaiting completion per connection
+const int ZEROCOPY_WAIT_MS = 1000;          // Longest wait for completions before giving up
+
+/**
+ * @brief A file opened for Connection::sendFileFrame(). Never open where
+ * sendfile() is unsupported.
+ */
+class FileSource {
+public:
+    explicit FileSource(const std::string& path);
+    ~FileSource();
+
+    FileSource(const FileSource&) = delete;
+    FileSource& operator=(const FileSource&) = delete;
+
+    bool isOpen() const { return fd_ >= 0; }
+    int fd() const { return fd_; }
+
+    /**
+     * @brief Maps the whole file read-only, so what sendFileFrame() sends
+     * can be checksummed without copying it. Null on failure or if empty.
+     */
+    const char* map();
+
+private:
+    int fd_ = -1;
+    void* mapped_ = nullptr;
+    size_t mappedLength_ = 0;
+};
+
+/**
+ * @brief Owns a connected socket and exchanges whole frames over it.
+ */
+class Connection {
+public:
+    explicit Connection(SocketType sock, std::string key = DEFAULT_ENCRYPTION_KEY);
+    ~Connection();
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    bool sendFrame(const char* data, size_t length);
+    bool sendFrame(const std::string& payload) { return sendFrame(payload.data(), payload.size()); }
+
+    /**
+     * @brief Queues a frame without sending it. It leaves with the next
+     * sendFrame()/flush(), or before the next read that has to block.
+     */
+    bool queueFrame(const char* data, size_t length);
+    bool queueFrame(const std::string& payload) { return queueFrame(payload.data(), payload.size()); }
+
+    /**
+     * @brief Sends any queued frames.
+     */
+    bool flush();
+
+    /**
+     * @brief Sends buffer.size() payload bytes as one frame without copying:
+     * the payload is ciphered in place and the header goes in the headroom.
+     * Queued frames and an optional trailing control frame go out in the
+     * same gathered write. The buffer's contents are consumed (left ciphered).
+     *
+     * With zero-copy enabled and a payload of at least the threshold, the
+     * connection keeps a reference to the block until the kernel is done
+     * with it: callers must acquire a fresh Buffer for the next frame.
+     */
+    bool sendFrame(Buffer& buffer, const std::string* trailer = nullptr);
+
+    /**
+     * @brief Turns on MSG_ZEROCOPY for Buffer frames of at least threshold
+     * payload bytes. False (and no change) where unsupported.
+     */
+    bool enableZeroCopy(size_t threshold);
+
+    /**
+     * @brief Switches the stream to TLS 1.3 records under the given keys,
+     * encrypted by the kernel where kTLS is available and in user space
+     * otherwise. Queued frames are flushed first, under the old cipher.
+     * False if input past the switch is already buffered or the keys
+     * cannot be installed; the connection is then unusable.
+     */
+    bool startSecure(const TrafficKeys& tx, const TrafficKeys& rx);
+
+    bool isSecure() const { return secure_; }
+    bool kernelTx() const { return kernelTx_; }
+    bool kernelRx() const { return kernelRx_; }
+
+    /**
+     * @brief True if sendFileFrame() can be used: the kernel encrypts the
+     * stream, so file pages can go out untouched.
+     */
+    bool canSendFile() const { return kernelTx_; }
+
+    /**
+     * @brief Sends length bytes of file from offset as one frame with
+     * sendfile(), after any queued frames and followed by an optional
+     * trailing control frame. False if canSendFile() is not set.
+     */
+    bool sendFileFrame(const FileSource& file, uint64_t offset, size_t length, const std::string* trailer = nullptr);
+
+    uint64_t zeroCopyFrames() const { return zeroCopyFrames_; }
+    uint64_t zeroCopyCopied() const { return zeroCopyCopied_; }   // Completions the kernel had to copy anyway
+
+    /**
+     * @brief Receives one frame into payload. False on close, error or a
+     * frame larger than MAX_FRAME_SIZE.
+     */
+    bool recvFrame(std::string& payload);
+
+    /**
+     * @brief Receives one frame directly into a pooled buffer. False also
+     * if the frame does not fit in Buffer::capacity().
+     */
+    bool recvFrame(Buffer& buffer);
+
+    /**
+     * @brief True if received bytes are waiting to be parsed.
+     */
+    bool hasBufferedInput() const { return recvEnd_ > recvStart_ || recordEnd_ > recordStart_; }
+
+    SocketType socket() const { return sock_; }
+    void close();
+
+    uint64_t bytesSent() const { return bytesSent_; }
+    uint64_t bytesReceived() const { return bytesReceived_; }
+
+private:
+    void appendFrame(std::string& out, const char* data, size_t length);
+    bool writeOut(IoSlice* slices, size_t count);
+    bool fill(size_t minBytes);
+    bool readRecord();
+    bool readPayload(char* out, size_t length);
+    bool sendZeroCopy(Buffer& buffer, const char* frame, size_t length);
+    void reapZeroCopy(int timeoutMs);
+
+    SocketType sock_;
+    std::string key_;
+    std::string sendBuffer_;                // Queued, already ciphered frames
+    std::string trailerBuffer_;
+    std::vector<char> recvBuffer_;
+    size_t recvStart_ = 0;
+    size_t recvEnd_ = 0;
+    size_t zeroCopyThreshold_ = 0;           // 0 = disabled
+    uint32_t zeroCopyNextId_ = 0;            // Kernel numbers each MSG_ZEROCOPY send call
+    std::deque<std::pair<uint32_t, Buffer>> zeroCopyPending_;  // Last send id using each block
+    uint64_t zeroCopyFrames_ = 0;
+    uint64_t zeroCopyCopied_ = 0;
+    bool secure_ = false;
+    bool kernelTx_ = false;
+    bool kernelRx_ = false;
+    std::unique_ptr<RecordCipher> sealer_;   // User-space record encryption, if the kernel does not
+    std::unique_ptr<RecordCipher> opener_;
+    std::string sealed_;                     // Records about to be written
+    std::vector<char> recordBuffer_;         // Received records not yet decrypted
+    size_t recordStart_ = 0;
+    size_t recordEnd_ = 0;
+    uint64_t bytesSent_ = 0;
+    uint64_t bytesReceived_ = 0;
+};
+
+/**
+ * @brief Client side of STARTTLS: sends this side's key share, waits for
+ * the server's, and switches the connection to encrypted records. False
+ * if the server declined (the session continues unencrypted) or failed.
+ */
+bool requestSecureTransport(Connection& conn, std::string_view psk);
+
+#endif // FILESHARE_TRANSPORT_H
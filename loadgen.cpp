@@ -0,0 +1,474 @@
+/*
+ * C++ File Sharing Load Generator
+ *
+ * Opens many concurrent authenticated sessions against a running server
+ * and drives a weighted mix of LIST, DOWNLOAD and UPLOAD requests for a
+ * fixed duration. Reports throughput, p50/p99/p999 latency per operation
+ * and error counts, and can save or compare against a baseline file so
+ * performance regressions are caught by `make bench`.
+ *
+ * Supports Windows (Winsock) and POSIX (Linux/macOS) sockets.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <cctype>
+
+#include <memory>
+
+#include "libfileshare/buffer_pool.h"
+#include "libfileshare/flow_control.h"
+#include "libfileshare/platform.h"
+#include "libfileshare/protocol.h"
+#include "libfileshare/socket_tuning.h"
+#include "libfileshare/transport.h"
+
+// --- Configuration ---
+const size_t BUFFER_SIZE = BUFFER_CAPACITY;   // Bytes per upload chunk
+const int RECV_TIMEOUT_SEC = 10; // A stalled session counts as an error, not a hang
+// --- End Configuration ---
+
+enum OpKind { OP_LIST = 0, OP_DOWNLOAD, OP_UPLOAD, OP_KIND_COUNT };
+const char* OP_NAMES[OP_KIND_COUNT] = {"list", "download", "upload"};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 9999;
+    std::string user = "user";
+    std::string pass = "pass123";
+    int sessions = 64;
+    int durationSec = 10;
+    int mix[OP_KIND_COUNT] = {50, 40, 10};     // Relative weights
+    std::vector<long long> sizes = {4096, 65536, 1048576};
+    uint64_t window = DEFAULT_TRANSFER_WINDOW;   // DOWNLOAD credit window
+    const TuningProfile* profile = findTuningProfile("default");
+    bool tls = false;                            // STARTTLS after AUTH
+    bool resume = false;                         // Sessions RESUME with the setup session's ticket
+    std::string ticket;                          // ... which AUTH_SUCCESS handed it
+    std::string saveBaseline;
+    std::string compareBaseline;
+    double tolerancePct = 10.0;
+};
+
+/**
+ * @brief Per-session results, merged once all sessions finish.
+ */
+struct SessionResult {
+    std::vector<uint32_t> latencyUs[OP_KIND_COUNT];
+    uint64_t errors[OP_KIND_COUNT] = {0, 0, 0};
+    uint64_t bytes = 0;
+    uint64_t connectFailures = 0;
+    uint64_t busyRejections = 0;
+    uint64_t drainResumes = 0;     // Sessions resumed elsewhere after a draining server's BUSY
+};
+
+bool sendCommand(Connection& conn, const std::string& cmd) {
+    return conn.sendFrame(cmd);
+}
+
+std::string receiveResponse(Connection& conn) {
+    std::string payload;
+    if (!conn.recvFrame(payload)) {
+        return ""; // Connection closed, timeout or error
+    }
+    return payload;
+}
+
+/**
+ * @brief Connects and authenticates one session, with RESUME if opts has
+ * a ticket and --resume (or forceResume) was given, else with AUTH (storing
+ * the ticket it returns in *ticket, if given). Returns null on failure;
+ * retryAfterSec is set if the server shed the connection as BUSY, else -1.
+ */
+std::unique_ptr<Connection> openSession(const Options& opts, int& retryAfterSec, std::string* ticket = nullptr,
+                                        bool forceResume = false) {
+    retryAfterSec = -1;
+    SocketType sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == INVALID_SOCKET_HANDLE) return nullptr;
+    auto conn = std::make_unique<Connection>(sock);
+    setReceiveTimeout(sock, RECV_TIMEOUT_SEC);
+
+    sockaddr_in serverAddr;
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(opts.port);
+    inet_pton(AF_INET, opts.host.c_str(), &serverAddr.sin_addr);
+    if (connect(sock, (sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
+        return nullptr;
+    }
+    applyTuningProfile(sock, *opts.profile);
+    bool resume = (opts.resume || forceResume) && !opts.ticket.empty();
+    if (!sendCommand(*conn, resume ? "RESUME " + opts.ticket : "AUTH " + opts.user + " " + opts.pass)) {
+        return nullptr;
+    }
+    std::string response = receiveResponse(*conn);
+    CommandView reply = tokenizeCommand(response);
+    if (reply.verbText != (resume ? "RESUMED" : "AUTH_SUCCESS")) {
+        parseBusyReply(response, retryAfterSec);
+        return nullptr;
+    }
+    if (ticket) *ticket = std::string(reply.arg(0));
+    if (opts.tls && !requestSecureTransport(*conn, DEFAULT_ENCRYPTION_KEY)) {
+        return nullptr;
+    }
+    return conn;
+}
+
+std::string seedFileName(long long size) {
+    return "loadgen_" + std::to_string(size) + ".bin";
+}
+
+// Outcome of one operation. Drained: the server answered the command with
+// BUSY because it is draining, and ended the session without running it.
+enum class OpResult { Ok, Failed, Drained };
+
+OpResult failedUnlessBusy(const std::string& response) {
+    int retryAfterSec = 0;
+    return parseBusyReply(response, retryAfterSec) ? OpResult::Drained : OpResult::Failed;
+}
+
+OpResult doList(Connection& conn, uint64_t& bytes) {
+    if (!sendCommand(conn, "LIST")) return OpResult::Failed;
+    std::string response = receiveResponse(conn);
+    bytes += response.size();
+    return response.rfind("Files on server:", 0) == 0 ? OpResult::Ok : failedUnlessBusy(response);
+}
+
+OpResult doDownload(Connection& conn, const std::string& filename, uint64_t window, uint64_t& bytes) {
+    if (!sendCommand(conn, "DOWNLOAD " + filename + " " + std::to_string(window))) return OpResult::Failed;
+    std::string response = receiveResponse(conn);
+    CommandView reply = tokenizeCommand(response);
+    long long fileSize = 0;
+    if (reply.verbText != "OK_DOWNLOAD" || !parseNumber(reply.arg(0), fileSize)) return failedUnlessBusy(response);
+
+    long long received = 0;
+    ReceiveWindow receiveWindow(window, fileSize);
+    Buffer chunk = Buffer::acquire();
+    while (received < fileSize) {
+        if (!conn.recvFrame(chunk)) return OpResult::Failed;
+        received += chunk.size();
+        uint64_t grant = receiveWindow.consume(chunk.size());
+        if (grant > 0 && !sendCredit(conn, grant)) return OpResult::Failed;
+    }
+    bytes += fileSize;
+    return receiveResponse(conn) == "DOWNLOAD_DONE" ? OpResult::Ok : OpResult::Failed;
+}
+
+OpResult doUpload(Connection& conn, const std::string& filename, const std::string& payload, uint64_t& bytes) {
+    if (!sendCommand(conn, "UPLOAD " + filename + " " + std::to_string(payload.size()))) return OpResult::Failed;
+    std::string response = receiveResponse(conn);
+    CommandView reply = tokenizeCommand(response);
+    uint64_t window = 0;
+    if (reply.verbText != "OK_UPLOAD" || !parseNumber(reply.arg(0), window) || window == 0) {
+        return failedUnlessBusy(response);
+    }
+
+    SendCredit credit(window);
+    size_t offset = 0;
+    while (offset < payload.size()) {
+        uint64_t allowed = credit.allowance(BUFFER_SIZE, payload.size() - offset);
+        if (allowed == 0) {
+            if (!receiveCredit(conn, response, credit)) return OpResult::Failed;
+            continue;
+        }
+        if (!conn.sendFrame(payload.data() + offset, allowed)) return OpResult::Failed;
+        credit.consume(allowed);
+        offset += allowed;
+    }
+    bytes += payload.size();
+    return receiveResponse(conn) == "UPLOAD_SUCCESS" ? OpResult::Ok : OpResult::Failed;
+}
+
+/**
+ * @brief Drives one session until the deadline, reconnecting after errors.
+ * An operation a draining server turned away is not an error: the session
+ * resumes with the ticket on a new connection and runs it again.
+ */
+void runSession(const Options& opts, int sessionId, const std::vector<std::string>& payloads,
+                std::chrono::steady_clock::time_point deadline, SessionResult& result) {
+    std::mt19937 rng(sessionId * 7919 + 1);
+    std::discrete_distribution<int> pickOp(std::begin(opts.mix), std::end(opts.mix));
+    std::uniform_int_distribution<size_t> pickSize(0, opts.sizes.size() - 1);
+
+    std::unique_ptr<Connection> conn;
+    bool drained = false;      // Resume the next session and repeat the operation
+    int op = 0;
+    size_t sizeIndex = 0;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (!conn) {
+            int retryAfterSec = 0;
+            conn = openSession(opts, retryAfterSec, nullptr, drained);
+            if (!conn) {
+                if (retryAfterSec >= 0) {   // 0 from a draining server: retry at once
+                    result.busyRejections++;
+                    std::this_thread::sleep_for(std::chrono::seconds(retryAfterSec));
+                } else {
+                    result.connectFailures++;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                }
+                continue;
+            }
+        }
+
+        if (!drained) {
+            op = pickOp(rng);
+            sizeIndex = pickSize(rng);
+        }
+        drained = false;
+        auto start = std::chrono::steady_clock::now();
+        OpResult outcome = OpResult::Failed;
+        switch (op) {
+            case OP_LIST:
+                outcome = doList(*conn, result.bytes);
+                break;
+            case OP_DOWNLOAD:
+                outcome = doDownload(*conn, seedFileName(opts.sizes[sizeIndex]), opts.window, result.bytes);
+                break;
+            case OP_UPLOAD:
+                outcome = doUpload(*conn, "loadgen_up_" + std::to_string(sessionId) + ".bin",
+                                   payloads[sizeIndex], result.bytes);
+                break;
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+        if (outcome == OpResult::Ok) {
+            result.latencyUs[op].push_back(static_cast<uint32_t>(us));
+        } else if (outcome == OpResult::Drained) {
+            result.drainResumes++;
+            drained = true;
+            conn.reset();
+        } else {
+            // The stream is in an unknown state after a failure; start over.
+            result.errors[op]++;
+            conn.reset();
+        }
+    }
+
+    if (conn) {
+        sendCommand(*conn, "QUIT");
+    }
+}
+
+uint64_t percentile(const std::vector<uint32_t>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t index = static_cast<size_t>(q * sorted.size());
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+/**
+ * @brief Parses "4K,64K,1M" into byte counts.
+ */
+std::vector<long long> parseSizes(const std::string& text) {
+    std::vector<long long> sizes;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item.empty()) continue;
+        long long multiplier = 1;
+        char suffix = static_cast<char>(std::toupper(item.back()));
+        if (suffix == 'K') multiplier = 1024;
+        if (suffix == 'M') multiplier = 1024 * 1024;
+        if (suffix == 'G') multiplier = 1024LL * 1024 * 1024;
+        if (multiplier != 1) item.pop_back();
+        sizes.push_back(std::stoll(item) * multiplier);
+    }
+    return sizes;
+}
+
+std::map<std::string, double> loadBaseline(const std::string& path) {
+    std::map<std::string, double> values;
+    std::ifstream in(path);
+    std::string key;
+    double value;
+    while (in >> key >> value) values[key] = value;
+    return values;
+}
+
+void printUsage() {
+    std::cout <<
+        "Usage: loadgen [options]\n"
+        "  --host ADDR            Server address (default 127.0.0.1)\n"
+        "  --port N               Server port (default 9999)\n"
+        "  --user NAME --pass PW  Credentials (default user/pass123)\n"
+        "  --sessions N           Concurrent sessions (default 64)\n"
+        "  --duration SEC         Measurement time (default 10)\n"
+        "  --mix L:D:U            Weights for list/download/upload (default 50:40:10)\n"
+        "  --sizes LIST           File sizes, e.g. 4K,64K,1M (default)\n"
+        "  --window BYTES         DOWNLOAD flow-control window (default 1 MiB)\n"
+        "  --profile NAME         Socket tuning: none, default, latency or bulk\n"
+        "  --tls                  Encrypt sessions with STARTTLS (kTLS where available)\n"
+        "  --resume               Start sessions with RESUME and a ticket instead of AUTH\n"
+        "  --save-baseline FILE   Write results as a baseline\n"
+        "  --baseline FILE        Compare against a baseline; exit 2 on regression\n"
+        "  --tolerance PCT        Allowed regression before failing (default 10)\n";
+}
+
+bool parseArgs(int argc, char** argv, Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&]() -> std::string { return i + 1 < argc ? argv[++i] : ""; };
+        if (arg == "--host") opts.host = next();
+        else if (arg == "--port") opts.port = std::stoi(next());
+        else if (arg == "--user") opts.user = next();
+        else if (arg == "--pass") opts.pass = next();
+        else if (arg == "--sessions") opts.sessions = std::stoi(next());
+        else if (arg == "--duration") opts.durationSec = std::stoi(next());
+        else if (arg == "--sizes") opts.sizes = parseSizes(next());
+        else if (arg == "--window") opts.window = std::stoull(next());
+        else if (arg == "--profile") {
+            opts.profile = findTuningProfile(next());
+            if (!opts.profile) {
+                std::cerr << "[-] Unknown --profile" << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--tls") opts.tls = true;
+        else if (arg == "--resume") opts.resume = true;
+        else if (arg == "--save-baseline") opts.saveBaseline = next();
+        else if (arg == "--baseline") opts.compareBaseline = next();
+        else if (arg == "--tolerance") opts.tolerancePct = std::stod(next());
+        else if (arg == "--mix") {
+            if (std::sscanf(next().c_str(), "%d:%d:%d", &opts.mix[0], &opts.mix[1], &opts.mix[2]) != 3) {
+                std::cerr << "[-] --mix expects L:D:U" << std::endl;
+                return false;
+            }
+        } else {
+            printUsage();
+            return false;
+        }
+    }
+    if (opts.sessions <= 0 || opts.durationSec <= 0 || opts.sizes.empty() || opts.window == 0) {
+        std::cerr << "[-] sessions, duration, sizes and window must be positive." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parseArgs(argc, argv, opts)) return 1;
+    if (initialize_networking() != 0) {
+        std::cerr << "WSAStartup failed." << std::endl;
+        return 1;
+    }
+
+    // Synthetic payloads, one per configured size.
+    std::vector<std::string> payloads;
+    std::mt19937 rng(42);
+    for (long long size : opts.sizes) {
+        std::string payload(size, '\0');
+        for (auto& c : payload) c = static_cast<char>(rng());
+        payloads.push_back(std::move(payload));
+    }
+
+    // Seed the server with the files DOWNLOAD requests will fetch.
+    int retryAfterSec = 0;
+    std::unique_ptr<Connection> setup = openSession(opts, retryAfterSec, &opts.ticket);
+    if (!setup) {
+        std::cerr << "[-] Could not connect/authenticate to " << opts.host << ":" << opts.port << std::endl;
+        cleanup_networking();
+        return 1;
+    }
+    for (size_t i = 0; i < opts.sizes.size(); ++i) {
+        uint64_t ignored = 0;
+        if (doUpload(*setup, seedFileName(opts.sizes[i]), payloads[i], ignored) != OpResult::Ok) {
+            std::cerr << "[-] Failed to seed " << seedFileName(opts.sizes[i]) << std::endl;
+            setup.reset();
+            cleanup_networking();
+            return 1;
+        }
+    }
+    sendCommand(*setup, "QUIT");
+    setup.reset();
+
+    std::cout << "[+] Running " << opts.sessions << " sessions for " << opts.durationSec
+              << "s (mix list:download:upload = " << opts.mix[0] << ":" << opts.mix[1] << ":" << opts.mix[2]
+              << ")" << std::endl;
+
+    std::vector<SessionResult> results(opts.sessions);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::seconds(opts.durationSec);
+    for (int i = 0; i < opts.sessions; ++i) {
+        threads.emplace_back(runSession, std::cref(opts), i, std::cref(payloads), deadline, std::ref(results[i]));
+    }
+    for (auto& t : threads) t.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // --- Report ---
+    std::map<std::string, double> report;
+    uint64_t totalOps = 0, totalErrors = 0, totalBytes = 0, connectFailures = 0, busyRejections = 0;
+    uint64_t drainResumes = 0;
+    std::printf("\n%-10s %10s %8s %10s %10s %10s\n", "op", "count", "errors", "p50(us)", "p99(us)", "p999(us)");
+    for (int op = 0; op < OP_KIND_COUNT; ++op) {
+        std::vector<uint32_t> merged;
+        uint64_t errors = 0;
+        for (const auto& r : results) {
+            merged.insert(merged.end(), r.latencyUs[op].begin(), r.latencyUs[op].end());
+            errors += r.errors[op];
+        }
+        std::sort(merged.begin(), merged.end());
+        uint64_t p50 = percentile(merged, 0.5), p99 = percentile(merged, 0.99), p999 = percentile(merged, 0.999);
+        std::printf("%-10s %10zu %8llu %10llu %10llu %10llu\n", OP_NAMES[op], merged.size(),
+                    (unsigned long long)errors, (unsigned long long)p50, (unsigned long long)p99,
+                    (unsigned long long)p999);
+        totalOps += merged.size();
+        totalErrors += errors;
+        if (!merged.empty()) {
+            report[std::string(OP_NAMES[op]) + "_p50_us"] = p50;
+            report[std::string(OP_NAMES[op]) + "_p99_us"] = p99;
+        }
+    }
+    for (const auto& r : results) {
+        totalBytes += r.bytes;
+        connectFailures += r.connectFailures;
+        busyRejections += r.busyRejections;
+        drainResumes += r.drainResumes;
+    }
+    report["ops_per_sec"] = totalOps / elapsed;
+    report["mib_per_sec"] = totalBytes / elapsed / (1024.0 * 1024.0);
+    report["error_rate"] = totalOps + totalErrors ? double(totalErrors) / (totalOps + totalErrors) : 0.0;
+
+    std::printf("\nthroughput: %.1f ops/s, %.2f MiB/s, errors: %llu, connect failures: %llu, busy: %llu, "
+                "resumed after drain: %llu\n",
+                report["ops_per_sec"], report["mib_per_sec"], (unsigned long long)totalErrors,
+                (unsigned long long)connectFailures, (unsigned long long)busyRejections,
+                (unsigned long long)drainResumes);
+
+    int status = 0;
+    if (!opts.saveBaseline.empty()) {
+        std::ofstream out(opts.saveBaseline);
+        for (const auto& kv : report) out << kv.first << " " << kv.second << "\n";
+        std::cout << "[+] Baseline saved to " << opts.saveBaseline << std::endl;
+    }
+    if (!opts.compareBaseline.empty()) {
+        auto baseline = loadBaseline(opts.compareBaseline);
+        double tolerance = opts.tolerancePct / 100.0;
+        std::cout << "\nComparison against " << opts.compareBaseline << ":" << std::endl;
+        for (const auto& kv : baseline) {
+            if (!report.count(kv.first)) continue;
+            double current = report[kv.first];
+            // Throughput must not drop; latency and error rate must not rise.
+            bool higherIsBetter = kv.first == "ops_per_sec" || kv.first == "mib_per_sec";
+            bool regressed = higherIsBetter ? current < kv.second * (1.0 - tolerance)
+                                            : current > kv.second * (1.0 + tolerance) + (kv.first == "error_rate" ? 0.001 : 0.0);
+            std::printf("  %-18s baseline %12.2f  current %12.2f  %s\n", kv.first.c_str(), kv.second, current,
+                        regressed ? "REGRESSION" : "ok");
+            if (regressed) status = 2;
+        }
+    }
+
+    cleanup_networking();
+    return status;
+}
@@ -0,0 +1,360 @@
+/*
+ * Microbenchmarks for the file sharing protocol primitives.
+ *
+ * Each hot-path building block is measured in isolation so individual
+ * optimizations can be evaluated without an end-to-end run:
+ *  - the XOR cipher (encryptDecrypt)
+ *  - command parsing as done for every incoming message (and the
+ *    original stringstream tokenizer for reference)
+ *  - per-chunk buffer handling on the DOWNLOAD path
+ *  - LIST generation over synthetic directories, whole and one page
+ *  - chunked file reads and writes
+ *  - a framed send/receive round trip over a local socket pair, one
+ *    frame at a time and as a pipelined batch
+ *  - large frame sends over TCP, copying vs MSG_ZEROCOPY
+ *
+ * Built against libfileshare, the server code (compiled with
+ * FILESHARE_NO_MAIN) and Google Benchmark. Run with `make microbench`.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <sstream>
+#include <cstring>
+#include <thread>
+
+#include "libfileshare/buffer_pool.h"
+#include "libfileshare/checksum.h"
+#include "libfileshare/cipher.h"
+#include "libfileshare/file_catalog.h"
+#include "libfileshare/metrics.h"
+#include "libfileshare/protocol.h"
+#include "libfileshare/transport.h"
+
+const size_t BUFFER_SIZE = BUFFER_CAPACITY; // Chunk size used by server.cpp
+
+// Server-only code, linked from server.cpp built with FILESHARE_NO_MAIN.
+std::string buildFileList(std::string_view after, size_t limit);
+FileCatalog& fileCatalog();
+bool isServedName(std::string_view name);
+extern ShardedCounter heapAllocations; // Counts every operator new
+
+/**
+ * @brief Reports heap allocations per iteration as a benchmark counter.
+ */
+struct AllocationCounter {
+    benchmark::State& state;
+    uint64_t start;
+
+    explicit AllocationCounter(benchmark::State& state) : state(state), start(heapAllocations.value()) {}
+    ~AllocationCounter() {
+        state.counters["allocs_per_iter"] = benchmark::Counter(
+            double(heapAllocations.value() - start), benchmark::Counter::kAvgIterations);
+    }
+};
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief Scratch directory under the system temp dir, removed on destruction.
+ */
+struct ScratchDir {
+    fs::path path;
+
+    explicit ScratchDir(const std::string& name) : path(fs::temp_directory_path() / name) {
+        fs::remove_all(path);
+        fs::create_directories(path);
+    }
+    ~ScratchDir() {
+        std::error_code ec;
+        fs::remove_all(path, ec);
+    }
+};
+
+static void BM_EncryptDecrypt(benchmark::State& state) {
+    std::string data(state.range(0), 'x');
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(encryptDecrypt(data));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EncryptDecrypt)->Arg(64)->Arg(4096)->Arg(65536);
+
+// Per-chunk checksum plus folding it into the file CRC, as DOWNLOAD does.
+static void BM_ChunkChecksum(benchmark::State& state) {
+    std::string data(state.range(0), 'x');
+    uint32_t fileCrc = 0;
+    for (auto _ : state) {
+        uint32_t crc = crc32c(0, data.data(), data.size());
+        fileCrc = crc32cCombine(fileCrc, crc, data.size());
+        benchmark::DoNotOptimize(fileCrc);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ChunkChecksum)->Arg(4096)->Arg(65536);
+
+const std::vector<std::string> SAMPLE_COMMANDS = {
+    "LIST",
+    "DOWNLOAD some_reasonably_named_file.bin",
+    "UPLOAD upload_target.tar.gz 1073741824",
+    "AUTH user pass123",
+};
+
+// Reference: the original std::stringstream tokenizer and string compares.
+static void BM_ParseCommandStringstream(benchmark::State& state) {
+    size_t i = 0;
+    AllocationCounter allocs(state);
+    for (auto _ : state) {
+        std::stringstream ss(SAMPLE_COMMANDS[i++ & 3]);
+        std::string verb, token;
+        std::vector<std::string> args;
+        ss >> verb;
+        while (ss >> token) args.push_back(token);
+        long long size = 0;
+        if (verb == "UPLOAD") size = std::atoll(args[1].c_str());
+        benchmark::DoNotOptimize(size);
+        benchmark::DoNotOptimize(args.data());
+    }
+}
+BENCHMARK(BM_ParseCommandStringstream);
+
+static void BM_ParseCommand(benchmark::State& state) {
+    size_t i = 0;
+    AllocationCounter allocs(state);
+    for (auto _ : state) {
+        CommandView view = tokenizeCommand(SAMPLE_COMMANDS[i++ & 3]);
+        long long size = 0;
+        if (view.verb == Verb::Upload) parseNumber(view.arg(1), size);
+        benchmark::DoNotOptimize(size);
+        benchmark::DoNotOptimize(view);
+    }
+}
+BENCHMARK(BM_ParseCommand);
+
+static void BM_LookupVerb(benchmark::State& state) {
+    const std::string_view verbs[] = {"AUTH", "LIST", "DOWNLOAD", "UPLOAD", "STATS", "QUIT", "BOGUS", "ACK"};
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(lookupVerb(verbs[i++ & 7]));
+    }
+}
+BENCHMARK(BM_LookupVerb);
+
+// The original DOWNLOAD loop: copy a read buffer into a chunk, then cipher it.
+static void BM_DownloadChunkHandling(benchmark::State& state) {
+    std::vector<char> fileBuffer(state.range(0), 'y');
+    AllocationCounter allocs(state);
+    for (auto _ : state) {
+        std::string chunk(fileBuffer.data(), fileBuffer.size());
+        benchmark::DoNotOptimize(encryptDecrypt(chunk));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DownloadChunkHandling)->Arg(4096)->Arg(65536);
+
+// The pooled DOWNLOAD loop: fill a pooled buffer and cipher it in place.
+static void BM_PooledChunkHandling(benchmark::State& state) {
+    std::vector<char> fileBuffer(state.range(0), 'y');
+    AllocationCounter allocs(state);
+    for (auto _ : state) {
+        Buffer chunk = Buffer::acquire();
+        std::memcpy(chunk.data(), fileBuffer.data(), fileBuffer.size());
+        chunk.setSize(fileBuffer.size());
+        xorCipher(chunk.data(), chunk.size(), DEFAULT_ENCRYPTION_KEY);
+        benchmark::DoNotOptimize(chunk.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PooledChunkHandling)->Arg(4096)->Arg(65536);
+
+static void BM_ListGeneration(benchmark::State& state) {
+    ScratchDir dir("fileshare_bench_list");
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        std::ofstream((dir.path / ("file_" + std::to_string(i) + ".dat")).string()) << i;
+    }
+    fileCatalog().open(dir.path.string(), isServedName);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(buildFileList("", SIZE_MAX));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ListGeneration)->Arg(10)->Arg(1000)->Arg(10000);
+
+// One 100-name page from the middle: should not grow with the directory.
+static void BM_ListPage(benchmark::State& state) {
+    ScratchDir dir("fileshare_bench_list_page");
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        std::ofstream((dir.path / ("file_" + std::to_string(i) + ".dat")).string()) << i;
+    }
+    fileCatalog().open(dir.path.string(), isServedName);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(buildFileList("file_5", 100));
+    }
+    state.SetItemsProcessed(state.iterations() * 100);
+}
+BENCHMARK(BM_ListPage)->Arg(1000)->Arg(10000);
+
+static void BM_FileRead(benchmark::State& state) {
+    ScratchDir dir("fileshare_bench_read");
+    std::string filepath = (dir.path / "source.bin").string();
+    {
+        std::ofstream out(filepath, std::ios::binary);
+        std::string block(1 << 20, 'z');
+        for (int64_t written = 0; written < state.range(0); written += block.size()) out << block;
+    }
+    for (auto _ : state) {
+        std::ifstream file(filepath, std::ios::binary);
+        char fileBuffer[BUFFER_SIZE];
+        size_t total = 0;
+        while (file.read(fileBuffer, sizeof(fileBuffer)) || file.gcount() > 0) {
+            total += file.gcount();
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FileRead)->Arg(16 << 20)->Unit(benchmark::kMillisecond);
+
+static void BM_FileWrite(benchmark::State& state) {
+    ScratchDir dir("fileshare_bench_write");
+    std::string filepath = (dir.path / "target.bin").string();
+    std::string chunk(BUFFER_SIZE, 'w'); // Upload chunk size used by the client
+    for (auto _ : state) {
+        std::ofstream outFile(filepath, std::ios::binary);
+        for (int64_t written = 0; written < state.range(0); written += chunk.size()) {
+            outFile.write(chunk.c_str(), chunk.length());
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FileWrite)->Arg(16 << 20)->Unit(benchmark::kMillisecond);
+
+static void BM_SendReceive(benchmark::State& state) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        state.SkipWithError("socketpair failed");
+        return;
+    }
+    Connection sender(fds[0]), receiver(fds[1]);
+    std::string message(state.range(0), 'm');
+    std::string payload;
+    AllocationCounter allocs(state);
+    for (auto _ : state) {
+        sender.sendFrame(message);
+        receiver.recvFrame(payload);
+        benchmark::DoNotOptimize(payload);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SendReceive)->Arg(32)->Arg(2048);
+
+static void BM_SendReceivePooled(benchmark::State& state) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        state.SkipWithError("socketpair failed");
+        return;
+    }
+    Connection sender(fds[0]), receiver(fds[1]);
+    Buffer outgoing = Buffer::acquire();
+    Buffer incoming = Buffer::acquire();
+    AllocationCounter allocs(state);
+    for (auto _ : state) {
+        outgoing.setSize(state.range(0));
+        sender.sendFrame(outgoing);
+        receiver.recvFrame(incoming);
+        benchmark::DoNotOptimize(incoming.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SendReceivePooled)->Arg(2048)->Arg(65536);
+
+// Pipelined commands: a batch of small frames queued and flushed in one
+// write, then parsed out of buffered reads on the other side.
+static void BM_SendReceiveBatch(benchmark::State& state) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        state.SkipWithError("socketpair failed");
+        return;
+    }
+    Connection sender(fds[0]), receiver(fds[1]);
+    const std::string message = "DOWNLOAD some_reasonably_named_file.bin 1048576";
+    std::string payload;
+    for (auto _ : state) {
+        for (int64_t i = 0; i < state.range(0); ++i) sender.queueFrame(message);
+        sender.flush();
+        for (int64_t i = 0; i < state.range(0); ++i) receiver.recvFrame(payload);
+        benchmark::DoNotOptimize(payload);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SendReceiveBatch)->Arg(1)->Arg(16);
+
+/**
+ * @brief A connected TCP pair over loopback with a thread discarding all
+ * data on the receiving end.
+ */
+struct TcpSink {
+    SocketType sender = INVALID_SOCKET_HANDLE;
+    std::thread drain;
+
+    TcpSink() {
+        SocketType listener = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0 ||
+            getsockname(listener, (sockaddr*)&addr, &len) != 0) {
+            CLOSE_SOCKET(listener);
+            return;
+        }
+        sender = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(sender, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            CLOSE_SOCKET(sender);
+            sender = INVALID_SOCKET_HANDLE;
+        } else {
+            SocketType receiver = accept(listener, nullptr, nullptr);
+            drain = std::thread([receiver] {
+                std::vector<char> sink(1 << 20);
+                while (recv(receiver, sink.data(), sink.size(), 0) > 0) {}
+                CLOSE_SOCKET(receiver);
+            });
+        }
+        CLOSE_SOCKET(listener);
+    }
+    ~TcpSink() {
+        if (drain.joinable()) drain.join();
+    }
+};
+
+// Arg: 0 = copying send, 1 = MSG_ZEROCOPY. CPU time is the sending thread's.
+// On loopback the kernel still copies (see zerocopy_copied); the savings
+// only show on a real NIC.
+static void BM_SendLargeFrame(benchmark::State& state) {
+    TcpSink sink;
+    if (sink.sender == INVALID_SOCKET_HANDLE) {
+        state.SkipWithError("loopback TCP unavailable");
+        return;
+    }
+    {
+        Connection sender(sink.sender);
+        if (state.range(0) && !sender.enableZeroCopy(BUFFER_CAPACITY / 2)) {
+            state.SkipWithError("MSG_ZEROCOPY unsupported");
+            return;
+        }
+        for (auto _ : state) {
+            Buffer chunk = Buffer::acquire();
+            chunk.setSize(BUFFER_CAPACITY);
+            sender.sendFrame(chunk);
+        }
+        state.SetBytesProcessed(state.iterations() * BUFFER_CAPACITY);
+        state.counters["zerocopy_copied"] = benchmark::Counter(double(sender.zeroCopyCopied()));
+    } // Closing the sender ends the drain thread
+}
+BENCHMARK(BM_SendLargeFrame)->Arg(0)->Arg(1);
+
+BENCHMARK_MAIN();
@@ -16,294 +16,2751 @@
 #include <sstream>
 #include <cstring>
 #include <map>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cctype>
+#include <cinttypes>
+#include <cstdlib>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <unordered_set>
 #include <filesystem> // For directory creation
+#ifndef _WIN32
+    #include <signal.h>
+#else
+    #include <fcntl.h> // _setmode, for binary log output
+    #include <io.h>
+#endif
+
+#include "libfileshare/buffer_pool.h"
+#include "libfileshare/checksum.h"
+#include "libfileshare/config_file.h"
+#include "libfileshare/credential_store.h"
+#include "libfileshare/file_catalog.h"
+#include "libfileshare/file_index.h"
+#include "libfileshare/flow_control.h"
+#include "libfileshare/handoff.h"
+#include "libfileshare/merkle.h"
+#include "libfileshare/metrics.h"
+#include "libfileshare/path_lock.h"
+#include "libfileshare/platform.h"
+#include "libfileshare/protocol.h"
+#include "libfileshare/rate_limit.h"
+#include "libfileshare/scheduler.h"
+#include "libfileshare/secure_channel.h"
+#include "libfileshare/session_ticket.h"
+#include "libfileshare/socket_tuning.h"
+#include "libfileshare/timer_wheel.h"
+#include "libfileshare/transport.h"
+
+// --- Logging Types ---
+enum class LogLevel { Debug = 0, Info, Warn, Error };
+// Json: one structured object per line. Binary: fixed-layout records, see Logger::format
+enum class LogFormat { Text, Json, Binary };
+// --- End Logging Types ---
+
+// --- Configuration ---
+// Every tunable is a field of ServerConfig. The defaults below are
+// overridden by the config file (--config FILE, else CONFIG_FILE if it
+// exists) and those by command-line flags (--name VALUE); SIGHUP rereads
+// both and publishes a new snapshot (see Runtime Configuration). Settings
+// marked restart-only in SETTINGS keep their value until the next start.
+
+enum class IoBackend { Auto, Copy };  // Auto: sendfile() on kTLS sessions; Copy: always through buffers
+
+const char* CONFIG_FILE = "fileshare.conf";
+
+struct ServerConfig {
+    // Network and files
+    uint64_t port = 9999;
+    uint64_t metricsPort = 9100;              // Prometheus text endpoint (0 disables)
+    uint64_t listenBacklog = 128;
+    std::string filesDir = "server_files";
+    std::string encryptionKey = "mysecretkey";
+
+    // Shutdown and upgrades: SIGTERM drains; `server --takeover` replaces a running server
+    uint64_t drainTimeoutSec = 120;           // Longest in-flight transfers get to finish
+    uint64_t drainGraceSec = 10;              // Idle sessions get this long to send a command before being woken
+    std::string handoffSocket = "fileshare.handoff";  // Unix socket a successor takes the listeners from
+
+    // Transfers
+    uint64_t chunkSize = BUFFER_CAPACITY;     // Bytes per data frame, at most one pooled buffer
+    uint64_t uploadWindow = DEFAULT_TRANSFER_WINDOW;  // Bytes a client may have in flight
+    const TuningProfile* tuning = findTuningProfile("default");  // Socket options per connection
+    uint64_t zeroCopyThreshold = 0;           // MSG_ZEROCOPY for chunks this large (0 = off)
+    IoBackend ioBackend = IoBackend::Auto;
+    uint64_t maxRepairAttempts = 3;           // Resends of a chunk that failed its checksum
+    bool startTls = true;                     // Accept STARTTLS after AUTH (kTLS where the kernel has it)
+    std::string ticketKeyFile = "session_ticket.key"; // Signs RESUME tickets; give every shard the same file
+    uint64_t ticketLifetimeSec = 12 * 3600;   // How long after AUTH its ticket resumes sessions
+
+    // File index: digests of served files, kept in a sidecar in filesDir
+    uint64_t indexScanIntervalSec = 60;       // Between background passes over the directory
+    uint64_t indexScanRate = 64 * 1024 * 1024; // Bytes per second the scanner may read
+    uint64_t maxVersions = 5;                 // Versions kept per file, the current one included
+
+    // Admission control: beyond these limits clients get "BUSY retry-after N"
+    uint64_t maxConnections = 512;            // Sessions served at once
+    uint64_t maxConnectionsPerIp = 64;        // Served plus queued, per client address
+    uint64_t maxSessionsPerUser = 64;         // Authenticated sessions per user
+    uint64_t admissionQueueLimit = 128;       // Connections allowed to wait for a session slot
+    uint64_t admissionWaitMs = 2000;          // Longest a queued connection waits
+    uint64_t busyRetryAfterSec = 1;
+
+    // Deadlines: a session that makes no progress for this long is shut down
+    uint64_t idleTimeoutSec = 300;            // Waiting for the next command
+    uint64_t readTimeoutSec = 30;             // Waiting for upload data or an ACK
+    uint64_t writeTimeoutSec = 30;            // Waiting to send a reply or download data
+    uint64_t keepaliveIdleSec = 60;           // TCP keepalive: first probe after this much silence
+    uint64_t keepaliveIntervalSec = 10;
+    uint64_t keepaliveProbes = 3;
+
+    // Accounts: "<user>:scrypt:..." lines, as printed by `server --hash-password USER`
+    std::string credentialsFile = "credentials.txt";
+    uint64_t credentialsReloadSec = 5;        // How often the file is checked for changes
+    uint64_t authHashThreads = 2;             // Password hashes computed at once
+    uint64_t authHashQueue = 64;              // Hashes allowed to wait; beyond this AUTH is answered BUSY
+    uint64_t authCacheEntries = 4096;         // Successful logins remembered (see credential_store.h)
+
+    // Logging
+    LogLevel logLevel = LogLevel::Info;
+    LogFormat logFormat = LogFormat::Text;
+    uint64_t logRateLimit = 2000;             // Records per second per thread
+    uint64_t logRateBurst = 500;              // Records a thread may emit back-to-back
+
+    // Bandwidth shaping, in bytes per second (0 = unlimited). Only file data is
+    // shaped; command replies (LIST, STATS, ...) are never held back.
+    uint64_t globalRateLimit = 0;             // All transfers combined
+    uint64_t userRateLimit = 0;               // Per user, shared by all of their sessions
+    uint64_t connectionRateLimit = 0;         // Per session
+    uint64_t rateBurst = 4 * BUFFER_CAPACITY; // Bytes a bucket may release back-to-back
+    std::map<std::string, uint64_t, std::less<>> userRateOverrides;  // "user_rate.<user> = <rate>"
+
+    // Transfer scheduling: download chunks take turns in weighted round robin.
+    uint64_t sendSlots = 4;                   // Chunk sends in flight at once (0 = unscheduled)
+    std::map<std::string, uint64_t, std::less<>> userWeights;  // "user_weight.<user> = <n>"; default 1
+};
+
+// Hashed into credentialsFile when it does not exist yet; change them there
+const std::map<std::string, std::string, std::less<>> DEFAULT_USERS = {
+    {"user", "pass123"},
+    {"admin", "adminpass"}
+};
+
+const char* const USER_RATE_PREFIX = "user_rate.";
+const char* const USER_WEIGHT_PREFIX = "user_weight.";
+const char* const LOG_LEVEL_NAMES[] = {"debug", "info", "warn", "error"};
+
+template <typename T>
+bool parseSetting(std::string_view text, T& out) {
+    if constexpr (std::is_same_v<T, bool>) {
+        return parseBool(text, out);
+    } else if constexpr (std::is_same_v<T, std::string>) {
+        out = std::string(text);
+        return !out.empty();
+    } else {
+        return parseByteSize(text, out);
+    }
+}
+
+bool parseSetting(std::string_view text, LogLevel& out) {
+    for (int i = 0; i < 4; ++i) {
+        if (text == LOG_LEVEL_NAMES[i]) {
+            out = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseSetting(std::string_view text, LogFormat& out) {
+    if (text == "text") out = LogFormat::Text;
+    else if (text == "json") out = LogFormat::Json;
+    else if (text == "binary") out = LogFormat::Binary;
+    else return false;
+    return true;
+}
+
+bool parseSetting(std::string_view text, IoBackend& out) {
+    if (text != "auto" && text != "copy") return false;
+    out = text == "copy" ? IoBackend::Copy : IoBackend::Auto;
+    return true;
+}
+
+bool parseSetting(std::string_view text, const TuningProfile*& out) {
+    const TuningProfile* profile = findTuningProfile(text);
+    if (profile) out = profile;
+    return profile != nullptr;
+}
+
+template <typename T>
+std::string formatSetting(const T& value) {
+    if constexpr (std::is_same_v<T, bool>) {
+        return value ? "true" : "false";
+    } else if constexpr (std::is_same_v<T, std::string>) {
+        return value;
+    } else {
+        return std::to_string(value);
+    }
+}
+
+std::string formatSetting(LogLevel value) { return LOG_LEVEL_NAMES[static_cast<int>(value)]; }
+std::string formatSetting(LogFormat value) {
+    return value == LogFormat::Json ? "json" : value == LogFormat::Binary ? "binary" : "text";
+}
+std::string formatSetting(IoBackend value) { return value == IoBackend::Copy ? "copy" : "auto"; }
+std::string formatSetting(const TuningProfile* value) { return value->name; }
+
+/**
+ * @brief One named field of ServerConfig, as written in the config file
+ * and, as --name, on the command line.
+ */
+struct Setting {
+    const char* name;
+    bool reloadable;              // False: a new value waits for a restart
+    bool (*parse)(ServerConfig&, std::string_view);
+    std::string (*format)(const ServerConfig&);
+    void (*copy)(ServerConfig& to, const ServerConfig& from);
+};
+
+template <auto Field>
+Setting setting(const char* name, bool reloadable) {
+    return {name, reloadable,
+            [](ServerConfig& config, std::string_view text) { return parseSetting(text, config.*Field); },
+            [](const ServerConfig& config) { return formatSetting(config.*Field); },
+            [](ServerConfig& to, const ServerConfig& from) { to.*Field = from.*Field; }};
+}
+
+const Setting SETTINGS[] = {
+    setting<&ServerConfig::port>("port", false),
+    setting<&ServerConfig::metricsPort>("metrics_port", false),
+    setting<&ServerConfig::listenBacklog>("listen_backlog", false),
+    setting<&ServerConfig::filesDir>("files_dir", false),
+    setting<&ServerConfig::encryptionKey>("encryption_key", true),
+    setting<&ServerConfig::drainTimeoutSec>("drain_timeout_sec", true),
+    setting<&ServerConfig::drainGraceSec>("drain_grace_sec", true),
+    setting<&ServerConfig::handoffSocket>("handoff_socket", false),
+    setting<&ServerConfig::chunkSize>("chunk_size", true),
+    setting<&ServerConfig::uploadWindow>("upload_window", true),
+    setting<&ServerConfig::tuning>("tuning_profile", true),
+    setting<&ServerConfig::zeroCopyThreshold>("zerocopy_threshold", true),
+    setting<&ServerConfig::ioBackend>("io_backend", true),
+    setting<&ServerConfig::maxRepairAttempts>("max_repair_attempts", true),
+    setting<&ServerConfig::startTls>("starttls", true),
+    setting<&ServerConfig::ticketKeyFile>("ticket_key_file", false),
+    setting<&ServerConfig::ticketLifetimeSec>("ticket_lifetime_sec", true),
+    setting<&ServerConfig::indexScanIntervalSec>("index_scan_interval_sec", true),
+    setting<&ServerConfig::indexScanRate>("index_scan_rate", true),
+    setting<&ServerConfig::maxVersions>("max_versions", false),
+    setting<&ServerConfig::maxConnections>("max_connections", true),
+    setting<&ServerConfig::maxConnectionsPerIp>("max_connections_per_ip", true),
+    setting<&ServerConfig::maxSessionsPerUser>("max_sessions_per_user", true),
+    setting<&ServerConfig::admissionQueueLimit>("admission_queue_limit", true),
+    setting<&ServerConfig::admissionWaitMs>("admission_wait_ms", true),
+    setting<&ServerConfig::busyRetryAfterSec>("busy_retry_after_sec", true),
+    setting<&ServerConfig::idleTimeoutSec>("idle_timeout_sec", true),
+    setting<&ServerConfig::readTimeoutSec>("read_timeout_sec", true),
+    setting<&ServerConfig::writeTimeoutSec>("write_timeout_sec", true),
+    setting<&ServerConfig::keepaliveIdleSec>("keepalive_idle_sec", true),
+    setting<&ServerConfig::keepaliveIntervalSec>("keepalive_interval_sec", true),
+    setting<&ServerConfig::keepaliveProbes>("keepalive_probes", true),
+    setting<&ServerConfig::credentialsFile>("credentials_file", false),
+    setting<&ServerConfig::credentialsReloadSec>("credentials_reload_sec", true),
+    setting<&ServerConfig::authHashThreads>("auth_hash_threads", false),
+    setting<&ServerConfig::authHashQueue>("auth_hash_queue", false),
+    setting<&ServerConfig::authCacheEntries>("auth_cache_entries", false),
+    setting<&ServerConfig::logLevel>("log_level", true),
+    setting<&ServerConfig::logFormat>("log_format", true),
+    setting<&ServerConfig::logRateLimit>("log_rate_limit", true),
+    setting<&ServerConfig::logRateBurst>("log_rate_burst", true),
+    setting<&ServerConfig::globalRateLimit>("global_rate_limit", true),
+    setting<&ServerConfig::userRateLimit>("user_rate_limit", true),
+    setting<&ServerConfig::connectionRateLimit>("connection_rate_limit", true),
+    setting<&ServerConfig::rateBurst>("rate_burst", true),
+    setting<&ServerConfig::sendSlots>("send_slots", false),
+};
+
+/**
+ * @brief Sets the named setting, or a user_rate.<user> or user_weight.<user>
+ * entry. False if the name is unknown or the value does not parse.
+ */
+bool applySetting(ServerConfig& config, std::string_view name, std::string_view value) {
+    for (const char* prefix : {USER_RATE_PREFIX, USER_WEIGHT_PREFIX}) {
+        std::string_view p(prefix);
+        if (name.size() <= p.size() || name.substr(0, p.size()) != p) continue;
+        uint64_t number = 0;
+        if (!parseByteSize(value, number)) return false;
+        auto& map = prefix == USER_RATE_PREFIX ? config.userRateOverrides : config.userWeights;
+        map[std::string(name.substr(p.size()))] = number;
+        return true;
+    }
+    for (const Setting& entry : SETTINGS) {
+        if (name == entry.name) return entry.parse(config, value);
+    }
+    return false;
+}
+
+/**
+ * @brief Checks values that parse but cannot work.
+ */
+bool validateConfig(const ServerConfig& config, std::string& error) {
+    if (config.port == 0 || config.port > 65535 || config.metricsPort > 65535) error = "port out of range";
+    else if (config.chunkSize == 0 || config.chunkSize > BUFFER_CAPACITY)
+        error = "chunk_size must be 1.." + std::to_string(BUFFER_CAPACITY);
+    else if (config.uploadWindow == 0 || config.uploadWindow > MAX_TRANSFER_WINDOW)
+        error = "upload_window must be 1.." + std::to_string(MAX_TRANSFER_WINDOW);
+    else if (config.maxConnections == 0 || config.authHashThreads == 0 || config.maxVersions == 0)
+        error = "max_connections, auth_hash_threads and max_versions must be positive";
+    else if (config.idleTimeoutSec == 0 || config.readTimeoutSec == 0 || config.writeTimeoutSec == 0)
+        error = "timeouts must be positive";
+    else if (config.credentialsReloadSec == 0 || config.indexScanIntervalSec == 0)
+        error = "reload and scan intervals must be positive";
+    return error.empty();
+}
+
+// Readers work from a snapshot: each thread holds the configuration it last
+// picked up and only swaps it for the published one in refreshConfig(),
+// which threads call between units of work (a command, a scan pass, an
+// accepted connection). A transfer therefore finishes under the settings it
+// started with, and the old snapshot is freed when its last reader moves on.
+std::shared_ptr<const ServerConfig> publishedConfig = std::make_shared<const ServerConfig>();
+std::atomic<uint64_t> configGeneration{1};
+
+struct ThreadConfig {
+    std::shared_ptr<const ServerConfig> snapshot;
+    uint64_t generation = 0;
+};
+
+thread_local ThreadConfig threadConfig;
+
+/**
+ * @brief Picks up the published configuration if it changed since this
+ * thread last looked. Returns true if it did.
+ */
+bool refreshConfig() {
+    uint64_t generation = configGeneration.load(std::memory_order_acquire);
+    if (generation == threadConfig.generation) return false;
+    threadConfig.snapshot = std::atomic_load(&publishedConfig);
+    threadConfig.generation = generation;
+    return true;
+}
+
+/**
+ * @brief This thread's snapshot. References stay valid until the thread
+ * next calls refreshConfig().
+ */
+inline const ServerConfig& config() {
+    if (!threadConfig.snapshot) refreshConfig();
+    return *threadConfig.snapshot;
+}
+
+void publishConfig(std::shared_ptr<const ServerConfig> next) {
+    std::atomic_store(&publishedConfig, std::move(next));
+    configGeneration.fetch_add(1, std::memory_order_release);
+}
+// --- End Configuration ---
+
+// --- Asynchronous Logger ---
+// Every thread owns a single-producer/single-consumer ring of fixed-size
+// records. Producers never lock or allocate: a full ring (or an exhausted
+// rate limit) drops the record and bumps a counter instead of blocking.
+// One background writer drains all rings and writes them in batches.
+
+const size_t LOG_RING_CAPACITY = 1024;  // Power of two
+const size_t LOG_TEXT_SIZE = 240;
+
+struct LogRecord {
+    int64_t timestampNs;
+    LogLevel level;
+    uint16_t length;
+    char text[LOG_TEXT_SIZE];
+};
+
+class LogRing {
+public:
+    explicit LogRing(uint64_t threadId) : threadId(threadId) {}
+
+    /**
+     * @brief Producer side. Returns false (record dropped) if the ring is full.
+     */
+    bool push(LogLevel level, int64_t timestampNs, const char* text, size_t length) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == LOG_RING_CAPACITY) {
+            return false;
+        }
+        LogRecord& record = records_[tail & (LOG_RING_CAPACITY - 1)];
+        record.timestampNs = timestampNs;
+        record.level = level;
+        record.length = static_cast<uint16_t>(std::min(length, LOG_TEXT_SIZE));
+        std::memcpy(record.text, text, record.length);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Consumer side. Returns false if the ring is empty.
+     */
+    bool pop(LogRecord& out) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        out = records_[head & (LOG_RING_CAPACITY - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t depth() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    const uint64_t threadId;
+    std::atomic<bool> closed{false};       // Owning thread has exited
+    std::atomic<uint64_t> dropped{0};      // Ring full or rate limited
+
+private:
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    std::array<LogRecord, LOG_RING_CAPACITY> records_;
+};
+
+class Logger {
+public:
+    Logger() : writer_(&Logger::writerLoop, this) {}
 
+    ~Logger() { stop(); }
+
+    /**
+     * @brief Writes out everything queued so far and stops the writer.
+     */
+    void stop() {
+        running_.store(false);
+        if (writer_.joinable()) writer_.join();
+    }
+
+    std::shared_ptr<LogRing> registerThread() {
+        static std::atomic<uint64_t> nextThreadId{1};
+        auto ring = std::make_shared<LogRing>(nextThreadId.fetch_add(1));
+        std::lock_guard<std::mutex> lock(registryMutex_);
+        rings_.push_back(ring);
+        return ring;
+    }
+
+    /**
+     * @brief Total records waiting to be written, across all threads.
+     */
+    size_t queueDepth() {
+        std::lock_guard<std::mutex> lock(registryMutex_);
+        size_t total = 0;
+        for (const auto& ring : rings_) total += ring->depth();
+        return total;
+    }
+
+private:
+    void writerLoop() {
+        std::string batch;
+        auto idleSleep = std::chrono::microseconds(500);
+        while (true) {
+            refreshConfig();
+            bool stopping = !running_.load();
+            std::vector<std::shared_ptr<LogRing>> rings;
+            {
+                std::lock_guard<std::mutex> lock(registryMutex_);
+                rings = rings_;
+            }
+
+            uint64_t dropped = 0;
+            LogRecord record;
+            for (const auto& ring : rings) {
+                while (ring->pop(record)) {
+                    format(record, ring->threadId, batch);
+                }
+                dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+            }
+            if (dropped > 0) {
+                std::string note = std::to_string(dropped) + " log records dropped (queue full or rate limited)";
+                LogRecord summary{nowNs(), LogLevel::Warn, 0, {}};
+                summary.length = static_cast<uint16_t>(std::min(note.size(), LOG_TEXT_SIZE));
+                std::memcpy(summary.text, note.data(), summary.length);
+                format(summary, 0, batch);
+            }
+
+            if (!batch.empty()) {
+#ifdef _WIN32
+                if (config().logFormat == LogFormat::Binary) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+                std::fwrite(batch.data(), 1, batch.size(), stdout);
+                std::fflush(stdout);
+                batch.clear();
+                idleSleep = std::chrono::microseconds(500);
+            } else if (stopping) {
+                break;
+            } else {
+                std::this_thread::sleep_for(idleSleep);
+                idleSleep = std::min(idleSleep * 2, std::chrono::microseconds(20000));
+            }
+
+            // Forget rings whose threads have exited and been fully drained.
+            std::lock_guard<std::mutex> lock(registryMutex_);
+            rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const std::shared_ptr<LogRing>& ring) {
+                return ring->closed.load() && ring->depth() == 0;
+            }), rings_.end());
+        }
+    }
+
+    /**
+     * @brief Appends one record in the configured format. A binary record is
+     * little-endian: u64 timestamp (ns since epoch), u64 thread id, u8 level,
+     * u16 message length, then the message bytes. It needs no escaping and is
+     * meant for a collector, not a terminal.
+     */
+    static void format(const LogRecord& record, uint64_t threadId, std::string& out) {
+        const char* levelName = LOG_LEVEL_NAMES[static_cast<int>(record.level)];
+        if (config().logFormat == LogFormat::Binary) {
+            auto appendLe = [&out](uint64_t value, int bytes) {
+                for (int i = 0; i < bytes; ++i) out += static_cast<char>((value >> (8 * i)) & 0xFF);
+            };
+            appendLe(static_cast<uint64_t>(record.timestampNs), 8);
+            appendLe(threadId, 8);
+            appendLe(static_cast<uint64_t>(record.level), 1);
+            appendLe(record.length, 2);
+            out.append(record.text, record.length);
+        } else if (config().logFormat == LogFormat::Json) {
+            out += "{\"ts\":" + std::to_string(record.timestampNs) +
+                   ",\"level\":\"" + levelName +
+                   "\",\"thread\":" + std::to_string(threadId) + ",\"msg\":\"";
+            for (size_t i = 0; i < record.length; ++i) {
+                unsigned char c = static_cast<unsigned char>(record.text[i]);
+                if (c == '"' || c == '\\') {
+                    out += '\\';
+                    out += static_cast<char>(c);
+                } else if (c < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out += static_cast<char>(c);
+                }
+            }
+            out += "\"}\n";
+        } else {
+            out += "[SERVER] ";
+            if (record.level != LogLevel::Info) {
+                out += "[";
+                for (const char* p = levelName; *p; ++p) out += static_cast<char>(std::toupper(*p));
+                out += "] ";
+            }
+            out.append(record.text, record.length);
+            out += '\n';
+        }
+    }
+
+public:
+    static int64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    std::mutex registryMutex_;
+    std::vector<std::shared_ptr<LogRing>> rings_;
+    std::atomic<bool> running_{true};
+    std::thread writer_;
+};
+
+Logger& logger() {
+    static Logger instance;
+    return instance;
+}
+
+/**
+ * @brief Per-thread producer state: the thread's ring plus its rate limiter.
+ */
+struct ThreadLogState {
+    std::shared_ptr<LogRing> ring;
+    double tokens = static_cast<double>(config().logRateBurst);
+    int64_t lastRefillNs = 0;
+
+    ~ThreadLogState() {
+        if (ring) ring->closed.store(true);
+    }
+};
+
+thread_local ThreadLogState threadLog;
+
+/**
+ * @brief Returns true if messages at this level are written at all.
+ * Check this before building expensive messages.
+ */
+inline bool logEnabled(LogLevel level) {
+    return level >= config().logLevel;
+}
+
+/**
+ * @brief Queues a message for the background writer. Never blocks.
+ * Callers that build the message guard it with logEnabled() first, so a
+ * filtered record costs one comparison and no allocation.
+ */
+void logAt(LogLevel level, std::string_view message) {
+    if (!logEnabled(level)) return;
+    if (!threadLog.ring) {
+        threadLog.ring = logger().registerThread();
+    }
+
+    int64_t now = Logger::nowNs();
+    if (threadLog.lastRefillNs != 0) {
+        threadLog.tokens = std::min<double>(config().logRateBurst,
+            threadLog.tokens + (now - threadLog.lastRefillNs) * 1e-9 * config().logRateLimit);
+    }
+    threadLog.lastRefillNs = now;
+    if (threadLog.tokens < 1.0 && level < LogLevel::Error) {
+        threadLog.ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    threadLog.tokens -= 1.0;
+
+    if (!threadLog.ring->push(level, now, message.data(), message.size())) {
+        threadLog.ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Logs an informational message with a [SERVER] prefix.
+ */
+void log(std::string_view message) {
+    logAt(LogLevel::Info, message);
+}
+// --- End Asynchronous Logger ---
+
+// --- Atomic Uploads ---
+// An upload is written to a hidden temp file and renamed over the target
+// only once complete, so a DOWNLOAD running at the same time reads either
+// the old version or the new one, never a mix. Uploads to the same name
+// are serialized through a striped lock table; the second one is refused.
+// Publishing goes through the catalog (libfileshare/file_catalog.h), which
+// keeps the replaced contents as an older version.
+
+const char* const UPLOAD_TEMP_PREFIX = ".upload-";
+
+FileCatalog& fileCatalog() {
+    static FileCatalog* instance = new FileCatalog(config().maxVersions); // Never destroyed, like the index
+    return *instance;
+}
+
+PathLockTable& uploadLocks() {
+    static PathLockTable table;
+    return table;
+}
+
+/**
+ * @brief An upload's temp file in the served directory, removed on
+ * destruction unless it was published.
+ */
+class PendingUpload {
+public:
+    explicit PendingUpload(const std::string& directory) {
+        static std::atomic<uint64_t> nextId{0};
+        path_ = directory + "/" + UPLOAD_TEMP_PREFIX + std::to_string(nextId.fetch_add(1)) + "-" +
+                std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    }
+    ~PendingUpload() {
+        std::error_code ec;
+        if (!published_) std::filesystem::remove(path_, ec);
+    }
+
+    PendingUpload(const PendingUpload&) = delete;
+    PendingUpload& operator=(const PendingUpload&) = delete;
+
+    const std::string& path() const { return path_; }
+
+    /**
+     * @brief Renames the temp file over name, replacing it atomically.
+     * @return The version it became, or 0 on failure.
+     */
+    uint64_t publish(const std::string& name) {
+        uint64_t version = fileCatalog().publish(name, path_);
+        published_ = version > 0;
+        return version;
+    }
+
+    /**
+     * @brief Makes a kept version of name current again, through the temp
+     * path, without copying its data.
+     * @return The version it became, or 0 on failure.
+     */
+    uint64_t restore(const std::string& name, uint64_t version) {
+        uint64_t restored = fileCatalog().restore(name, version, path_);
+        published_ = restored > 0;
+        return restored;
+    }
+
+private:
+    std::string path_;
+    bool published_ = false;
+};
+
+/**
+ * @brief Deletes temp files left behind by uploads interrupted by a crash.
+ */
+void removeStaleUploads(const std::string& directory) {
+    std::error_code ec;
+    size_t removed = 0;
+    for (std::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().filename().string().rfind(UPLOAD_TEMP_PREFIX, 0) != 0) continue;
+        std::error_code removeError;
+        if (std::filesystem::remove(it->path(), removeError)) ++removed;
+    }
+    if (removed > 0) log("Removed " + std::to_string(removed) + " unfinished upload(s).");
+}
+// --- End Atomic Uploads ---
+
+// --- File Index ---
+// Digests of served files (libfileshare/file_index.h). UPLOAD stores the
+// digest of what it wrote; a low-priority scanner picks up files that
+// arrived by other means and drops entries for removed ones.
+
+FileIndex& fileIndex() {
+    static FileIndex* instance = new FileIndex(); // Never destroyed: the scanner runs until exit
+    return *instance;
+}
+
+/**
+ * @brief True for names a client may list, fetch or upload: no path
+ * separators, not hidden, which keeps the index, versions and other
+ * dotfiles private, and no '@', which names a version.
+ */
+bool isServedName(std::string_view name) {
+    return !name.empty() && name[0] != '.' && name.find_first_of("/\\@") == std::string_view::npos;
+}
+
+/**
+ * @brief Resolves "<name>" or "<name>@<version>" to a path. isVersion
+ * tells which it was. False if the name is not served or the version not kept.
+ */
+bool resolveServedFile(std::string_view spec, std::string& path, bool& isVersion) {
+    std::string_view name;
+    uint64_t version = 0;
+    isVersion = parseVersionSpec(spec, name, version);
+    if (!isVersion) {
+        path = config().filesDir + "/" + std::string(spec);
+        return isServedName(spec);
+    }
+    return isServedName(name) && fileCatalog().versionPath(name, version, path);
+}
+
+/**
+ * @brief One scanner pass: digests new and changed files and forgets
+ * removed ones.
+ */
+void scanFileIndex(const std::string& directory) {
+    std::unordered_set<std::string> present;
+    size_t digested = 0;
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        FileStat stat;
+        if (!isServedName(name) || !statFile(it->path().string(), stat)) continue;
+        present.insert(name);
+        // A file being replaced gets its entry when the upload publishes it.
+        if (fileIndex().isCurrent(name, stat) || uploadLocks().isLocked(name)) continue;
+        FileDigest digest;
+        // Fails if the file changes underneath us; the next pass retries.
+        if (digestFile(it->path().string(), digest, config().indexScanRate) && fileIndex().store(name, digest)) {
+            ++digested;
+        }
+    }
+    if (ec) return;   // A partial listing must not drop entries
+    fileIndex().retain(present);
+    fileIndex().compactIfNeeded();
+    fileCatalog().sync(present);
+    if (digested > 0 && logEnabled(LogLevel::Debug)) {
+        logAt(LogLevel::Debug, "File index: digested " + std::to_string(digested) + " file(s).");
+    }
+}
+
+void indexScannerLoop() {
+    lowerThreadPriority();
+    while (true) {
+        refreshConfig();
+        scanFileIndex(config().filesDir);
+        std::this_thread::sleep_for(std::chrono::seconds(config().indexScanIntervalSec));
+    }
+}
+// --- End File Index ---
+
+// --- Credentials ---
+CredentialStore& credentials() {
+    static CredentialStore* store =
+        new CredentialStore(config().authHashThreads, config().authHashQueue, config().authCacheEntries);
+    return *store;
+}
+
+/**
+ * @brief Writes DEFAULT_USERS, hashed, to the credentials file (mode 0600)
+ * if there is no such file yet.
+ */
+void ensureCredentialsFile() {
+    const std::string& path = config().credentialsFile;
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec)) return;
+    std::ofstream out(path);
+    std::filesystem::permissions(path, std::filesystem::perms::owner_read | std::filesystem::perms::owner_write, ec);
+    out << "# <user>:scrypt:<log2 N>:<r>:<p>:<salt>:<hash>; add lines with `server --hash-password USER`\n";
+    for (const auto& account : DEFAULT_USERS) {
+        out << account.first << ":" << hashPassword(account.second) << "\n";
+    }
+    logAt(LogLevel::Warn, "Created " + path + " with the default accounts; change them.");
+}
+
+void credentialsReloadLoop() {
+    while (true) {
+        refreshConfig();
+        std::this_thread::sleep_for(std::chrono::seconds(config().credentialsReloadSec));
+        std::string error;
+        if (credentials().reloadIfChanged(error)) {
+            log("Reloaded " + std::to_string(credentials().users()) + " account(s) from " + config().credentialsFile +
+                ".");
+        } else if (!error.empty()) {
+            logAt(LogLevel::Error, "Keeping the previous accounts: " + error);
+        }
+    }
+}
+// --- End Credentials ---
+
+// --- Metrics ---
+// Per-thread sharded counters and histograms live in libfileshare/metrics.h.
+
+// Every heap allocation in the process is counted so STATS can show that
+// the transfer hot path does not allocate. The counter is constant-
+// initialized, so it is safe to use before static constructors run.
+ShardedCounter heapAllocations;
+
+void* operator new(std::size_t size) {
+    heapAllocations.add();
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+// Kept out of line so GCC does not flag the inlined free() as mismatched.
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+enum CommandKind { CMD_AUTH = 0, CMD_LIST, CMD_DOWNLOAD, CMD_UPLOAD, CMD_STATS, CMD_OTHER, CMD_KIND_COUNT };
+const char* COMMAND_KIND_NAMES[CMD_KIND_COUNT] = {"auth", "list", "download", "upload", "stats", "other"};
+
+CommandKind commandKind(Verb verb) {
+    switch (verb) {
+        case Verb::Auth:
+        case Verb::Resume: return CMD_AUTH;
+        case Verb::List: return CMD_LIST;
+        case Verb::Download:
+        case Verb::Range: return CMD_DOWNLOAD;
+        case Verb::Upload: return CMD_UPLOAD;
+        case Verb::Stats: return CMD_STATS;
+        default: return CMD_OTHER;
+    }
+}
+
+struct ServerMetrics {
+    ShardedCounter commands[CMD_KIND_COUNT];
+    Histogram commandLatencyUs[CMD_KIND_COUNT];
+    Histogram downloadTtfbUs;          // DOWNLOAD received -> first data byte sent
+    Histogram transferKBps[2];         // Per-transfer throughput: [0] download, [1] upload
+    Histogram schedulerWaitUs;         // Time a chunk waited for its send turn
+    ShardedCounter bytesIn;
+    ShardedCounter bytesOut;
+    ShardedCounter connectionsTotal;
+    ShardedCounter connectionsRejected; // Answered BUSY by admission control
+    ShardedCounter connectionsReaped;   // Shut down after missing a deadline
+    ShardedCounter throttledUs;        // Time transfers spent waiting on rate limits
+    ShardedCounter zeroCopyFrames;     // Chunks sent with MSG_ZEROCOPY
+    ShardedCounter zeroCopyCopied;     // ... whose completion said the kernel copied anyway
+    ShardedCounter secureSessions;     // Sessions switched to TLS records by STARTTLS
+    ShardedCounter kernelTlsSessions;  // ... whose records the kernel encrypts (kTLS)
+    ShardedCounter sendfileFrames;     // Chunks sent from the page cache with sendfile()
+    ShardedCounter checksumMismatches; // Uploaded chunks that failed their CRC
+    ShardedCounter repairRequests;     // RESENDs asked of uploaders for chunks that failed their CRC
+    ShardedCounter rangesServed;       // RANGE requests answered: pget segments and client re-fetches
+    ShardedCounter treesServed;        // TREE requests answered
+    ShardedCounter treesBuilt;         // ... that had to read the file to compute the leaves
+    ShardedCounter sessionsResumed;    // Sessions started by RESUME instead of AUTH
+    ShardedCounter resumesRejected;    // RESUMEs with a bad or expired ticket
+    ShardedCounter configReloads;      // Configurations published by SIGHUP
+    ShardedCounter configReloadFailures; // ... and SIGHUPs whose configuration was refused
+    std::atomic<int64_t> activeConnections{0};
+    std::atomic<SocketType> listenSocket{static_cast<SocketType>(-1)};
+    std::atomic<int64_t> sessionThreads{0};    // Accepted connections whose thread has not finished
+    std::atomic<bool> draining{false};         // Shutting down: no new sessions, idle ones closed
+    std::atomic<bool> handedOff{false};        // A successor process owns the listening sockets
+};
+
+ServerMetrics metrics;
+
+inline uint64_t elapsedUs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - since).count();
+}
+
+/**
+ * @brief Records one finished transfer's throughput in KiB/s.
+ */
+void recordTransfer(int direction, uint64_t bytes, std::chrono::steady_clock::time_point started) {
+    uint64_t us = std::max<uint64_t>(elapsedUs(started), 1);
+    metrics.transferKBps[direction].record(bytes * 1000000 / 1024 / us);
+}
+
+/**
+ * @brief Connections waiting in the kernel accept queue (Linux only, else 0).
+ */
+uint64_t acceptQueueDepth() {
+#ifdef TCP_INFO
+    SocketType listenSocket = metrics.listenSocket.load();
+    if (listenSocket < 0) return 0;
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(listenSocket, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+        return info.tcpi_unacked; // For listeners: current accept queue length
+    }
+#endif
+    return 0;
+}
+
+/**
+ * @brief Compact human-readable summary returned by the STATS command.
+ */
+std::string renderStats() {
+    std::string out = "Server stats:\n";
+    char line[160];
+    std::snprintf(line, sizeof(line), "connections active=%" PRId64 " total=%" PRIu64 " rejected=%" PRIu64
+                  " reaped=%" PRIu64 "\n",
+                  metrics.activeConnections.load(), metrics.connectionsTotal.value(),
+                  metrics.connectionsRejected.value(), metrics.connectionsReaped.value());
+    out += line;
+    std::snprintf(line, sizeof(line), "bytes in=%" PRIu64 " out=%" PRIu64 "\n",
+                  metrics.bytesIn.value(), metrics.bytesOut.value());
+    out += line;
+    std::snprintf(line, sizeof(line), "queues accept=%" PRIu64 " log=%zu\n",
+                  acceptQueueDepth(), logger().queueDepth());
+    out += line;
+    BufferPoolStats pool = bufferPoolStats();
+    std::snprintf(line, sizeof(line), "allocs heap=%" PRIu64 " buffers acquired=%" PRIu64 " allocated=%" PRIu64
+                  " outstanding=%" PRIu64 "\n",
+                  heapAllocations.value(), pool.acquired, pool.heapAllocated, pool.outstanding);
+    out += line;
+    std::snprintf(line, sizeof(line), "shaping throttled_ms=%" PRIu64 "\n", metrics.throttledUs.value() / 1000);
+    out += line;
+    std::snprintf(line, sizeof(line), "zerocopy frames=%" PRIu64 " copied=%" PRIu64 "\n",
+                  metrics.zeroCopyFrames.value(), metrics.zeroCopyCopied.value());
+    out += line;
+    std::snprintf(line, sizeof(line), "tls sessions=%" PRIu64 " kernel=%" PRIu64 " sendfile_frames=%" PRIu64 "\n",
+                  metrics.secureSessions.value(), metrics.kernelTlsSessions.value(), metrics.sendfileFrames.value());
+    out += line;
+    std::snprintf(line, sizeof(line), "auth users=%zu cache_hits=%" PRIu64 " hashes=%" PRIu64 " shed=%" PRIu64
+                  " queued=%zu\n",
+                  credentials().users(), credentials().cacheHits(), credentials().hashes(), credentials().shed(),
+                  credentials().queued());
+    out += line;
+    std::snprintf(line, sizeof(line), "tickets resumed=%" PRIu64 " rejected=%" PRIu64 "\n",
+                  metrics.sessionsResumed.value(), metrics.resumesRejected.value());
+    out += line;
+    std::snprintf(line, sizeof(line), "config generation=%" PRIu64 " reloads=%" PRIu64 " failed=%" PRIu64 "\n",
+                  configGeneration.load(), metrics.configReloads.value(), metrics.configReloadFailures.value());
+    out += line;
+    std::snprintf(line, sizeof(line), "integrity mismatches=%" PRIu64 " repairs=%" PRIu64 " crc32c=%s\n",
+                  metrics.checksumMismatches.value(), metrics.repairRequests.value(),
+                  crc32cAccelerated() ? "hardware" : "table");
+    out += line;
+    std::snprintf(line, sizeof(line), "catalog names=%zu versions=%zu\n",
+                  fileCatalog().names(), fileCatalog().keptVersions());
+    out += line;
+    std::snprintf(line, sizeof(line), "index entries=%zu bytes=%" PRIu64 " trees_served=%" PRIu64
+                  " trees_built=%" PRIu64 "\n",
+                  fileIndex().entries(), fileIndex().bytes(), metrics.treesServed.value(), metrics.treesBuilt.value());
+    out += line;
+    std::snprintf(line, sizeof(line), "ranges served=%" PRIu64 "\n", metrics.rangesServed.value());
+    out += line;
+
+    auto appendHistogram = [&](const char* name, const Histogram& histogram, const char* unit) {
+        auto counts = histogram.snapshot();
+        uint64_t total = 0;
+        for (uint64_t c : counts) total += c;
+        if (total == 0) return;
+        std::snprintf(line, sizeof(line), "%-16s n=%-8" PRIu64 " p50=%" PRIu64 "%s p99=%" PRIu64 "%s p999=%" PRIu64 "%s\n",
+                      name, total, Histogram::percentile(counts, 0.5), unit,
+                      Histogram::percentile(counts, 0.99), unit, Histogram::percentile(counts, 0.999), unit);
+        out += line;
+    };
+    for (int i = 0; i < CMD_KIND_COUNT; ++i) {
+        appendHistogram(COMMAND_KIND_NAMES[i], metrics.commandLatencyUs[i], "us");
+    }
+    appendHistogram("download_ttfb", metrics.downloadTtfbUs, "us");
+    appendHistogram("download_rate", metrics.transferKBps[0], "KiB/s");
+    appendHistogram("upload_rate", metrics.transferKBps[1], "KiB/s");
+    appendHistogram("send_wait", metrics.schedulerWaitUs, "us");
+    return out;
+}
+
+/**
+ * @brief Prometheus text exposition (format 0.0.4).
+ */
+std::string renderPrometheus() {
+    std::string out;
+    auto appendSample = [&](const std::string& name, const std::string& labels, uint64_t value) {
+        out += name;
+        if (!labels.empty()) out += "{" + labels + "}";
+        out += " " + std::to_string(value) + "\n";
+    };
+    // Buckets are reported per power of two to keep the series count small.
+    auto appendHistogram = [&](const std::string& name, const std::string& labels, const Histogram& histogram) {
+        uint64_t sum = 0;
+        auto counts = histogram.snapshot(&sum);
+        std::string prefix = labels.empty() ? "" : labels + ",";
+        uint64_t cumulative = 0;
+        int next = 0;
+        for (int octave = 0; octave <= 40; ++octave) {
+            uint64_t bound = (octave == 0) ? 0 : (uint64_t(1) << octave) - 1;
+            while (next < Histogram::BUCKETS && Histogram::bucketUpperBound(next) <= bound) {
+                cumulative += counts[next++];
+            }
+            appendSample(name + "_bucket", prefix + "le=\"" + std::to_string(bound) + "\"", cumulative);
+        }
+        while (next < Histogram::BUCKETS) cumulative += counts[next++];
+        appendSample(name + "_bucket", prefix + "le=\"+Inf\"", cumulative);
+        appendSample(name + "_sum", labels, sum);
+        appendSample(name + "_count", labels, cumulative);
+    };
+
+    out += "# TYPE fileshare_connections_active gauge\n";
+    appendSample("fileshare_connections_active", "", metrics.activeConnections.load());
+    out += "# TYPE fileshare_draining gauge\n";
+    appendSample("fileshare_draining", "", metrics.draining.load() ? 1 : 0);
+    out += "# TYPE fileshare_connections_total counter\n";
+    appendSample("fileshare_connections_total", "", metrics.connectionsTotal.value());
+    out += "# TYPE fileshare_connections_rejected_total counter\n";
+    appendSample("fileshare_connections_rejected_total", "", metrics.connectionsRejected.value());
+    out += "# TYPE fileshare_connections_reaped_total counter\n";
+    appendSample("fileshare_connections_reaped_total", "", metrics.connectionsReaped.value());
+    out += "# TYPE fileshare_bytes_total counter\n";
+    appendSample("fileshare_bytes_total", "direction=\"in\"", metrics.bytesIn.value());
+    appendSample("fileshare_bytes_total", "direction=\"out\"", metrics.bytesOut.value());
+    out += "# TYPE fileshare_queue_depth gauge\n";
+    appendSample("fileshare_queue_depth", "queue=\"accept\"", acceptQueueDepth());
+    appendSample("fileshare_queue_depth", "queue=\"log\"", logger().queueDepth());
+
+    BufferPoolStats pool = bufferPoolStats();
+    out += "# TYPE fileshare_heap_allocations_total counter\n";
+    appendSample("fileshare_heap_allocations_total", "", heapAllocations.value());
+    out += "# TYPE fileshare_buffer_acquires_total counter\n";
+    appendSample("fileshare_buffer_acquires_total", "", pool.acquired);
+    out += "# TYPE fileshare_buffer_allocations_total counter\n";
+    appendSample("fileshare_buffer_allocations_total", "", pool.heapAllocated);
+    out += "# TYPE fileshare_buffers_outstanding gauge\n";
+    appendSample("fileshare_buffers_outstanding", "", pool.outstanding);
+    out += "# TYPE fileshare_throttled_us_total counter\n";
+    appendSample("fileshare_throttled_us_total", "", metrics.throttledUs.value());
+    out += "# TYPE fileshare_zerocopy_frames_total counter\n";
+    appendSample("fileshare_zerocopy_frames_total", "", metrics.zeroCopyFrames.value());
+    out += "# TYPE fileshare_zerocopy_copied_total counter\n";
+    appendSample("fileshare_zerocopy_copied_total", "", metrics.zeroCopyCopied.value());
+    out += "# TYPE fileshare_tls_sessions_total counter\n";
+    appendSample("fileshare_tls_sessions_total", "mode=\"user\"",
+                 metrics.secureSessions.value() - metrics.kernelTlsSessions.value());
+    appendSample("fileshare_tls_sessions_total", "mode=\"kernel\"", metrics.kernelTlsSessions.value());
+    out += "# TYPE fileshare_auth_users gauge\n";
+    appendSample("fileshare_auth_users", "", credentials().users());
+    out += "# TYPE fileshare_auth_cache_hits_total counter\n";
+    appendSample("fileshare_auth_cache_hits_total", "", credentials().cacheHits());
+    out += "# TYPE fileshare_auth_hashes_total counter\n";
+    appendSample("fileshare_auth_hashes_total", "", credentials().hashes());
+    out += "# TYPE fileshare_auth_shed_total counter\n";
+    appendSample("fileshare_auth_shed_total", "", credentials().shed());
+    out += "# TYPE fileshare_auth_hash_queue gauge\n";
+    appendSample("fileshare_auth_hash_queue", "", credentials().queued());
+    out += "# TYPE fileshare_sessions_resumed_total counter\n";
+    appendSample("fileshare_sessions_resumed_total", "", metrics.sessionsResumed.value());
+    out += "# TYPE fileshare_resumes_rejected_total counter\n";
+    appendSample("fileshare_resumes_rejected_total", "", metrics.resumesRejected.value());
+    out += "# TYPE fileshare_config_generation gauge\n";
+    appendSample("fileshare_config_generation", "", configGeneration.load());
+    out += "# TYPE fileshare_config_reloads_total counter\n";
+    appendSample("fileshare_config_reloads_total", "result=\"ok\"", metrics.configReloads.value());
+    appendSample("fileshare_config_reloads_total", "result=\"failed\"", metrics.configReloadFailures.value());
+    out += "# TYPE fileshare_sendfile_frames_total counter\n";
+    appendSample("fileshare_sendfile_frames_total", "", metrics.sendfileFrames.value());
+    out += "# TYPE fileshare_checksum_mismatches_total counter\n";
+    appendSample("fileshare_checksum_mismatches_total", "", metrics.checksumMismatches.value());
+    out += "# TYPE fileshare_repair_requests_total counter\n";
+    appendSample("fileshare_repair_requests_total", "", metrics.repairRequests.value());
+    out += "# TYPE fileshare_range_requests_total counter\n";
+    appendSample("fileshare_range_requests_total", "", metrics.rangesServed.value());
+    out += "# TYPE fileshare_catalog_names gauge\n";
+    appendSample("fileshare_catalog_names", "", fileCatalog().names());
+    out += "# TYPE fileshare_versions_kept gauge\n";
+    appendSample("fileshare_versions_kept", "", fileCatalog().keptVersions());
+    out += "# TYPE fileshare_index_entries gauge\n";
+    appendSample("fileshare_index_entries", "", fileIndex().entries());
+    out += "# TYPE fileshare_index_bytes gauge\n";
+    appendSample("fileshare_index_bytes", "", fileIndex().bytes());
+    out += "# TYPE fileshare_trees_served_total counter\n";
+    appendSample("fileshare_trees_served_total", "", metrics.treesServed.value());
+    out += "# TYPE fileshare_trees_built_total counter\n";
+    appendSample("fileshare_trees_built_total", "", metrics.treesBuilt.value());
+
+    out += "# TYPE fileshare_commands_total counter\n";
+    for (int i = 0; i < CMD_KIND_COUNT; ++i) {
+        appendSample("fileshare_commands_total", std::string("command=\"") + COMMAND_KIND_NAMES[i] + "\"",
+                     metrics.commands[i].value());
+    }
+    out += "# TYPE fileshare_command_latency_us histogram\n";
+    for (int i = 0; i < CMD_KIND_COUNT; ++i) {
+        appendHistogram("fileshare_command_latency_us", std::string("command=\"") + COMMAND_KIND_NAMES[i] + "\"",
+                        metrics.commandLatencyUs[i]);
+    }
+    out += "# TYPE fileshare_download_ttfb_us histogram\n";
+    appendHistogram("fileshare_download_ttfb_us", "", metrics.downloadTtfbUs);
+    out += "# TYPE fileshare_transfer_rate_kibps histogram\n";
+    appendHistogram("fileshare_transfer_rate_kibps", "direction=\"download\"", metrics.transferKBps[0]);
+    appendHistogram("fileshare_transfer_rate_kibps", "direction=\"upload\"", metrics.transferKBps[1]);
+    out += "# TYPE fileshare_send_wait_us histogram\n";
+    appendHistogram("fileshare_send_wait_us", "", metrics.schedulerWaitUs);
+    return out;
+}
+
+// Listening loops wake this often to notice that a successor took over.
+const int ACCEPT_POLL_MS = 200;
+
+/**
+ * @brief Opens the metrics listener on metrics_port.
+ * @return The socket, or INVALID_SOCKET_HANDLE after logging why not.
+ */
+SocketType openMetricsSocket() {
+    SocketType httpSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (httpSocket < 0) {
+        logAt(LogLevel::Error, "Metrics: failed to create socket.");
+        return INVALID_SOCKET_HANDLE;
+    }
+    int reuse = 1;
+    setsockopt(httpSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+    sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(config().metricsPort));
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(httpSocket, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(httpSocket, 16) < 0) {
+        logAt(LogLevel::Error, "Metrics: bind/listen failed on port " + std::to_string(config().metricsPort) + ".");
+        CLOSE_SOCKET(httpSocket);
+        return INVALID_SOCKET_HANDLE;
+    }
+    setBlocking(httpSocket, false);   // Shared with a successor, which may take the connection first
+    return httpSocket;
+}
+
+/**
+ * @brief Minimal HTTP/1.1 server answering GET /metrics on metrics_port.
+ * Serves httpSocket until a successor takes it over.
+ */
+void metricsServerLoop(SocketType httpSocket) {
+    log("Metrics endpoint on http://0.0.0.0:" + std::to_string(config().metricsPort) + "/metrics");
+
+    while (!metrics.handedOff.load()) {
+        if (!waitReadable(httpSocket, ACCEPT_POLL_MS)) continue;
+        SocketType conn = accept(httpSocket, nullptr, nullptr);
+        if (conn < 0) continue;
+        setBlocking(conn, true);
+        refreshConfig();
+
+        char request[1024];
+        int n = recv(conn, request, sizeof(request) - 1, 0);
+        std::string requestLine = n > 0 ? std::string(request, n) : "";
+        std::string status = "200 OK";
+        std::string body;
+        if (requestLine.rfind("GET /metrics", 0) == 0) {
+            body = renderPrometheus();
+        } else {
+            status = "404 Not Found";
+            body = "Not found. Try /metrics\n";
+        }
+        std::string response = "HTTP/1.1 " + status + "\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while (sent < response.size()) {
+            int m = send(conn, response.data() + sent, response.size() - sent, SEND_FLAGS);
+            if (m <= 0) break;
+            sent += m;
+        }
+        CLOSE_SOCKET(conn);
+    }
+    CLOSE_SOCKET(httpSocket);         // The successor holds its own descriptor
+}
+// --- End Metrics ---
+
+// --- Bandwidth Shaping ---
+// Each file-data chunk is charged to the session's bucket, the user's bucket
+// and the global bucket; the transfer thread then sleeps for the longest of
+// the three waits. Interactive traffic (replies, LIST, STATS, ACKs) bypasses
+// the buckets, so it is never queued behind bulk data. A configuration
+// reload re-rates the global and user buckets in place; each session
+// re-rates its own when it picks up the new snapshot.
+
+TokenBucket globalBucket(0, 0);   // Rated from the configuration in applyRateLimits()
+
+struct UserBuckets {
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<TokenBucket>, std::less<>> buckets;
+};
+
+UserBuckets userBuckets;
+
+uint64_t userRate(const ServerConfig& config, std::string_view user) {
+    auto override = config.userRateOverrides.find(user);
+    return override != config.userRateOverrides.end() ? override->second : config.userRateLimit;
+}
+
+/**
+ * @brief Returns the bucket shared by every session of a user.
+ */
+std::shared_ptr<TokenBucket> userBucket(std::string_view user) {
+    std::lock_guard<std::mutex> lock(userBuckets.mutex);
+    auto it = userBuckets.buckets.find(user);
+    if (it != userBuckets.buckets.end()) return it->second;
+    auto bucket = std::make_shared<TokenBucket>(userRate(config(), user), config().rateBurst);
+    userBuckets.buckets.emplace(std::string(user), bucket);
+    return bucket;
+}
+
+/**
+ * @brief Re-rates the global bucket and every user bucket from config.
+ */
+void applyRateLimits(const ServerConfig& config) {
+    globalBucket.setRate(config.globalRateLimit, config.rateBurst);
+    std::lock_guard<std::mutex> lock(userBuckets.mutex);
+    for (auto& entry : userBuckets.buckets) {
+        entry.second->setRate(userRate(config, entry.first), config.rateBurst);
+    }
+}
+
+/**
+ * @brief Per-session view of the rate limits that apply to it.
+ */
+class TransferShaper {
+public:
+    TransferShaper() : connection_(config().connectionRateLimit, config().rateBurst) {}
+
+    void setUser(std::string_view user) { user_ = userBucket(user); }
+
+    void configure(const ServerConfig& config) {
+        connection_.setRate(config.connectionRateLimit, config.rateBurst);
+    }
+
+    /**
+     * @brief Blocks until `bytes` of file data may be moved.
+     */
+    void throttle(uint64_t bytes) {
+        std::chrono::nanoseconds wait = std::max(connection_.reserve(bytes), globalBucket.reserve(bytes));
+        if (user_) wait = std::max(wait, user_->reserve(bytes));
+        if (wait.count() > 0) {
+            metrics.throttledUs.add(std::chrono::duration_cast<std::chrono::microseconds>(wait).count());
+            std::this_thread::sleep_for(wait);
+        }
+    }
+
+private:
+    TokenBucket connection_;
+    std::shared_ptr<TokenBucket> user_;
+};
+// --- End Bandwidth Shaping ---
+
+/**
+ * @brief Queues a response (string) to the client as one encrypted frame.
+ * It goes out with the next data frame or before the next blocking read,
+ * so replies to pipelined commands share one write.
+ */
+bool sendResponse(Connection& conn, const std::string& response) {
+    if (!conn.queueFrame(response)) return false;
+    metrics.bytesOut.add(FRAME_HEADER_SIZE + response.size());
+    return true;
+}
+
+/**
+ * @brief Receives one command frame from the client, with decryption.
+ * Reuses the caller's string so steady-state receives do not allocate.
+ * @return false if the connection closed or failed.
+ */
+bool receiveCommand(Connection& conn, std::string& payload) {
+    if (!conn.recvFrame(payload)) {
+        return false;
+    }
+    metrics.bytesIn.add(FRAME_HEADER_SIZE + payload.size());
+    return true;
+}
+
+/**
+ * @brief Sends one file-data chunk from a pooled buffer (ciphered in place),
+ * plus any queued replies and an optional trailing reply, in one write.
+ */
+bool sendChunk(Connection& conn, Buffer& chunk, const std::string* trailer = nullptr) {
+    size_t length = chunk.size();
+    if (!conn.sendFrame(chunk, trailer)) return false;
+    metrics.bytesOut.add(FRAME_HEADER_SIZE + length + (trailer ? FRAME_HEADER_SIZE + trailer->size() : 0));
+    return true;
+}
+
+/**
+ * @brief Sends one file-data chunk from the page cache with sendfile().
+ * Only for connections whose records the kernel encrypts.
+ */
+bool sendFileChunk(Connection& conn, const FileSource& file, uint64_t offset, size_t length,
+                   const std::string* trailer = nullptr) {
+    if (!conn.sendFileFrame(file, offset, length, trailer)) return false;
+    metrics.bytesOut.add(FRAME_HEADER_SIZE + length + (trailer ? FRAME_HEADER_SIZE + trailer->size() : 0));
+    metrics.sendfileFrames.add();
+    return true;
+}
+
+/**
+ * @brief Receives one file-data chunk straight into a pooled buffer.
+ */
+bool receiveChunk(Connection& conn, Buffer& chunk) {
+    if (!conn.recvFrame(chunk)) return false;
+    metrics.bytesIn.add(FRAME_HEADER_SIZE + chunk.size());
+    return true;
+}
+
+enum class ChunkStatus { Ok, Damaged, Lost };
+
+/**
+ * @brief Receives a file-data chunk and the "CRC" frame that follows it.
+ * Damaged if the data does not hash to the CRC; crc is the sender's value.
+ */
+ChunkStatus receiveCheckedChunk(Connection& conn, Buffer& chunk, std::string& scratch, uint32_t& crc) {
+    if (!receiveChunk(conn, chunk) || !conn.recvFrame(scratch) || !parseCrcFrame(scratch, crc)) {
+        return ChunkStatus::Lost;
+    }
+    return crc32c(0, chunk.data(), chunk.size()) == crc ? ChunkStatus::Ok : ChunkStatus::Damaged;
+}
+
+const std::string DOWNLOAD_DONE = "DOWNLOAD_DONE";
+
+// --- Transfer Scheduling ---
+// Download threads do not write to their sockets whenever the OS runs them:
+// once a socket is writable the thread asks the scheduler for a send slot,
+// and slots are granted in deficit round robin order weighted per user.
+
+FairScheduler& transferScheduler() {
+    static FairScheduler* instance = new FairScheduler(config().sendSlots, config().chunkSize);
+    return *instance;
+}
+
+uint32_t userWeight(std::string_view user) {
+    auto it = config().userWeights.find(user);
+    return it != config().userWeights.end() ? static_cast<uint32_t>(it->second) : 1;
+}
+
+/**
+ * @brief Runs send(), which writes length bytes of file data, once the
+ * scheduler grants this flow a turn.
+ */
+template <typename SendFn>
+bool sendScheduled(Connection& conn, FairScheduler::Flow& flow, size_t length, SendFn&& send) {
+    // Wait for socket space first so a slow reader never holds a slot.
+    if (!waitWritable(conn.socket(), -1)) return false;
+    auto waitStart = std::chrono::steady_clock::now();
+    transferScheduler().acquire(flow, length);
+    metrics.schedulerWaitUs.record(elapsedUs(waitStart));
+    bool sent = send();
+    transferScheduler().release();
+    return sent;
+}
+// --- End Transfer Scheduling ---
+
+// --- Admission Control ---
+// The accept loop admits a connection straight away while fewer than
+// max_connections sessions are being served. Otherwise it may wait, in a
+// queue of bounded length and for a bounded time, for a session to end.
+// Anything beyond that is answered "BUSY retry-after N" and closed at once,
+// so a burst costs a few bytes per connection instead of a thread each.
+// While anyone is queued, new arrivals queue behind them, and a session
+// that ends hands its slot to a waiter rather than freeing it, so a waiter
+// cannot lose its slot to a connection accepted after it.
+
+struct AdmissionState {
+    std::mutex mutex;
+    std::condition_variable slotFreed;
+    int active = 0;
+    int queued = 0;
+    int handedOff = 0;        // Slots passed to queued connections, counted in active, not yet claimed
+    std::map<std::string, int> perAddress;                 // Served plus queued
+    std::map<std::string, int, std::less<>> perUser;       // Authenticated sessions
+};
+
+AdmissionState admission;
+
+enum class Admission { Admitted, Queued, Rejected };
+
+Admission admitConnection(const std::string& address) {
+    std::lock_guard<std::mutex> lock(admission.mutex);
+    int& fromAddress = admission.perAddress[address];
+    Admission result = Admission::Rejected;
+    const ServerConfig& limits = config();
+    if (fromAddress >= static_cast<int64_t>(limits.maxConnectionsPerIp)) {
+        result = Admission::Rejected;
+    } else if (admission.queued == 0 && admission.active < static_cast<int64_t>(limits.maxConnections)) {
+        ++admission.active;
+        result = Admission::Admitted;
+    } else if (admission.queued < static_cast<int64_t>(limits.admissionQueueLimit)) {
+        ++admission.queued;
+        result = Admission::Queued;
+        // Slots can be free with a queue only after max_connections was raised; wake a waiter for one.
+        if (admission.active < static_cast<int64_t>(limits.maxConnections)) admission.slotFreed.notify_one();
+    }
+    if (result != Admission::Rejected) {
+        ++fromAddress;
+    } else if (fromAddress == 0) {
+        admission.perAddress.erase(address);
+    }
+    return result;
+}
+
+/**
+ * @brief Waits up to admission_wait_ms for a queued connection's turn.
+ */
+bool waitForSessionSlot() {
+    const ServerConfig& limits = config();
+    std::unique_lock<std::mutex> lock(admission.mutex);
+    bool admitted = admission.slotFreed.wait_for(lock, std::chrono::milliseconds(limits.admissionWaitMs), [&] {
+        return admission.handedOff > 0 || admission.active < static_cast<int64_t>(limits.maxConnections);
+    });
+    --admission.queued;
+    if (admitted && admission.handedOff > 0) {
+        --admission.handedOff;
+    } else if (admitted) {
+        ++admission.active;
+    }
+    return admitted;
+}
+
+/**
+ * @brief Releases an address slot and, if the connection was served, its session slot.
+ */
+void releaseConnection(const std::string& address, bool wasServed) {
+    std::lock_guard<std::mutex> lock(admission.mutex);
+    auto it = admission.perAddress.find(address);
+    if (it != admission.perAddress.end() && --it->second == 0) {
+        admission.perAddress.erase(it);
+    }
+    if (!wasServed) return;
+    // Every handed-off slot has a waiter to claim it: a waiter only gives up
+    // while handedOff is 0, so handedOff never exceeds queued.
+    if (admission.queued > admission.handedOff &&
+        admission.active <= static_cast<int64_t>(config().maxConnections)) {
+        ++admission.handedOff;
+    } else {
+        --admission.active;
+    }
+    admission.slotFreed.notify_one();
+}
+
+bool acquireUserSession(std::string_view user) {
+    std::lock_guard<std::mutex> lock(admission.mutex);
+    auto it = admission.perUser.find(user);
+    if (it == admission.perUser.end()) it = admission.perUser.emplace(std::string(user), 0).first;
+    if (it->second >= static_cast<int64_t>(config().maxSessionsPerUser)) return false;
+    ++it->second;
+    return true;
+}
+
+void releaseUserSession(const std::string& user) {
+    std::lock_guard<std::mutex> lock(admission.mutex);
+    auto it = admission.perUser.find(user);
+    if (it != admission.perUser.end() && --it->second == 0) {
+        admission.perUser.erase(it);
+    }
+}
+
+std::string busyReply() {
+    return "BUSY retry-after " + std::to_string(config().busyRetryAfterSec);
+}
 
+/**
+ * @brief Answers reply (BUSY) and closes. The client reads it as the reply to AUTH.
+ */
+void rejectConnection(SocketType clientSocket, const std::string& reply) {
+    metrics.connectionsRejected.add();
+    Connection conn(clientSocket, config().encryptionKey);
+    conn.sendFrame(reply);
 #ifdef _WIN32
-    // Windows (Winsock)
-    #include <winsock2.h>
-    #include <ws2tcpip.h>
-    #pragma comment(lib, "ws2_32.lib") // Link against the Winsock library
-    typedef SOCKET SocketType;
-    #define CLOSE_SOCKET(s) closesocket(s)
+    shutdown(clientSocket, SD_SEND);
 #else
-    // POSIX (Linux/macOS)
-    #include <sys/socket.h>
-    #include <netinet/in.h>
-    #include <arpa/inet.h>
-    #include <unistd.h>
-    typedef int SocketType;
-    #define CLOSE_SOCKET(s) close(s)
+    shutdown(clientSocket, SHUT_WR);
 #endif
-// --- End Platform-Specific ---
+}
+// --- End Admission Control ---
 
-// --- Configuration ---
-const int PORT = 9999;
-const int BUFFER_SIZE = 4096;
-const char* SERVER_FILES_DIR = "server_files";
-const std::string ENCRYPTION_KEY = "mysecretkey";
+// --- Session Tickets ---
+// AUTH_SUCCESS carries a ticket that RESUME accepts in place of AUTH on
+// later connections, to this server or any other holding the same key.
 
-// Simple user database
-std::map<std::string, std::string> VALID_USERS = {
-    {"user", "pass123"},
-    {"admin", "adminpass"}
+SessionTickets& sessionTickets() {
+    static SessionTickets* tickets = new SessionTickets();
+    return *tickets;
+}
+
+int64_t unixNow() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+// --- End Session Tickets ---
+
+// --- Connection Deadlines ---
+// Each session has one timer on a shared hierarchical wheel. Session threads
+// record progress with a relaxed store and take the reaper's lock only when a
+// phase change needs an earlier deadline than the one armed. When a timer
+// fires the reaper re-arms it from the last progress, or shuts the socket
+// down if the phase's timeout has passed, which wakes the thread blocked in
+// recv/send/poll so it can clean up.
+
+enum class SessionPhase : int { Idle, Reading, Writing };
+
+const int DEADLINE_TICK_MS = 100;         // Timer wheel resolution
+
+inline int64_t steadyNowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint64_t deadlineTick(int64_t ms) { return static_cast<uint64_t>(ms) / DEADLINE_TICK_MS; }
+
+struct ConnectionWatch : TimerNode {
+    explicit ConnectionWatch(SocketType sock) : sock(sock) { setTimeouts(config()); }
+
+    int64_t deadlineMs() const {
+        return lastProgressMs.load(std::memory_order_relaxed) +
+               timeoutMs[phase.load(std::memory_order_relaxed)].load(std::memory_order_relaxed);
+    }
+
+    void setTimeouts(const ServerConfig& config) {
+        timeoutMs[0].store(config.idleTimeoutSec * 1000, std::memory_order_relaxed);
+        timeoutMs[1].store(config.readTimeoutSec * 1000, std::memory_order_relaxed);
+        timeoutMs[2].store(config.writeTimeoutSec * 1000, std::memory_order_relaxed);
+    }
+
+    SocketType sock;
+    std::atomic<int64_t> timeoutMs[3];      // Per SessionPhase, from the session's snapshot
+    std::atomic<int64_t> lastProgressMs{steadyNowMs()};
+    std::atomic<int> phase{static_cast<int>(SessionPhase::Idle)};
+    std::atomic<uint64_t> armedTick{0};     // Written by the reaper under its lock
 };
-// --- End Configuration ---
+
+class Reaper {
+public:
+    Reaper() : wheel_(deadlineTick(steadyNowMs())), thread_(&Reaper::run, this) {}
+
+    void arm(ConnectionWatch& watch) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        armLocked(watch, deadlineTick(watch.deadlineMs()));
+        watches_.insert(&watch);
+    }
+
+    void disarm(ConnectionWatch& watch) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wheel_.cancel(watch);
+        watches_.erase(&watch);
+    }
+
+    /**
+     * @brief Wakes every session waiting for its next command by shutting
+     * down its receive side, so a drain need not wait out their idle
+     * timeouts. Each answers DRAIN_REPLY and ends. Sessions mid-command
+     * are left alone. Returns how many were woken.
+     */
+    size_t wakeIdle() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t woken = 0;
+        for (ConnectionWatch* watch : watches_) {
+            if (watch->phase.load(std::memory_order_relaxed) != static_cast<int>(SessionPhase::Idle)) continue;
+            shutdownReceive(watch->sock);
+            ++woken;
+        }
+        return woken;
+    }
+
+private:
+    void armLocked(ConnectionWatch& watch, uint64_t tick) {
+        wheel_.schedule(watch, tick);
+        watch.armedTick.store(watch.expiry, std::memory_order_relaxed);
+    }
+
+    void run() {
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(DEADLINE_TICK_MS));
+            std::lock_guard<std::mutex> lock(mutex_);
+            int64_t now = steadyNowMs();
+            wheel_.advance(deadlineTick(now), [&](TimerNode& node) {
+                auto& watch = static_cast<ConnectionWatch&>(node);
+                int64_t deadline = watch.deadlineMs();
+                if (now < deadline) {
+                    armLocked(watch, deadlineTick(deadline)); // Progress since arming
+                    return;
+                }
+                watch.armedTick.store(UINT64_MAX, std::memory_order_relaxed);
+                metrics.connectionsReaped.add();
+                logAt(LogLevel::Warn, "Reaping session: no progress before its deadline.");
+                shutdownSocket(watch.sock);
+            });
+        }
+    }
+
+    std::mutex mutex_;
+    TimerWheel wheel_;
+    std::unordered_set<ConnectionWatch*> watches_;   // Every armed session, for wakeIdle()
+    std::thread thread_;
+};
+
+Reaper& reaper() {
+    static Reaper* instance = new Reaper(); // Never destroyed: its thread runs until exit
+    return *instance;
+}
 
 /**
- * @brief Logs a message to the console with a [SERVER] prefix.
+ * @brief A session's deadlines, registered with the reaper for its lifetime.
  */
-void log(const std::string& message) {
-    std::cout << "[SERVER] " << message << std::endl;
+class SessionDeadline {
+public:
+    explicit SessionDeadline(SocketType sock) : watch_(sock) { reaper().arm(watch_); }
+    ~SessionDeadline() { stop(); }
+
+    SessionDeadline(const SessionDeadline&) = delete;
+    SessionDeadline& operator=(const SessionDeadline&) = delete;
+
+    /**
+     * @brief Records progress: the current phase's deadline restarts.
+     */
+    void touch() { watch_.lastProgressMs.store(steadyNowMs(), std::memory_order_relaxed); }
+
+    /**
+     * @brief Stops watching; call before the socket is closed.
+     */
+    void stop() { reaper().disarm(watch_); }
+
+    /**
+     * @brief Applies new timeouts; shorter ones take effect when the armed
+     * timer next fires.
+     */
+    void configure(const ServerConfig& config) { watch_.setTimeouts(config); }
+
+    void enter(SessionPhase phase) {
+        watch_.phase.store(static_cast<int>(phase), std::memory_order_relaxed);
+        touch();
+        // A later deadline is picked up lazily when the armed timer fires.
+        if (deadlineTick(watch_.deadlineMs()) < watch_.armedTick.load(std::memory_order_relaxed)) {
+            reaper().arm(watch_);
+        }
+    }
+
+private:
+    ConnectionWatch watch_;
+};
+// --- End Connection Deadlines ---
+
+// --- Runtime Configuration ---
+// A configuration is built from the defaults, then the config file, then the
+// command-line overrides, and published whole. SIGHUP (POSIX only) builds it
+// again from the same sources; if the file no longer parses or a value is
+// out of range, the running configuration stays in effect.
+
+struct ConfigSource {
+    std::string path;             // Config file; empty for none
+    bool required = false;        // Named with --config, so it must exist
+    std::vector<std::pair<std::string, std::string>> overrides;  // Command-line settings, applied last
+};
+
+ConfigSource configSource;        // Set in main before any thread starts
+
+bool buildConfig(const ConfigSource& source, ServerConfig& out, std::string& error) {
+    ServerConfig next;
+    std::error_code ec;
+    if (!source.path.empty() && (source.required || std::filesystem::exists(source.path, ec))) {
+        std::vector<ConfigEntry> entries;
+        if (!readConfigFile(source.path, entries, error)) return false;
+        for (const ConfigEntry& entry : entries) {
+            if (!applySetting(next, entry.name, entry.value)) {
+                error = source.path + ":" + std::to_string(entry.line) + ": unknown setting or bad value: " +
+                        entry.name;
+                return false;
+            }
+        }
+    }
+    for (const auto& override : source.overrides) {
+        if (!applySetting(next, override.first, override.second)) {
+            error = "unknown setting or bad value: --" + override.first;
+            return false;
+        }
+    }
+    if (!validateConfig(next, error)) return false;
+    out = std::move(next);
+    return true;
 }
 
 /**
- * @brief "Encrypts" or "Decrypts" data using a simple XOR cipher.
- * This is NOT secure and is for educational purposes only.
+ * @brief The configuration as a config file would write it.
  */
-std::string encryptDecrypt(const std::string& data) {
-    std::string result = data;
-    for (size_t i = 0; i < data.size(); ++i) {
-        result[i] = data[i] ^ ENCRYPTION_KEY[i % ENCRYPTION_KEY.size()];
+std::string formatConfig(const ServerConfig& config) {
+    std::string out;
+    for (bool reloadable : {true, false}) {
+        if (!reloadable) out += "# Read at startup only; SIGHUP leaves these as they are\n";
+        for (const Setting& entry : SETTINGS) {
+            if (entry.reloadable == reloadable) out += std::string(entry.name) + " = " + entry.format(config) + "\n";
+        }
     }
-    return result;
+    for (const auto& rate : config.userRateOverrides) {
+        out += USER_RATE_PREFIX + rate.first + " = " + std::to_string(rate.second) + "\n";
+    }
+    for (const auto& weight : config.userWeights) {
+        out += USER_WEIGHT_PREFIX + weight.first + " = " + std::to_string(weight.second) + "\n";
+    }
+    return out;
 }
 
 /**
- * @brief Sends a response (string) to the client, with encryption.
+ * @brief Rebuilds the configuration from configSource and publishes it.
+ * Restart-only settings keep their running values.
  */
-bool sendResponse(SocketType clientSocket, const std::string& response) {
-    std::string encryptedResponse = encryptDecrypt(response);
-    int bytesSent = send(clientSocket, encryptedResponse.c_str(), encryptedResponse.length(), 0);
-    return bytesSent > 0;
+void reloadConfig() {
+    auto next = std::make_shared<ServerConfig>();
+    std::string error;
+    if (!buildConfig(configSource, *next, error)) {
+        metrics.configReloadFailures.add();
+        logAt(LogLevel::Error, "Keeping the running configuration: " + error);
+        return;
+    }
+    refreshConfig();
+    const ServerConfig& running = config();
+    for (const Setting& entry : SETTINGS) {
+        if (entry.reloadable || entry.format(*next) == entry.format(running)) continue;
+        logAt(LogLevel::Warn, std::string(entry.name) + " takes effect after a restart; keeping " +
+              entry.format(running) + ".");
+        entry.copy(*next, running);
+    }
+    std::shared_ptr<const ServerConfig> published = next;
+    publishConfig(published);
+    applyRateLimits(*published);
+    metrics.configReloads.add();
+    log("Configuration reloaded (generation " + std::to_string(configGeneration.load()) + ").");
+}
+
+// --- End Runtime Configuration ---
+
+// --- Graceful Shutdown ---
+// SIGTERM or SIGINT starts a drain. The accept loop stops and connections
+// still queued for a session slot are answered BUSY. Sessions mid-command
+// finish it first. A session's next command is answered DRAIN_REPLY instead
+// of being run, and the session ends; the client reconnects, with RESUME,
+// to whichever server is accepting. Sessions still waiting for a command
+// after drain_grace_sec are woken to send DRAIN_REPLY unasked, so a client
+// reads it as the reply to whatever it sends next, or to a command already
+// on its way. The process exits when the last session has ended or
+// drain_timeout_sec has passed, whichever is first. A second signal exits
+// at once.
+//
+// To upgrade, start the new binary with --takeover while this one runs. It
+// takes the listening sockets over handoff_socket (libfileshare/handoff.h)
+// and is accepting before this process starts to drain, so no connection
+// is refused and running downloads finish here.
+
+const int HANDOFF_TIMEOUT_MS = 60000;     // For either side to answer; the successor loads its index first
+const char* const DRAIN_REPLY = "BUSY retry-after 0";
+
+std::atomic<const char*> drainReason{nullptr};
+
+/**
+ * @brief Starts draining. False if a drain had already begun.
+ */
+bool beginDrain(const char* reason) {
+    if (metrics.draining.exchange(true)) return false;
+    drainReason.store(reason);
+    return true;
+}
+
+/**
+ * @brief Waits for every session to end, waking sessions still idle after
+ * drain_grace_sec, until drain_timeout_sec has passed. True if they all ended. Called by the
+ * accept thread once it has stopped, so the drain logs in order.
+ */
+bool drainSessions() {
+    refreshConfig();
+    const char* reason = drainReason.load();
+    log(std::string("Draining (") + (reason ? reason : "stopped") + "): no new sessions; transfers in flight get " +
+        "up to " + std::to_string(config().drainTimeoutSec) + " s to finish.");
+    auto graceEnd = std::chrono::steady_clock::now() + std::chrono::seconds(config().drainGraceSec);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(config().drainTimeoutSec);
+    while (metrics.sessionThreads.load() > 0) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            logAt(LogLevel::Warn, std::to_string(metrics.sessionThreads.load()) +
+                  " session(s) still running at the drain deadline; exiting anyway.");
+            return false;
+        }
+        if (now >= graceEnd) reaper().wakeIdle();
+        std::this_thread::sleep_for(std::chrono::milliseconds(DEADLINE_TICK_MS));
+    }
+    log("Drained: every session has ended.");
+    return true;
+}
+
+/**
+ * @brief Hands sockets (the service listener, then the metrics listener if
+ * any) to the first successor that asks for them and confirms, then
+ * drains. Stops if a drain starts some other way.
+ */
+void handoffLoop(SocketType listener, std::vector<SocketType> sockets) {
+    while (!metrics.draining.load()) {
+        if (!waitReadable(listener, ACCEPT_POLL_MS)) continue;
+        SocketType channel = acceptHandoff(listener);
+        if (channel == INVALID_SOCKET_HANDLE) continue;
+        bool taken = sendSockets(channel, sockets) && receiveHandoffAck(channel, HANDOFF_TIMEOUT_MS);
+        CLOSE_SOCKET(channel);
+        if (!taken) {
+            logAt(LogLevel::Warn, "A successor asked for the listening sockets but did not take over; still serving.");
+            continue;
+        }
+        metrics.handedOff.store(true);
+        beginDrain("a new server took over");
+    }
+    CLOSE_SOCKET(listener);           // Not unlinked: after a hand-off the path is the successor's
+}
+
+/**
+ * @brief Takes the listening sockets of the server at handoff_socket.
+ * Returns false if it refused; sockets stays empty if no server was there.
+ */
+bool takeOver(SocketType& channel, std::vector<SocketType>& sockets) {
+    channel = connectHandoff(config().handoffSocket);
+    if (channel == INVALID_SOCKET_HANDLE) return true;
+    if (receiveSockets(channel, sockets, HANDOFF_TIMEOUT_MS)) return true;
+    CLOSE_SOCKET(channel);
+    channel = INVALID_SOCKET_HANDLE;
+    return false;
+}
+// --- End Graceful Shutdown ---
+
+// --- Signals ---
+// POSIX signals are taken synchronously by one thread with sigwait(), so
+// handling them can log, allocate and lock like any other code. Windows
+// has no SIGHUP or SIGTERM: there the config file is read at startup only
+// and the server is stopped the ordinary way.
+
+#ifndef _WIN32
+sigset_t serverSignals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    return signals;
+}
+
+/**
+ * @brief Blocks the server's signals in this thread and every thread it
+ * starts later, so only signalLoop() receives them. Call first in main.
+ */
+void blockServerSignals() {
+    sigset_t signals = serverSignals();
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+}
+
+void signalLoop() {
+    sigset_t signals = serverSignals();
+    while (true) {
+        int received = 0;
+        if (sigwait(&signals, &received) != 0) continue;
+        if (received == SIGHUP) {
+            reloadConfig();
+        } else if (!beginDrain(received == SIGINT ? "SIGINT" : "SIGTERM")) {
+            logAt(LogLevel::Warn, "Signalled again while draining; exiting now.");
+            logger().stop();
+            std::_Exit(1);
+        }
+    }
+}
+#endif
+// --- End Signals ---
+
+/**
+ * @brief A file's digest with its Merkle leaves: from the index if it has
+ * them for this version of the file, otherwise read once and, for the
+ * current version, cached there.
+ */
+bool loadTree(const std::string& name, const std::string& path, bool isVersion, FileDigest& digest) {
+    FileStat stat;
+    if (!statFile(path, stat)) return false;
+    if (fileIndex().lookup(name, stat, digest) && digest.hasTree) return true;
+    if (!digestFile(path, digest, 0, true)) return false;
+    metrics.treesBuilt.add();
+    if (!isVersion) fileIndex().store(name, digest);   // Index entries describe current versions only
+    return true;
+}
+
+/**
+ * @brief Builds the LIST response: up to limit names after `after`, from
+ * the catalog, so a page costs O(page) however large the directory is. A
+ * full page ends with the command that fetches the next one.
+ */
+std::string buildFileList(std::string_view after, size_t limit) {
+    std::string fileList = "Files on server:\n";
+    std::vector<std::string> page = fileCatalog().list(after, limit);
+    for (const std::string& name : page) fileList += name + "\n";
+    if (!page.empty() && page.size() == limit) {
+        fileList += "More: LIST " + std::to_string(limit) + " " + page.back() + "\n";
+    }
+    return fileList;
 }
 
 /**
- * @brief Receives a command from the client, with decryption.
+ * @brief Builds the VERSIONS response, oldest first.
  */
-std::string receiveCommand(SocketType clientSocket) {
-    char buffer[BUFFER_SIZE] = {0};
-    int bytesReceived = recv(clientSocket, buffer, BUFFER_SIZE, 0);
-    if (bytesReceived <= 0) {
-        return ""; // Connection closed or error
+std::string buildVersionList(const std::string& name) {
+    std::vector<VersionInfo> kept = fileCatalog().versions(name);
+    FileStat current;
+    bool haveCurrent = statFile(config().filesDir + "/" + name, current);
+    // A restore shares its inode with the version it came from; the newer one is current.
+    size_t currentIndex = kept.size();
+    for (size_t i = 0; haveCurrent && i < kept.size(); ++i) {
+        if (kept[i].inode == current.inode) currentIndex = i;
+    }
+    std::string out = "Versions of " + name + ":\n";
+    char line[128];
+    for (size_t i = 0; i < kept.size(); ++i) {
+        std::snprintf(line, sizeof(line), "%" PRIu64 " size=%" PRIu64 " modified=%" PRId64 "%s\n", kept[i].version,
+                      kept[i].size, kept[i].mtimeNs / 1000000000, i == currentIndex ? " current" : "");
+        out += line;
     }
-    return encryptDecrypt(std::string(buffer, bytesReceived));
+    return out;
 }
 
 /**
  * @brief Handles a single client connection.
  * @param clientSocket The socket for the connected client.
+ * @param clientAddr The client's address, as used for admission limits.
  */
-void handle_client(SocketType clientSocket) {
-    std::string clientAddr = "Unknown"; // In a real app, get this from accept()
-    log("New client connected.");
+void handle_client(SocketType clientSocket, const std::string& clientAddr) {
+    refreshConfig();
+    // The session keeps the key it started with: the client ciphers with it
+    // and STARTTLS salts with it, whatever a reload changes meanwhile.
+    const std::string sessionKey = config().encryptionKey;
+    const TuningProfile* tuning = config().tuning;
+    Connection conn(clientSocket, sessionKey);
+    if (logEnabled(LogLevel::Info)) log("New client connected from " + clientAddr + ".");
+    metrics.connectionsTotal.add();
+    metrics.activeConnections.fetch_add(1);
+    setKeepalive(clientSocket, static_cast<int>(config().keepaliveIdleSec),
+                 static_cast<int>(config().keepaliveIntervalSec), static_cast<int>(config().keepaliveProbes));
+    TuningResult tuned = applyTuningProfile(clientSocket, *tuning);
+    if (config().zeroCopyThreshold > 0 && !conn.enableZeroCopy(config().zeroCopyThreshold)) {
+        logAt(LogLevel::Debug, "MSG_ZEROCOPY unavailable; using copying sends.");
+    }
+    if (logEnabled(LogLevel::Debug)) {
+        logAt(LogLevel::Debug, std::string("Tuning '") + tuning->name + "': rtt=" +
+              std::to_string(tuned.rttUs) + "us sndbuf=" + std::to_string(tuned.sendBuffer) +
+              " rcvbuf=" + std::to_string(tuned.recvBuffer) + " cc=" +
+              (tuned.congestionSet ? tuning->congestion : "default"));
+    }
+    SessionDeadline deadline(clientSocket);
 
     bool isAuthenticated = false;
+    std::string sessionUser;            // Holds a per-user session slot once set
+    TransferShaper shaper;
+    uint32_t weight = 1;
+    std::string cmd;
+    std::string reply;
 
     try {
         while (true) {
-            std::string cmd = receiveCommand(clientSocket);
-            if (cmd.empty()) {
-                log("Client disconnected abruptly.");
+            deadline.enter(SessionPhase::Idle);
+            bool received = receiveCommand(conn, cmd);
+            if (metrics.draining.load()) {   // Instead of the command, or after wakeIdle()
+                deadline.enter(SessionPhase::Writing);
+                sendResponse(conn, DRAIN_REPLY);
                 break;
             }
+            if (!received) {
+                logAt(LogLevel::Warn, "Client disconnected abruptly.");
+                break;
+            }
+            deadline.enter(SessionPhase::Writing);
+            // Between commands is this session's point to pick up a reload.
+            if (refreshConfig()) {
+                shaper.configure(config());
+                deadline.configure(config());
+                if (isAuthenticated) weight = userWeight(sessionUser);
+            }
+            const ServerConfig& settings = config();
+
+            auto commandStart = std::chrono::steady_clock::now();
+            CommandView parsed = tokenizeCommand(cmd);
+            const Verb command = parsed.verb;
+            CommandKind kind = commandKind(command);
+            metrics.commands[kind].add();
+            // Never echo AUTH or RESUME (they carry credentials) or oversized payloads.
+            if (command != Verb::Auth && command != Verb::Resume && logEnabled(LogLevel::Debug)) {
+                logAt(LogLevel::Debug, "Received command: " + cmd.substr(0, 128));
+            }
 
-            log("Received command: " + cmd);
-            std::stringstream ss(cmd);
-            std::string command;
-            ss >> command;
+            if (command == Verb::Ping) { // Liveness probe, answered even before AUTH
+                sendResponse(conn, "PONG");
+                metrics.commandLatencyUs[kind].record(elapsedUs(commandStart));
+                continue;
+            }
 
             if (!isAuthenticated) {
-                if (command == "AUTH") {
-                    std::string user, pass;
-                    ss >> user >> pass;
-                    if (VALID_USERS.count(user) && VALID_USERS[user] == pass) {
-                        isAuthenticated = true;
-                        sendResponse(clientSocket, "AUTH_SUCCESS");
-                        log("User '" + user + "' authenticated.");
+                // Takes a per-user session slot; false (after answering BUSY) if none is left.
+                auto beginSession = [&](std::string_view user) {
+                    if (!acquireUserSession(user)) {
+                        metrics.connectionsRejected.add();
+                        sendResponse(conn, busyReply());
+                        if (logEnabled(LogLevel::Warn)) {
+                            logAt(LogLevel::Warn, "Session limit reached for user '" + std::string(user) + "'.");
+                        }
+                        return false;
+                    }
+                    sessionUser = std::string(user);
+                    isAuthenticated = true;
+                    shaper.setUser(user);
+                    weight = userWeight(user);
+                    return true;
+                };
+                if (command == Verb::Auth) {
+                    std::string_view user = parsed.arg(0), pass = parsed.arg(1);
+                    AuthResult result = credentials().verify(user, pass);
+                    if (result == AuthResult::Busy) {
+                        metrics.connectionsRejected.add();
+                        sendResponse(conn, busyReply());
+                        if (logEnabled(LogLevel::Warn)) {
+                            logAt(LogLevel::Warn, "Password hash queue full; shed AUTH from " + clientAddr + ".");
+                        }
+                        break;
+                    }
+                    if (result == AuthResult::Accepted) {
+                        if (!beginSession(user)) break;
+                        // AUTH_SUCCESS [ticket]: the ticket is absent if no key could be loaded.
+                        std::string binding, ticket;
+                        if (credentials().ticketBinding(user, binding)) {
+                            ticket = sessionTickets().issue(user, binding, unixNow() + settings.ticketLifetimeSec);
+                        }
+                        sendResponse(conn, ticket.empty() ? "AUTH_SUCCESS" : "AUTH_SUCCESS " + ticket);
+                        if (logEnabled(LogLevel::Info)) log("User '" + std::string(user) + "' authenticated.");
+                    } else {
+                        sendResponse(conn, "AUTH_FAIL");
+                        if (logEnabled(LogLevel::Warn)) {
+                            logAt(LogLevel::Warn, "Failed auth attempt for user '" + std::string(user) + "'.");
+                        }
+                    }
+                } else if (command == Verb::Resume) {
+                    // RESUME <ticket>: checked with the key and the user's current credential line,
+                    // so a removed user or a changed password fails. No password hash is computed.
+                    std::string user, binding;
+                    if (SessionTickets::claimedUser(parsed.arg(0), user) && credentials().ticketBinding(user, binding) &&
+                        sessionTickets().verify(parsed.arg(0), binding, unixNow())) {
+                        if (!beginSession(user)) break;
+                        metrics.sessionsResumed.add();
+                        sendResponse(conn, "RESUMED");
+                        if (logEnabled(LogLevel::Debug)) logAt(LogLevel::Debug, "User '" + user + "' resumed a session.");
                     } else {
-                        sendResponse(clientSocket, "AUTH_FAIL");
-                        log("Failed auth attempt for user '" + user + "'.");
+                        metrics.resumesRejected.add();
+                        sendResponse(conn, "RESUME_FAIL");
+                        if (logEnabled(LogLevel::Warn)) {
+                            logAt(LogLevel::Warn, "Rejected session ticket from " + clientAddr + ".");
+                        }
                     }
                 } else {
-                    sendResponse(clientSocket, "ERROR Authentication required.");
+                    sendResponse(conn, "ERROR Authentication required.");
                 }
+                metrics.commandLatencyUs[kind].record(elapsedUs(commandStart));
                 continue;
             }
 
             // --- Authenticated Commands ---
 
-            if (command == "LIST") {
-                std::string fileList = "Files on server:\n";
-                for (const auto& entry : std::filesystem::directory_iterator(SERVER_FILES_DIR)) {
-                    fileList += entry.path().filename().string() + "\n";
+            if (command == Verb::List) {
+                // LIST [limit [after]]: names in byte order, a page at a time.
+                size_t limit = SIZE_MAX;
+                if (parsed.argCount > 0 && (!parseNumber(parsed.arg(0), limit) || limit == 0)) {
+                    sendResponse(conn, "ERROR Invalid page size.");
+                    continue;
                 }
-                sendResponse(clientSocket, fileList);
+                sendResponse(conn, buildFileList(parsed.arg(1), limit));
 
-            } else if (command == "DOWNLOAD") {
-                std::string filename;
-                ss >> filename;
-                std::string filepath = std::string(SERVER_FILES_DIR) + "/" + filename;
+            } else if (command == Verb::Download || command == Verb::Range) {
+                // DOWNLOAD <file> <window> [crc32c]
+                // RANGE <file> <offset> <length> <window> [crc32c] sends part of a
+                // file, e.g. a chunk whose checksum did not match on the client.
+                // The window is the client's initial credit. <file> may name a
+                // kept version as <name>@<version>.
+                bool isRange = command == Verb::Range;
+                size_t windowArg = isRange ? 3 : 1;
+                std::string filename(parsed.arg(0));
+                std::string filepath;
+                bool isVersion = false;
+                if (!resolveServedFile(filename, filepath, isVersion)) {
+                    sendResponse(conn, isVersion ? "ERROR Version not found." : "ERROR Invalid file name.");
+                    continue;
+                }
+                uint64_t window = 0;
+                if (!parseNumber(parsed.arg(windowArg), window) || window == 0) {
+                    sendResponse(conn, "ERROR Missing or invalid window.");
+                    continue;
+                }
+                uint64_t rangeOffset = 0, rangeLength = 0;
+                if (isRange && (!parseNumber(parsed.arg(1), rangeOffset) || !parseNumber(parsed.arg(2), rangeLength))) {
+                    sendResponse(conn, "ERROR Invalid range.");
+                    continue;
+                }
+                bool checksums = parsed.arg(windowArg + 1) == CHECKSUM_NAME;
 
+                FileStat expected;                     // What file was opened as; see pages below
+                bool haveExpected = statFile(filepath, expected);
                 std::ifstream file(filepath, std::ios::binary | std::ios::ate);
                 if (file.is_open()) {
-                    std::streamsize size = file.tellg();
-                    file.seekg(0, std::ios::beg);
-                    
-                    // 1. Send OK and file size
-                    sendResponse(clientSocket, "OK_DOWNLOAD " + std::to_string(size));
-
-                    // 2. Wait for client readiness (expect "START")
-                    if (receiveCommand(clientSocket) != "START") {
-                        log("Client did not start transfer.");
+                    uint64_t size = static_cast<uint64_t>(file.tellg());
+                    if (!isRange) rangeLength = size;
+                    if (rangeOffset > size || rangeLength > size - rangeOffset) {
+                        sendResponse(conn, "ERROR Invalid range.");
                         continue;
                     }
+                    file.seekg(rangeOffset, std::ios::beg);
+                    if (isRange) metrics.rangesServed.add();
+
+                    // 1. Send OK and the byte count; data follows immediately.
+                    // Corking lets the reply share a segment with the first data.
+                    bool corked = tuning->cork;
+                    if (corked) setCork(clientSocket, true);
+                    sendResponse(conn, (isRange ? "OK_RANGE " : "OK_DOWNLOAD ") + std::to_string(rangeLength));
 
-                    // 3. Send file data in chunks
-                    char fileBuffer[BUFFER_SIZE];
-                    while (file.read(fileBuffer, sizeof(fileBuffer)) || file.gcount() > 0) {
-                        std::string chunk(fileBuffer, file.gcount());
-                        sendResponse(clientSocket, chunk); // Send encrypted chunk
+                    // 2. Send file data in chunks, never exceeding the client's credit
+                    auto transferStart = std::chrono::steady_clock::now();
+                    bool firstChunk = true;
+                    bool streamOk = true;
+                    SendCredit credit(std::min(window, MAX_TRANSFER_WINDOW));
+                    FairScheduler::Flow flow(weight);
+                    // With kTLS the kernel encrypts, so pages can leave the cache
+                    // untouched; checksums then read them through a mapping.
+                    std::optional<FileSource> pages;
+                    const char* mapped = nullptr;
+                    if (conn.canSendFile() && settings.ioBackend == IoBackend::Auto) {
+                        // The name is reopened, and an upload may have replaced it
+                        // since: only send pages of the version file has open. A
+                        // restore can bring an inode back, but linking it changes
+                        // its ctime, so inode and ctime together identify it.
+                        pages.emplace(filepath);
+                        FileStat opened;
+                        if (!haveExpected || !pages->isOpen() || !statOpenFile(pages->fd(), opened) ||
+                            !(opened == expected) || opened.ctimeNs != expected.ctimeNs) {
+                            pages.reset();
+                        } else if (checksums && rangeLength > 0 && !(mapped = pages->map())) {
+                            pages.reset();
+                        }
+                    }
+                    uint32_t rangeCrc = 0;
+                    std::string crcFrame;
+                    uint64_t remaining = rangeLength;
+                    while (remaining > 0) {
+                        uint64_t allowed = credit.allowance(settings.chunkSize, remaining);
+                        if (allowed == 0) {
+                            if (corked) { // Flush the partial segment the client is waiting for
+                                setCork(clientSocket, false);
+                                setCork(clientSocket, true);
+                            }
+                            deadline.enter(SessionPhase::Reading);
+                            if (!receiveCredit(conn, reply, credit)) {
+                                streamOk = false;
+                                break;
+                            }
+                            deadline.enter(SessionPhase::Writing);
+                            continue;
+                        }
+                        // Each chunk carries its CRC frame in the same write; without
+                        // checksums the last one carries DOWNLOAD_DONE instead.
+                        const std::string* trailer = checksums ? &crcFrame
+                                                   : allowed == remaining ? &DOWNLOAD_DONE : nullptr;
+                        auto checksum = [&](const char* data) {
+                            uint32_t crc = crc32c(0, data, allowed);
+                            formatCrcFrame(crc, crcFrame);
+                            rangeCrc = crc32cCombine(rangeCrc, crc, allowed);
+                        };
+                        bool sent;
+                        if (pages && pages->isOpen()) {
+                            uint64_t offset = rangeOffset + (rangeLength - remaining);
+                            if (checksums) checksum(mapped + offset);
+                            shaper.throttle(allowed);
+                            sent = sendScheduled(conn, flow, allowed, [&] {
+                                return sendFileChunk(conn, *pages, offset, allowed, trailer);
+                            });
+                        } else {
+                            // A fresh block per chunk: a zero-copy send may still own the last one.
+                            Buffer chunk = Buffer::acquire();
+                            if (!file.read(chunk.data(), allowed)) {
+                                streamOk = false;
+                                break;
+                            }
+                            chunk.setSize(allowed);
+                            if (checksums) checksum(chunk.data());
+                            shaper.throttle(allowed);
+                            sent = sendScheduled(conn, flow, allowed, [&] {
+                                return sendChunk(conn, chunk, trailer); // Ciphers and sends in place
+                            });
+                        }
+                        if (!sent) {
+                            streamOk = false;
+                            break;
+                        }
+                        deadline.touch();
+                        credit.consume(allowed);
+                        remaining -= allowed;
+                        if (firstChunk) {
+                            metrics.downloadTtfbUs.record(elapsedUs(commandStart));
+                            firstChunk = false;
+                        }
                     }
                     file.close();
-                    log("Finished sending " + filename);
-                    sendResponse(clientSocket, "DOWNLOAD_DONE"); // Send final chunk
+                    if (!streamOk) {
+                        // The stream position is unknown; the session cannot continue.
+                        if (logEnabled(LogLevel::Warn)) logAt(LogLevel::Warn, "Download of " + filename + " aborted.");
+                        break;
+                    }
+                    recordTransfer(0, rangeLength, transferStart);
+                    if (logEnabled(LogLevel::Info)) log("Finished sending " + filename + (isRange ? " (range)" : ""));
+                    if (checksums) {
+                        sendResponse(conn, DOWNLOAD_DONE + " " + crcToHex(rangeCrc));
+                    } else if (rangeLength == 0) {
+                        sendResponse(conn, DOWNLOAD_DONE); // Otherwise sent with the last chunk
+                    }
+                    if (corked) setCork(clientSocket, false);
 
                 } else {
-                    sendResponse(clientSocket, "ERROR File not found.");
+                    sendResponse(conn, "ERROR File not found.");
                 }
 
-            } else if (command == "UPLOAD") {
-                std::string filename;
-                long long fileSize;
-                ss >> filename >> fileSize;
-                
-                std::string filepath = std::string(SERVER_FILES_DIR) + "/" + filename;
-                std::ofstream outFile(filepath, std::ios::binary);
-                
+            } else if (command == Verb::Upload) {
+                // UPLOAD <file> <size> [crc32c]: with checksums every chunk is
+                // followed by its CRC frame, and damaged chunks are asked for again.
+                std::string filename(parsed.arg(0));
+                if (!isServedName(filename)) {
+                    sendResponse(conn, "ERROR Invalid file name.");
+                    continue;
+                }
+                long long fileSize = 0;
+                if (!parseNumber(parsed.arg(1), fileSize) || fileSize < 0) {
+                    sendResponse(conn, "ERROR Invalid file size.");
+                    continue;
+                }
+                bool checksums = parsed.arg(2) == CHECKSUM_NAME;
+
+                std::string filepath = settings.filesDir + "/" + filename;
+                PathLock writeLock(uploadLocks(), filename);
+                if (!writeLock.owns()) {
+                    sendResponse(conn, "ERROR File is being uploaded by another session.");
+                    continue;
+                }
+                PendingUpload pending(settings.filesDir);
+                std::ofstream outFile(pending.path(), std::ios::binary);
+
                 if (!outFile.is_open()) {
-                    sendResponse(clientSocket, "ERROR Cannot create file.");
+                    sendResponse(conn, "ERROR Cannot create file.");
                     continue;
                 }
                 
-                // 1. Send OK to start transfer
-                sendResponse(clientSocket, "OK_UPLOAD");
-                
-                // 2. Receive file data
+                // 1. Send OK with the window the client may fill before an ACK
+                sendResponse(conn, "OK_UPLOAD " + std::to_string(settings.uploadWindow));
+
+                // 2. Receive file data, returning credit as it is written out
+                deadline.enter(SessionPhase::Reading);
+                auto transferStart = std::chrono::steady_clock::now();
                 long long bytesReceived = 0;
+                ReceiveWindow receiveWindow(settings.uploadWindow, fileSize);
+                Buffer chunk = Buffer::acquire();
+                bool streamOk = true;
+                uint32_t fileCrc = 0;                  // Built from the sender's chunk CRCs
+                std::vector<ChunkChecksum> damaged;
+                DigestBuilder indexDigest;             // Index entry, built as the data passes
                 while (bytesReceived < fileSize) {
-                    std::string chunk = receiveCommand(clientSocket);
-                    if (chunk.empty()) {
-                        log("Upload failed: Client disconnected.");
+                    uint32_t crc = 0;
+                    ChunkStatus status = checksums ? receiveCheckedChunk(conn, chunk, reply, crc)
+                                                   : receiveChunk(conn, chunk) ? ChunkStatus::Ok : ChunkStatus::Lost;
+                    if (status == ChunkStatus::Lost) {
+                        logAt(LogLevel::Warn, "Upload failed: Client disconnected.");
+                        streamOk = false;
                         break;
                     }
-                    outFile.write(chunk.c_str(), chunk.length());
-                    bytesReceived += chunk.length();
+                    if (static_cast<long long>(chunk.size()) > fileSize - bytesReceived) {
+                        logAt(LogLevel::Warn, "Upload failed: Client sent more than announced.");
+                        streamOk = false;
+                        break;
+                    }
+                    if (status == ChunkStatus::Damaged) {
+                        metrics.checksumMismatches.add();
+                        damaged.push_back({static_cast<uint64_t>(bytesReceived), chunk.size(), crc});
+                    }
+                    if (checksums) fileCrc = crc32cCombine(fileCrc, crc, chunk.size());
+                    deadline.touch();
+                    // Delaying the write also delays the credit, which slows the sender.
+                    shaper.throttle(chunk.size());
+                    outFile.write(chunk.data(), chunk.size());
+                    if (fileIndex().isOpen()) indexDigest.update(chunk.data(), chunk.size());
+                    bytesReceived += chunk.size();
+                    uint64_t grant = receiveWindow.consume(chunk.size());
+                    if (grant > 0 && !sendCredit(conn, grant)) {
+                        streamOk = false;
+                        break;
+                    }
+                }
+
+                // 3. Ask for damaged chunks again; "RESEND <offset> <length>" is
+                // also the credit for them. The repair must hash to the CRC that
+                // was sent with the original, or the file-wide CRC would not hold.
+                bool repaired = true;
+                for (const ChunkChecksum& bad : damaged) {
+                    bool fixed = false;
+                    for (uint64_t attempt = 0; streamOk && !fixed && attempt < settings.maxRepairAttempts; ++attempt) {
+                        metrics.repairRequests.add();
+                        sendResponse(conn, "RESEND " + std::to_string(bad.offset) + " " + std::to_string(bad.length));
+                        uint64_t got = 0;
+                        uint32_t rangeCrc = 0;
+                        bool clean = true;
+                        while (got < bad.length) {
+                            uint32_t crc = 0;
+                            ChunkStatus status = receiveCheckedChunk(conn, chunk, reply, crc);
+                            if (status == ChunkStatus::Lost || chunk.size() > bad.length - got) {
+                                streamOk = false;
+                                break;
+                            }
+                            if (status == ChunkStatus::Damaged) clean = false;
+                            outFile.seekp(bad.offset + got, std::ios::beg);
+                            outFile.write(chunk.data(), chunk.size());
+                            rangeCrc = crc32cCombine(rangeCrc, crc, chunk.size());
+                            got += chunk.size();
+                            deadline.touch();
+                        }
+                        fixed = streamOk && clean && rangeCrc == bad.crc;
+                    }
+                    if (!fixed) repaired = false;
                 }
                 outFile.close();
+                if (!streamOk) {
+                    if (logEnabled(LogLevel::Warn)) {
+                        logAt(LogLevel::Warn, "Upload failed for " + filename + ". Incomplete data.");
+                    }
+                    break;
+                }
                 
-                if (bytesReceived == fileSize) {
-                    log("Successfully received " + filename);
-                    sendResponse(clientSocket, "UPLOAD_SUCCESS");
+                uint64_t version = 0;
+                if (bytesReceived == fileSize && repaired && !outFile) {
+                    logAt(LogLevel::Error, "Upload of " + filename + " could not be written.");
+                    sendResponse(conn, "ERROR Cannot create file.");
+                } else if (bytesReceived == fileSize && repaired && (version = pending.publish(filename)) == 0) {
+                    logAt(LogLevel::Error, "Upload of " + filename + " could not be published.");
+                    sendResponse(conn, "ERROR Cannot create file.");
+                } else if (bytesReceived == fileSize && repaired) {
+                    recordTransfer(1, fileSize, transferStart);
+                    if (fileIndex().isOpen()) {
+                        // Repaired chunks were overwritten after being digested: read the file back.
+                        FileDigest digest;
+                        bool built = damaged.empty() ? (indexDigest.finish(digest), statFile(filepath, digest.stat))
+                                                     : digestFile(filepath, digest);
+                        if (built) fileIndex().store(filename, digest);
+                    }
+                    if (logEnabled(LogLevel::Info)) {
+                        log("Successfully received " + filename + " (version " + std::to_string(version) + ")");
+                    }
+                    // The client compares the CRC with its own to confirm the whole file.
+                    sendResponse(conn, checksums ? "UPLOAD_SUCCESS " + crcToHex(fileCrc) : "UPLOAD_SUCCESS");
+                } else if (!repaired) {
+                    if (logEnabled(LogLevel::Warn)) {
+                        logAt(LogLevel::Warn, "Upload of " + filename + " failed its checksum.");
+                    }
+                    sendResponse(conn, "ERROR Checksum mismatch.");
                 } else {
-                    log("Upload failed for " + filename + ". Incomplete data.");
-                    sendResponse(clientSocket, "ERROR Upload incomplete.");
+                    if (logEnabled(LogLevel::Warn)) {
+                        logAt(LogLevel::Warn, "Upload failed for " + filename + ". Incomplete data.");
+                    }
+                    sendResponse(conn, "ERROR Upload incomplete.");
+                }
+
+            } else if (command == Verb::Tree) {
+                // TREE <file> [first leaf]: the file's Merkle tree (merkle.h), at
+                // most TREE_LEAVES_PER_REPLY leaves per reply. Clients then fetch
+                // segments with RANGE and check every block against its leaf.
+                std::string filename(parsed.arg(0));
+                std::string filepath;
+                bool isVersion = false;
+                uint64_t first = 0;
+                if (!resolveServedFile(filename, filepath, isVersion)) {
+                    sendResponse(conn, isVersion ? "ERROR Version not found." : "ERROR Invalid file name.");
+                    continue;
+                }
+                if (parsed.argCount > 1 && !parseNumber(parsed.arg(1), first)) {
+                    sendResponse(conn, "ERROR Invalid range.");
+                    continue;
+                }
+                FileDigest digest;
+                std::string_view name = filename;
+                uint64_t ignored = 0;
+                if (isVersion) parseVersionSpec(filename, name, ignored);
+                if (!loadTree(std::string(name), filepath, isVersion, digest)) {
+                    sendResponse(conn, "ERROR File not found.");
+                    continue;
+                }
+                if (first > digest.leaves.size()) {
+                    sendResponse(conn, "ERROR Invalid range.");
+                    continue;
+                }
+                TreeInfo info;
+                info.size = digest.stat.size;
+                info.blockSize = INDEX_BLOCK_SIZE;
+                info.leafCount = digest.leaves.size();
+                info.root = merkleRoot(digest.leaves);
+                formatTreeReply(info, digest.leaves, static_cast<size_t>(first), reply);
+                sendResponse(conn, reply);
+                metrics.treesServed.add();
+
+            } else if (command == Verb::Versions) {
+                // VERSIONS <file>: the kept versions, oldest first.
+                std::string filename(parsed.arg(0));
+                if (!isServedName(filename)) {
+                    sendResponse(conn, "ERROR Invalid file name.");
+                    continue;
+                }
+                sendResponse(conn, buildVersionList(filename));
+
+            } else if (command == Verb::Restore) {
+                // RESTORE <file> <version>: makes a kept version current again,
+                // as a new version, by linking rather than copying it.
+                std::string filename(parsed.arg(0));
+                uint64_t version = 0;
+                if (!isServedName(filename) || !parseNumber(parsed.arg(1), version)) {
+                    sendResponse(conn, "ERROR Invalid file name or version.");
+                    continue;
+                }
+                PathLock writeLock(uploadLocks(), filename);
+                if (!writeLock.owns()) {
+                    sendResponse(conn, "ERROR File is being uploaded by another session.");
+                    continue;
+                }
+                PendingUpload pending(settings.filesDir);
+                uint64_t restored = pending.restore(filename, version);
+                if (restored == 0) {
+                    sendResponse(conn, "ERROR Version not found.");
+                    continue;
+                }
+                if (logEnabled(LogLevel::Info)) {
+                    log("Restored " + filename + " version " + std::to_string(version) + " as version " +
+                        std::to_string(restored));
+                }
+                sendResponse(conn, "RESTORED " + filename + " " + std::to_string(restored));
+
+            } else if (command == Verb::StartTls) {
+                // STARTTLS <client key share>: answer with ours under the old
+                // cipher, then both sides switch to TLS records.
+                KeyShare share;
+                TrafficKeys tx, rx;
+                if (!settings.startTls || conn.isSecure()) {
+                    sendResponse(conn, "ERROR STARTTLS not available.");
+                    continue;
+                }
+                if (!share.valid() || !share.deriveTrafficKeys(parsed.arg(0), sessionKey, true, tx, rx)) {
+                    sendResponse(conn, "ERROR Invalid key share.");
+                    continue;
+                }
+                sendResponse(conn, "OK_STARTTLS " + share.publicKeyHex());
+                if (!conn.startSecure(tx, rx)) {
+                    logAt(LogLevel::Warn, "STARTTLS failed; closing the session.");
+                    break;
                 }
+                metrics.secureSessions.add();
+                if (conn.kernelTx()) metrics.kernelTlsSessions.add();
+                if (logEnabled(LogLevel::Debug)) {
+                    logAt(LogLevel::Debug, std::string("STARTTLS: records sealed in ") +
+                          (conn.kernelTx() ? "kernel" : "user space") + ", opened in " +
+                          (conn.kernelRx() ? "kernel" : "user space") + ".");
+                }
+
+            } else if (command == Verb::Stats) {
+                sendResponse(conn, renderStats());
 
-            } else if (command == "QUIT") {
+            } else if (command == Verb::Quit) {
                 log("Client sent QUIT. Disconnecting.");
                 break;
             } else {
-                sendResponse(clientSocket, "ERROR Unknown command.");
+                sendResponse(conn, "ERROR Unknown command.");
             }
+            metrics.commandLatencyUs[kind].record(elapsedUs(commandStart));
         }
     } catch (const std::exception& e) {
-        log(std::string("Error handling client: ") + e.what());
+        logAt(LogLevel::Error, std::string("Error handling client: ") + e.what());
     }
 
-    CLOSE_SOCKET(clientSocket);
+    deadline.stop();
+    conn.close();
+    metrics.zeroCopyFrames.add(conn.zeroCopyFrames());
+    metrics.zeroCopyCopied.add(conn.zeroCopyCopied());
+    if (!sessionUser.empty()) releaseUserSession(sessionUser);
+    metrics.activeConnections.fetch_sub(1);
     log("Client connection closed.");
 }
 
 /**
- * @brief Initializes platform-specific networking (e.g., Winsock).
- * @return 0 on success, -1 on failure.
+ * @brief Thread entry for an accepted connection: waits for a session slot
+ * if it was queued, serves the client, then returns its admission slots.
  */
-int initialize_networking() {
-#ifdef _WIN32
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        log("WSAStartup failed.");
-        return -1;
+void serveConnection(SocketType clientSocket, std::string clientAddr, bool queued) {
+    bool admitted = !queued || waitForSessionSlot();
+    if (!admitted || metrics.draining.load()) {
+        // While draining, the client's immediate retry reaches the successor
+        rejectConnection(clientSocket, metrics.draining.load() ? DRAIN_REPLY : busyReply());
+        releaseConnection(clientAddr, admitted);
+    } else {
+        handle_client(clientSocket, clientAddr);
+        releaseConnection(clientAddr, true);
     }
-#endif
-    return 0;
+    metrics.sessionThreads.fetch_sub(1);
 }
 
 /**
- * @brief Cleans up platform-specific networking.
+ * @brief Opens the service listener on the configured port.
+ * @return The socket, or INVALID_SOCKET_HANDLE after logging why not.
  */
-void cleanup_networking() {
-#ifdef _WIN32
-    WSACleanup();
-#endif
+SocketType openListenSocket() {
+    SocketType serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (serverSocket == -1) { // Or INVALID_SOCKET for Winsock
+        logAt(LogLevel::Error, "Failed to create socket.");
+        return INVALID_SOCKET_HANDLE;
+    }
+
+    // Rebind immediately after a restart instead of waiting out TIME_WAIT.
+    int reuse = 1;
+    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+    sockaddr_in serverAddr;
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(static_cast<uint16_t>(config().port));
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(serverSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
+        logAt(LogLevel::Error, "Bind failed.");
+        CLOSE_SOCKET(serverSocket);
+        return INVALID_SOCKET_HANDLE;
+    }
+
+    if (listen(serverSocket, static_cast<int>(config().listenBacklog)) < 0) {
+        logAt(LogLevel::Error, "Listen failed.");
+        CLOSE_SOCKET(serverSocket);
+        return INVALID_SOCKET_HANDLE;
+    }
+    // Shared with a successor during a hand-off: whichever process loses the
+    // race for a connection must not block in accept().
+    setBlocking(serverSocket, false);
+    return serverSocket;
 }
 
-int main() {
-    if (initialize_networking() != 0) {
+#ifndef FILESHARE_NO_MAIN // Defined when linking server code into benchmarks
+int main(int argc, char** argv) {
+#ifndef _WIN32
+    blockServerSignals();
+#endif
+    configSource.path = CONFIG_FILE;
+    bool printConfig = false;
+    bool takeover = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--config" && i + 1 < argc) {
+            configSource.path = argv[++i];
+            configSource.required = true;
+        } else if (arg == "--print-config") {
+            printConfig = true;
+        } else if (arg == "--takeover") {
+            takeover = true;
+        } else if (arg == "--hash-password" && i + 1 < argc) {
+            // Reads the password from stdin and prints the line to add to the credentials file.
+            std::string user = argv[++i], password;
+            std::getline(std::cin, password);
+            std::string encoded = hashPassword(password);
+            if (encoded.empty() || user.find(':') != std::string::npos) return 1;
+            std::cout << user << ":" << encoded << std::endl;
+            return 0;
+        } else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+            // Any setting: --name VALUE or --name=VALUE, with - for _ in the name.
+            std::string name = arg.substr(2), value;
+            size_t equals = name.find('=');
+            if (equals != std::string::npos) {
+                value = name.substr(equals + 1);
+                name.resize(equals);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            }
+            std::replace(name.begin(), name.end(), '-', '_');
+            if (name == "profile") name = "tuning_profile";     // Older spellings
+            if (name == "zerocopy") name = "zerocopy_threshold";
+            configSource.overrides.emplace_back(name, value);
+        } else {
+            std::cerr << "Usage: server [--config FILE] [--print-config] [--takeover] [--hash-password USER]"
+                         " [--SETTING VALUE]...\n"
+                         "  SETTING is any name from the config file, e.g. --tuning-profile bulk;"
+                         " --print-config lists them.\n";
+            return 1;
+        }
+    }
+
+    auto initial = std::make_shared<ServerConfig>();
+    std::string configError;
+    if (!buildConfig(configSource, *initial, configError)) {
+        std::cerr << "Invalid configuration: " << configError << std::endl;
         return 1;
     }
+    if (printConfig) {
+        std::cout << formatConfig(*initial);
+        return 0;
+    }
+    publishConfig(std::move(initial));
+    applyRateLimits(config());
 
-    // Ensure server files directory exists
-    if (!std::filesystem::exists(SERVER_FILES_DIR)) {
-        std::filesystem::create_directory(SERVER_FILES_DIR);
-        log("Created directory: " + std::string(SERVER_FILES_DIR));
+    if (initialize_networking() != 0) {
+        logAt(LogLevel::Error, "WSAStartup failed.");
+        return 1;
     }
 
-    SocketType serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverSocket == -1) { // Or INVALID_SOCKET for Winsock
-        log("Failed to create socket.");
+    // --takeover: the sockets of the server being replaced, which keeps
+    // accepting until this one is ready and acknowledges them below.
+    SocketType predecessor = INVALID_SOCKET_HANDLE;
+    std::vector<SocketType> inherited;
+    if (takeover && !takeOver(predecessor, inherited)) {
+        logAt(LogLevel::Error, "The server at " + config().handoffSocket + " did not hand over its sockets.");
         cleanup_networking();
         return 1;
     }
+    if (takeover && inherited.empty()) {
+        logAt(LogLevel::Warn, "No server to take over at " + config().handoffSocket + "; starting fresh.");
+    }
 
-    sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(PORT);
-    serverAddr.sin_addr.s_addr = INADDR_ANY;
-
-    if (bind(serverSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
-        log("Bind failed.");
-        CLOSE_SOCKET(serverSocket);
+    // Ensure server files directory exists
+    const std::string& filesDir = config().filesDir;
+    if (!std::filesystem::exists(filesDir)) {
+        std::filesystem::create_directory(filesDir);
+        log("Created directory: " + filesDir);
+    }
+    if (inherited.empty()) removeStaleUploads(filesDir);   // Else the predecessor's are still in flight
+    ensureCredentialsFile();
+    std::string credentialsError;
+    if (!credentials().load(config().credentialsFile, credentialsError)) {
+        logAt(LogLevel::Error, "Cannot load accounts: " + credentialsError);
+        cleanup_networking();
+        return 1;
+    }
+    std::thread(credentialsReloadLoop).detach();
+    if (!sessionTickets().loadOrCreateKey(config().ticketKeyFile)) {
+        logAt(LogLevel::Warn, "Cannot load or create " + config().ticketKeyFile + "; RESUME is disabled.");
+    }
+    if (!fileCatalog().open(filesDir, isServedName)) {
+        logAt(LogLevel::Error, "Cannot open the versions directory in " + filesDir + ".");
         cleanup_networking();
         return 1;
     }
 
-    if (listen(serverSocket, 5) < 0) {
-        log("Listen failed.");
-        CLOSE_SOCKET(serverSocket);
+    auto indexStart = std::chrono::steady_clock::now();
+    if (fileIndex().open(filesDir)) {
+        log("File index: " + std::to_string(fileIndex().entries()) + " entries loaded in " +
+            std::to_string(elapsedUs(indexStart)) + " us.");
+        std::thread(indexScannerLoop).detach();
+    } else {
+        logAt(LogLevel::Warn, "File index unavailable; serving without it.");
+    }
+
+    SocketType serverSocket = inherited.empty() ? openListenSocket() : inherited[0];
+    SocketType metricsSocket = inherited.size() > 1 ? inherited[1] : INVALID_SOCKET_HANDLE;
+    if (serverSocket == INVALID_SOCKET_HANDLE) {
         cleanup_networking();
         return 1;
     }
 
-    log("Server listening on port " + std::to_string(PORT) + "...");
+    log("Server " + std::string(inherited.empty() ? "listening" : "took over listening") + " on port " +
+        std::to_string(config().port) + " (tuning profile '" + config().tuning->name + "')...");
+    metrics.listenSocket.store(serverSocket);
 
-    while (true) {
+    if (config().metricsPort == 0 && metricsSocket != INVALID_SOCKET_HANDLE) {
+        CLOSE_SOCKET(metricsSocket);
+        metricsSocket = INVALID_SOCKET_HANDLE;
+    } else if (config().metricsPort != 0 && metricsSocket == INVALID_SOCKET_HANDLE) {
+        metricsSocket = openMetricsSocket();
+    }
+    if (metricsSocket != INVALID_SOCKET_HANDLE) {
+        std::thread(metricsServerLoop, metricsSocket).detach();
+    }
+
+#ifndef _WIN32
+    SocketType handoffListener = listenForHandoff(config().handoffSocket);
+    if (handoffListener == INVALID_SOCKET_HANDLE) {
+        logAt(LogLevel::Warn, "Cannot listen on " + config().handoffSocket +
+              "; --takeover cannot replace this server.");
+    } else {
+        std::vector<SocketType> listeners = {serverSocket};
+        if (metricsSocket != INVALID_SOCKET_HANDLE) listeners.push_back(metricsSocket);
+        std::thread(handoffLoop, handoffListener, listeners).detach();
+    }
+    std::thread(signalLoop).detach();
+#endif
+    if (predecessor != INVALID_SOCKET_HANDLE) {
+        sendHandoffAck(predecessor);  // The old server stops accepting and drains
+        CLOSE_SOCKET(predecessor);
+    }
+
+    while (!metrics.draining.load()) {
+        refreshConfig();              // Keeps the accept thread's snapshot from pinning an old one
+        if (!waitReadable(serverSocket, ACCEPT_POLL_MS)) continue;
         sockaddr_in clientAddr;
         int clientAddrSize = sizeof(clientAddr);
         SocketType clientSocket = accept(serverSocket, (sockaddr*)&clientAddr, (socklen_t*)&clientAddrSize);
 
         if (clientSocket < 0) { // Or INVALID_SOCKET
-            log("Accept failed.");
+            // Would-block: the other process took it during a hand-off.
+            if (!lastErrorWouldBlock()) logAt(LogLevel::Warn, "Accept failed.");
+            continue;
+        }
+        setBlocking(clientSocket, true);   // Some platforms inherit the listener's mode
+
+        char addressText[INET_ADDRSTRLEN] = "unknown";
+        inet_ntop(AF_INET, &clientAddr.sin_addr, addressText, sizeof(addressText));
+        std::string address(addressText);
+
+        Admission admitted = admitConnection(address);
+        if (admitted == Admission::Rejected) {
+            rejectConnection(clientSocket, busyReply()); // Fast path: no thread for a shed connection
             continue;
         }
 
         // Create a new thread to handle this client
-        std::thread clientThread(handle_client, clientSocket);
+        metrics.sessionThreads.fetch_add(1);
+        std::thread clientThread(serveConnection, clientSocket, address, admitted == Admission::Queued);
         clientThread.detach(); // Detach the thread to run independently
     }
 
+    // Connections not yet accepted stay queued for the successor, if any;
+    // without one, closing the listener refuses them.
+    metrics.listenSocket.store(INVALID_SOCKET_HANDLE);
     CLOSE_SOCKET(serverSocket);
+    bool drained = drainSessions();
     cleanup_networking();
-    return 0;
-}
\ No newline at end of file
+    logger().stop();
+    std::_Exit(drained ? 0 : 1);      // Detached threads may still run: skip static destructors
+}
+#endif // FILESHARE_NO_MAIN